@@ -148,6 +148,11 @@ struct vtuner_signal {
 	struct vtuner_dtv_fe_stats block_count;
 } __attribute__ ((packed));
 
+struct vtuner_status {
+	u8 tune_id;
+	u8 status;
+} __attribute__ ((packed));
+
 #define VTUNER_MAX_DELSYS 8
 
 struct vtuner_delsys {
@@ -178,5 +183,6 @@ struct vtuner_sids {
 #define VTUNER_SET_DELSYS	_IOW(VTUNER_MAJOR, 4, struct vtuner_delsys)
 #define VTUNER_SET_CAIDS	_IOW(VTUNER_MAJOR, 5, struct vtuner_caids)
 #define VTUNER_SET_SIDS		_IOW(VTUNER_MAJOR, 6, struct vtuner_sids)
+#define VTUNER_SET_STATUS	_IOW(VTUNER_MAJOR, 7, struct vtuner_status)
 #endif
 
@@ -33,6 +33,7 @@
 #define KERNEL_DELSYS_LEN (sizeof(((struct dvb_frontend_ops *)0)->delsys))
 #define VTUNER_CAIDS_LEN (sizeof(struct vtuner_caids))
 #define VTUNER_SIDS_LEN (sizeof(struct vtuner_sids))
+#define VTUNER_STATUS_LEN (sizeof(struct vtuner_status))
 
 static ssize_t vtunerc_ctrldev_write(struct file *filp, const char *buff, size_t len, loff_t *off)
 {
@@ -281,6 +282,7 @@ static long vtunerc_ctrldev_ioctl(struct file *file, unsigned int cmd, unsigned
 	struct vtunerc_cainfo *ca = NULL;
 	struct vtuner_caids caids;
 	struct vtuner_sids sids;
+	struct vtuner_status status;
 	int ret = 0, i, hdr;
 
 	if (down_interruptible(&ctx->ioctl_sem))
@@ -294,6 +296,19 @@ static long vtunerc_ctrldev_ioctl(struct file *file, unsigned int cmd, unsigned
 		dvb_proxyfe_set_signal(ctx);
 		break;
 
+	case VTUNER_SET_STATUS:
+		if (copy_from_user(&status, (char *)arg, VTUNER_STATUS_LEN)) {
+			ret = -EFAULT;
+			break;
+		}
+		// ignore status of a previous tuning
+		if (!status.tune_id || status.tune_id == ctx->tune_id) {
+			if (ctx->status != status.status)
+				dprintk(ctx, "set signal 0x%02x id=%i\n", status.status, status.tune_id);
+			ctx->status = status.status;
+		}
+		break;
+
 	case VTUNER_GET_MESSAGE:
 		if (wait_event_interruptible(ctx->ctrldev_wait_request_wq, ctx->ctrldev_request.type != -1)) {
 			ret = -ERESTARTSYS;
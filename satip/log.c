@@ -19,76 +19,362 @@
 #include <string.h>
 #include <syslog.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
 
 #define MAX_MSGSIZE 1024
 #include "log.h"
 
-__thread char msg[MAX_MSGSIZE];
+/*
+ * Every thread formats its messages into an own ring, a single producer
+ * single consumer queue needing no lock. A writer thread drains the rings
+ * in order of a global sequence number, does the time formatting and the
+ * blocking output, and keeps the last messages for a crash dump. It sleeps
+ * on an eventfd, signalled when a ring gets a message while empty.
+ * Before the writer is started messages are written synchronously.
+ */
+#define LOG_RING_SLOTS  64    /* power of 2 */
+#define LOG_MAX_RINGS   32
+#define LOG_RECORDER    128
+
+typedef struct log_entry {
+  unsigned long seq;
+  struct timespec ts;
+  unsigned int mtype;
+  int level;
+  int len;
+  char text[MAX_MSGSIZE];
+} t_log_entry;
+
+typedef struct log_ring {
+  unsigned int head;          /* written by the owning thread */
+  unsigned int tail;          /* written by the writer */
+  unsigned long dropped;      /* ring full, written by the owning thread */
+  unsigned long reported;
+  t_log_entry slot[LOG_RING_SLOTS];
+} t_log_ring;
+
+unsigned int log_filter = LOG_BIT(MSG_MAIN | MSG_NET, MSG_ERROR);
+int log_pid = 0;
+
+static __thread t_log_ring* thread_ring;
+static t_log_ring* rings[LOG_MAX_RINGS];
+static int ring_count = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long log_seq = 0;
+static int writer_running = 0;
+static int writer_fd = -1;
+
+static t_log_entry recorder[LOG_RECORDER];
+static unsigned int recorder_count = 0;
+static const char* crash_path;
 
 static struct sockaddr_in udplog_saddr;
 static int udplog_fd = -1;
 static int udplog_enabled = 0;
 
+static void output_message(const int level, const struct timespec* ts, const char* text, int len)
+{
+  if(use_syslog) {
+    int priority;
+    switch(level) {
+      case 1: priority=LOG_ERR; break;
+      case 2: priority=LOG_WARNING; break;
+      case 3: priority=LOG_INFO; break;
+      default: priority=LOG_DEBUG; break;
+    }
+    syslog(priority, "%s", text);
+  } else {
+    char buff[20];
+    struct tm sTm;
+    time_t now = ts->tv_sec;
+    localtime_r(&now, &sTm);
+    strftime (buff, sizeof(buff), "%b %d %H:%M:%S", &sTm);
+    fprintf(stderr, "%s %s", buff, text);
+  }
+
+  if(udplog_fd > -1 && udplog_enabled)
+    sendto(udplog_fd, text, len, 0, (const struct sockaddr *)&udplog_saddr, sizeof(udplog_saddr));
+}
+
+static int format_message(char* text, const char* fmt, va_list ap)
+{
+  int len = vsnprintf(text, MAX_MSGSIZE, fmt, ap);
+
+  if ( len < 0 )
+    len = 0;
+  else if ( len >= MAX_MSGSIZE )
+    len = MAX_MSGSIZE-1;
+  return len;
+}
+
+static t_log_ring* ring_register(void)
+{
+  t_log_ring* ring = NULL;
+
+  pthread_mutex_lock(&ring_lock);
+  if ( ring_count < LOG_MAX_RINGS )
+    {
+      ring = calloc(1, sizeof(t_log_ring));
+      if ( ring != NULL )
+	{
+	  rings[ring_count] = ring;
+	  __atomic_store_n(&ring_count, ring_count+1, __ATOMIC_RELEASE);
+	}
+    }
+  pthread_mutex_unlock(&ring_lock);
+
+  thread_ring = ring;
+  return ring;
+}
+
 void write_message(const unsigned int mtype, const int level, const char* fmt, ... ) {
-  if( !(mtype & dbg_mask ) )
-    return;
+  t_log_ring* ring = thread_ring;
+  t_log_entry* e;
+  unsigned int head;
+  va_list ap;
 
-  if( level <= dbg_level ) {
-    char tn[MAX_MSGSIZE];
-    va_list ap;
+  if ( !__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ) {
+    char text[MAX_MSGSIZE];
+    struct timespec ts;
+    int len;
+
+    if ( level > dbg_level || !(mtype & dbg_mask) )
+      return;
+    clock_gettime(CLOCK_REALTIME, &ts);
     va_start(ap, fmt);
-    vsnprintf(tn, sizeof(tn), fmt, ap);
+    len = format_message(text, fmt, ap);
     va_end(ap);
-    strncat(msg, tn, sizeof(msg)-1);
-
-    if(use_syslog) {
-      int priority;
-      switch(level) {
-        case 1: priority=LOG_ERR; break;
-        case 2: priority=LOG_WARNING; break;
-        case 3: priority=LOG_INFO; break;
-        default: priority=LOG_DEBUG; break;
+    output_message(level, &ts, text, len);
+    return;
+  }
+
+  if ( ring == NULL && (ring = ring_register()) == NULL )
+    return;
+
+  /* never block the caller, a full ring loses the message */
+  head = ring->head;
+  if ( head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS ) {
+    __atomic_store_n(&ring->dropped, ring->dropped+1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  e = &ring->slot[head & (LOG_RING_SLOTS-1)];
+  e->seq = __atomic_fetch_add(&log_seq, 1, __ATOMIC_RELAXED);
+  clock_gettime(CLOCK_REALTIME, &e->ts);
+  e->mtype = mtype;
+  e->level = level;
+  va_start(ap, fmt);
+  e->len = format_message(e->text, fmt, ap);
+  va_end(ap);
+
+  __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+
+  /* pairs with the fence in log_drain(), either side sees the other */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ( (int)(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) <= 0 ) {
+    uint64_t one = 1;
+
+    if ( write(writer_fd, &one, sizeof(one)) < 0 )
+      return;
+  }
+}
+
+/* write out all queued messages, oldest first over all threads */
+static void log_drain(void)
+{
+  pthread_mutex_lock(&drain_lock);
+
+  for (;;) {
+    int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+    t_log_ring* next = NULL;
+    t_log_entry* e;
+    unsigned long dropped;
+    int i;
+
+    for ( i=0; i<count; i++ ) {
+      t_log_ring* ring = rings[i];
+
+      dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+      if ( dropped != ring->reported ) {
+	char text[64];
+	struct timespec ts;
+	int len;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	len = snprintf(text, sizeof(text), "[%d] log: %lu messages dropped\n", log_pid, dropped - ring->reported);
+	output_message(MSG_WARN, &ts, text, len);
+	ring->reported = dropped;
       }
-      syslog(priority, "%s", msg);
-    } else {
-      char buff[20];
-      struct tm *sTm;
-      time_t now = time(0);
-      sTm = localtime(&now);
-      strftime (buff, sizeof(buff), "%b %d %H:%M:%S", sTm);
-      fprintf(stderr, "%s %s", buff, msg);
+
+      if ( ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) )
+	continue;
+      if ( next == NULL ||
+	   ring->slot[ring->tail & (LOG_RING_SLOTS-1)].seq < next->slot[next->tail & (LOG_RING_SLOTS-1)].seq )
+	next = ring;
     }
 
-    if(udplog_fd > -1 && udplog_enabled)
-      sendto(udplog_fd, msg, strlen(msg), 0, (const struct sockaddr *)&udplog_saddr, sizeof(udplog_saddr));
+    if ( next == NULL )
+      break;
+
+    e = &next->slot[next->tail & (LOG_RING_SLOTS-1)];
+    if ( e->level <= dbg_level && (e->mtype & dbg_mask) )
+      output_message(e->level, &e->ts, e->text, e->len);
+
+    recorder[recorder_count % LOG_RECORDER] = *e;
+    __atomic_store_n(&recorder_count, recorder_count+1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&next->tail, next->tail+1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
   }
 
-  strncpy(msg, "", sizeof(msg));
+  if ( !use_syslog )
+    fflush(stderr);
+
+  pthread_mutex_unlock(&drain_lock);
 }
 
-void init_message(const char* fmt, ... ) {
-  va_list ap;
-  va_start(ap, fmt);
-  vsnprintf(msg, sizeof(msg), fmt, ap);
-  va_end(ap);
+static void* log_writer(void* param)
+{
+  uint64_t events;
+
+  (void)param;
+  prctl(PR_SET_NAME, "satip-log", 0, 0, 0);
+
+  for (;;) {
+    if ( read(writer_fd, &events, sizeof(events)) < 0 && errno != EINTR )
+      break;
+    log_drain();
+  }
+  return NULL;
 }
 
-void append_message(const char* fmt, ... ) {
-  char tn[MAX_MSGSIZE]; 
-  va_list ap;
+static void crash_write(int fd, const char* text, int len)
+{
+  while ( len > 0 ) {
+    ssize_t n = write(fd, text, len);
+    if ( n <= 0 )
+      break;
+    text += n;
+    len -= n;
+  }
+}
 
-  va_start(ap, fmt);
-  vsnprintf(tn, sizeof(tn), fmt, ap);
-  va_end(ap);
+static void crash_dump(int fd, int sig)
+{
+  char head[64] = "satip: crashed by signal ";
+  char num[12];
+  unsigned int count = __atomic_load_n(&recorder_count, __ATOMIC_ACQUIRE);
+  unsigned int i;
+  int n = 0, k;
+
+  /* async signal safe only from here */
+  do {
+    num[n++] = '0' + sig % 10;
+    sig /= 10;
+  } while ( sig > 0 );
+  k = strlen(head);
+  while ( n > 0 )
+    head[k++] = num[--n];
+  head[k++] = '\n';
+  crash_write(fd, head, k);
+
+  for ( i = count > LOG_RECORDER ? count-LOG_RECORDER : 0; i < count; i++ )
+    crash_write(fd, recorder[i % LOG_RECORDER].text, recorder[i % LOG_RECORDER].len);
+
+  /* not yet written, per thread */
+  for ( k=0; k<__atomic_load_n(&ring_count, __ATOMIC_ACQUIRE); k++ ) {
+    t_log_ring* ring = rings[k];
+    unsigned int head_pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    for ( i = ring->tail; i != head_pos; i++ )
+      crash_write(fd, ring->slot[i & (LOG_RING_SLOTS-1)].text, ring->slot[i & (LOG_RING_SLOTS-1)].len);
+  }
+}
+
+static void crash_handler(int sig)
+{
+  int fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
 
-  strncat(msg, tn, sizeof(msg)-1);
-}  
+  if ( fd >= 0 ) {
+    crash_dump(fd, sig);
+    close(fd);
+  }
+  if ( !use_syslog )
+    crash_dump(STDERR_FILENO, sig);
+
+  /* handler was reset, die by the default action */
+  raise(sig);
+}
+
+/*
+ * filter from dbg_level and dbg_mask, messages up to recorder_level
+ * of any type are formatted for the crash dump too
+ */
+void log_configure(int recorder_level) {
+  unsigned int filter = 0;
+  int level;
+
+  for ( level = MSG_ERROR; level <= MSG_DEBUG; level++ ) {
+    unsigned int mask = 0;
+
+    if ( level <= dbg_level )
+      mask |= dbg_mask;
+    if ( level <= recorder_level )
+      mask |= MSG_ALL;
+    filter |= LOG_BIT(mask, level);
+  }
+
+  log_filter = filter;
+  log_pid = getpid();
+}
+
+int log_start_writer(const char* crash_file) {
+  static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+  struct sigaction sa;
+  pthread_t writer;
+  unsigned int i;
+
+  if ( writer_running )
+    return 0;
+
+  writer_fd = eventfd(0, EFD_CLOEXEC);
+  if ( writer_fd < 0 || pthread_create(&writer, NULL, log_writer, NULL) ) {
+    ERROR(MSG_MAIN, "cannot start log writer, logging synchronously\n");
+    if ( writer_fd >= 0 )
+      close(writer_fd);
+    writer_fd = -1;
+    return -1;
+  }
+  pthread_detach(writer);
+  __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+  atexit(log_drain);
+
+  if ( crash_file != NULL ) {
+    crash_path = crash_file;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for ( i=0; i<sizeof(crash_signals)/sizeof(crash_signals[0]); i++ )
+      sigaction(crash_signals[i], &sa, NULL);
+  }
+
+  return 0;
+}
 
 int open_udplog(char *ipaddr, int portnum) {
 
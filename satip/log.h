@@ -36,12 +36,23 @@ extern int use_syslog;
 #define MSG_INFO	3
 #define MSG_DEBUG	4
 
-#define ERROR(mtype, msg, ...) write_message(mtype, MSG_ERROR, "[%d %s:%u] error: " msg, getpid(), __FILE__, __LINE__, ## __VA_ARGS__)
-#define  WARN(mtype, msg, ...) write_message(mtype, MSG_WARN,  "[%d %s:%u]  warn: " msg, getpid(), __FILE__, __LINE__, ## __VA_ARGS__)
-#define  INFO(mtype, msg, ...) write_message(mtype, MSG_INFO,  "[%d %s:%u]  info: " msg, getpid(), __FILE__, __LINE__, ## __VA_ARGS__)
-#define DEBUG(mtype, msg, ...) write_message(mtype, MSG_DEBUG, "[%d %s:%u] debug: " msg, getpid(), __FILE__, __LINE__, ## __VA_ARGS__)
+/* one bit per type and level, so a filtered message costs a single test */
+#define LOG_BIT(mtype, level)  ((unsigned int)(mtype) << (4*((level)-1)))
+
+extern unsigned int log_filter;
+extern int log_pid;
+
+#define LOG_MESSAGE(mtype, level, msg, ...) \
+  do { if ( __builtin_expect(log_filter & LOG_BIT(mtype, level), 0) ) write_message(mtype, level, msg, ## __VA_ARGS__); } while (0)
+
+#define ERROR(mtype, msg, ...) LOG_MESSAGE(mtype, MSG_ERROR, "[%d %s:%u] error: " msg, log_pid, __FILE__, __LINE__, ## __VA_ARGS__)
+#define  WARN(mtype, msg, ...) LOG_MESSAGE(mtype, MSG_WARN,  "[%d %s:%u]  warn: " msg, log_pid, __FILE__, __LINE__, ## __VA_ARGS__)
+#define  INFO(mtype, msg, ...) LOG_MESSAGE(mtype, MSG_INFO,  "[%d %s:%u]  info: " msg, log_pid, __FILE__, __LINE__, ## __VA_ARGS__)
+#define DEBUG(mtype, msg, ...) LOG_MESSAGE(mtype, MSG_DEBUG, "[%d %s:%u] debug: " msg, log_pid, __FILE__, __LINE__, ## __VA_ARGS__)
 
 void write_message(const unsigned int, const int, const char*, ...);
+void log_configure(int recorder_level);
+int log_start_writer(const char* crash_file);
 int open_udplog(char *, int );
 void udplog_enable(int);
 #endif
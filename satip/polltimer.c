@@ -21,34 +21,39 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include "polltimer.h"
 
-static long starttime=0;
-
 
 typedef struct polltimer {
-  struct polltimer* next;
   struct timespec ts;
   void (*timer_handler) (void*);
   void* param;
+  int period;              /* msec, 0 = one shot */
+  int index;               /* position in heap, -1 = not queued */
+  struct polltimer* next;  /* free list */
 } t_polltimer;
 
 
-
-typedef struct polltimer_periodic {
-  struct timespec ts;
-  t_polltimer** queue_head;
-  void (*timer_handler) (void*);
-  int msec;
-  void* param;
-} t_polltimer_periodic;
+/* min-heap on expiry time */
+typedef struct polltimer_queue {
+  t_polltimer** heap;
+  int count;
+  int size;
+  t_polltimer* free;
+  t_polltimer* running;    /* handler being called */
+  int timerfd;
+  struct timespec armed;   /* expiry the timerfd is set to */
+} t_polltimer_queue;
 
 
 
 static void expire_msec(struct timespec* ts,int msec)
 {
   ts->tv_nsec +=  (msec%1000)*1000000;
-  if ( ts->tv_nsec>1000000000 )
+  if ( ts->tv_nsec>=1000000000 )
     {
       ts->tv_nsec -= 1000000000;
       ts->tv_sec  += 1;
@@ -56,143 +61,256 @@ static void expire_msec(struct timespec* ts,int msec)
   ts->tv_sec  +=  msec/1000;
 }
 
+static int before(const struct timespec* a, const struct timespec* b)
+{
+  return ( a->tv_sec < b->tv_sec ||
+	   ( a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec ) );
+}
 
-static t_polltimer* queue_timer(t_polltimer** queue_head,
-				struct timespec* ts,
-				void (*timer_handler)(void *), 
-				void* param)
+
+/* add count nodes to the pool, only again if it was sized too small */
+static int grow_pool(t_polltimer_queue* queue, int count)
 {
-  t_polltimer* newtimer;
-  t_polltimer** current = queue_head;
+  t_polltimer* nodes;
+  t_polltimer** heap;
+  int i;
 
-  newtimer=(t_polltimer*)malloc(sizeof(t_polltimer));
-  newtimer->next=NULL;
-  newtimer->ts=*ts;
-  newtimer->param=param;
-  newtimer->timer_handler=timer_handler;
+  nodes = (t_polltimer*)calloc(count, sizeof(t_polltimer));
+  heap = (t_polltimer**)realloc(queue->heap, (queue->size+count)*sizeof(t_polltimer*));
+  if ( nodes == NULL || heap == NULL )
+    {
+      free(nodes);
+      if ( heap != NULL )
+	queue->heap = heap;
+      return -1;
+    }
+
+  for ( i=0; i<count; i++ )
+    {
+      nodes[i].index = -1;
+      nodes[i].next = queue->free;
+      queue->free = &nodes[i];
+    }
 
-  while ( *current != NULL )
-    if ( (*current)->ts.tv_sec > ts->tv_sec ||
-	 ((*current)->ts.tv_sec == ts->tv_sec && (*current)->ts.tv_nsec > ts->tv_nsec) )
-      {
-	newtimer->next=*current;
-	*current = newtimer;
-	return newtimer;
-      }
-    else
-      current=&( (*current)->next );
+  queue->heap = heap;
+  queue->size += count;
+  return 0;
+}
 
-  /* last in queue */
-  *current = newtimer;
+t_polltimer_queue* polltimer_queue_new(int size, int use_timerfd)
+{
+  t_polltimer_queue* queue;
 
-  return newtimer;
+  queue = (t_polltimer_queue*)calloc(1, sizeof(t_polltimer_queue));
+  queue->timerfd = -1;
+
+  if ( grow_pool(queue, size > 0 ? size : 16) )
+    {
+      free(queue);
+      return NULL;
+    }
+
+  if ( use_timerfd )
+    queue->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+
+  return queue;
+}
+
+
+static void place(t_polltimer_queue* queue, t_polltimer* timer, int index)
+{
+  queue->heap[index] = timer;
+  timer->index = index;
 }
 
-static void periodic_handler(void* param)
+static void sift_up(t_polltimer_queue* queue, int index)
 {
-  t_polltimer_periodic* periodic = (t_polltimer_periodic*) param;
+  t_polltimer* timer = queue->heap[index];
+  int parent;
 
-  /* call callback function */
-  (periodic->timer_handler) ( periodic->param );
+  while ( index > 0 )
+    {
+      parent = (index-1)/2;
+      if ( !before(&timer->ts, &queue->heap[parent]->ts) )
+	break;
+      place(queue, queue->heap[parent], index);
+      index = parent;
+    }
+  place(queue, timer, index);
+}
 
-  /* set next expiry */
-  expire_msec(&periodic->ts,periodic->msec);
+static void sift_down(t_polltimer_queue* queue, int index)
+{
+  t_polltimer* timer = queue->heap[index];
+  int child;
 
-  /* queue next */
-  queue_timer(periodic->queue_head,
-	      &periodic->ts,
-	      periodic_handler,
-	      (void*)periodic);
+  while ( ( child = 2*index+1 ) < queue->count )
+    {
+      if ( child+1 < queue->count &&
+	   before(&queue->heap[child+1]->ts, &queue->heap[child]->ts) )
+	child++;
+      if ( !before(&queue->heap[child]->ts, &timer->ts) )
+	break;
+      place(queue, queue->heap[child], index);
+      index = child;
+    }
+  place(queue, timer, index);
 }
 
+/* keep the timerfd on the earliest expiry */
+static void arm_timerfd(t_polltimer_queue* queue)
+{
+  struct itimerspec its;
+
+  if ( queue->timerfd < 0 )
+    return;
+
+  memset(&its, 0, sizeof(its));
+  if ( queue->count > 0 )
+    its.it_value = queue->heap[0]->ts;
+
+  if ( its.it_value.tv_sec == queue->armed.tv_sec &&
+       its.it_value.tv_nsec == queue->armed.tv_nsec )
+    return;
 
-void  polltimer_periodic_start(t_polltimer** queue_head,
-			       struct polltimer_periodic** periodic,
-			       void (*timer_handler)(void*), 
-			       int msec,void* param)
+  queue->armed = its.it_value;
+  timerfd_settime(queue->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void push(t_polltimer_queue* queue, t_polltimer* timer)
 {
-  *periodic=(t_polltimer_periodic*)
-    malloc(sizeof(t_polltimer_periodic));
- 
-  /* base time for this periodic timer */
-  clock_gettime(CLOCK_REALTIME,&(*periodic)->ts);
+  place(queue, timer, queue->count++);
+  sift_up(queue, timer->index);
+  if ( timer->index == 0 )
+    arm_timerfd(queue);
+}
+
+static void remove_timer(t_polltimer_queue* queue, t_polltimer* timer)
+{
+  int index = timer->index;
+  t_polltimer* last = queue->heap[--queue->count];
+
+  timer->index = -1;
+
+  if ( last != timer )
+    {
+      place(queue, last, index);
+      sift_up(queue, index);
+      sift_down(queue, last->index);
+    }
+
+  if ( index == 0 )
+    arm_timerfd(queue);
+}
+
+static t_polltimer* queue_timer(t_polltimer_queue* queue,
+				struct timespec* ts,
+				void (*timer_handler)(void *), 
+				int period, void* param)
+{
+  t_polltimer* newtimer;
+
+  if ( queue->free == NULL && grow_pool(queue, queue->size) )
+    return NULL;
 
-  /* for dumping time stamps */
-  if ( starttime == 0 )
-    starttime=(*periodic)->ts.tv_sec;
+  newtimer = queue->free;
+  queue->free = newtimer->next;
 
-  /* store parameters */
-  (*periodic)->queue_head = queue_head;
-  (*periodic)->timer_handler = timer_handler;
-  (*periodic)->msec = msec;
-  (*periodic)->param = param;
+  newtimer->ts=*ts;
+  newtimer->param=param;
+  newtimer->timer_handler=timer_handler;
+  newtimer->period=period;
+
+  push(queue, newtimer);
+
+  return newtimer;
+}
+
+
+
+t_polltimer* polltimer_periodic_start(t_polltimer_queue* queue,
+				      void (*timer_handler)(void*), 
+				      int msec,void* param)
+{
+  struct timespec ts;
+
+  /* base time for this periodic timer */
+  clock_gettime(CLOCK_MONOTONIC,&ts);
 
   /* set first expiry */
-  expire_msec(&(*periodic)->ts,msec);
+  expire_msec(&ts,msec);
   
-  queue_timer(queue_head,&(*periodic)->ts,periodic_handler,(void*)(*periodic));
+  return queue_timer(queue,&ts,timer_handler,msec,param);
 }
 
 
 
-t_polltimer* polltimer_start(t_polltimer** queue_head,
+t_polltimer* polltimer_start(t_polltimer_queue* queue,
 			     void (*timer_handler)(void *), 
 			     int msec,void* param)
 {
   struct timespec ts;
  
   /* calculate abs. time of expiry */
-  clock_gettime(CLOCK_REALTIME,&ts);
-
-  /* for dumping time stamps */
-  if ( starttime == 0 )
-    starttime=ts.tv_sec;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
 
   expire_msec(&ts,msec);
 
-  return queue_timer(queue_head,&ts,timer_handler,param);
+  return queue_timer(queue,&ts,timer_handler,0,param);
 }
 
 
 
 
-void polltimer_call_next(struct polltimer** queue_head)
+void polltimer_call_next(t_polltimer_queue* queue)
 {
   struct timespec ts;
-  t_polltimer* next;
+  t_polltimer* timer;
+  uint64_t expirations;
+
+  if ( queue->timerfd >= 0 &&
+       read(queue->timerfd, &expirations, sizeof(expirations)) < 0 )
+    expirations = 0;
 
-  clock_gettime(CLOCK_REALTIME,&ts);
+  clock_gettime(CLOCK_MONOTONIC,&ts);
 
-  while (*queue_head != NULL)
+  while ( queue->count > 0 && !before(&ts, &queue->heap[0]->ts) )
     {
-      
-      if ( (*queue_head)->ts.tv_sec<ts.tv_sec ||
-	   ( (*queue_head)->ts.tv_sec==ts.tv_sec &&
-	     (*queue_head)->ts.tv_nsec<ts.tv_nsec ) )
-	{	  
-	  /* call handler function */
-	  ((*queue_head)->timer_handler) ( (*queue_head)->param );
-
-	  next=(*queue_head)->next;
-	  free(*queue_head);
-	  *queue_head=next;
+      timer = queue->heap[0];
+
+      /* off the queue before the handler, which may start or cancel timers */
+      remove_timer(queue, timer);
+
+      /* call handler function */
+      queue->running = timer;
+      (timer->timer_handler) ( timer->param );
+      queue->running = NULL;
+
+      if ( timer->period > 0 )
+	{
+	  /* set next expiry, unless cancelled by the handler */
+	  expire_msec(&timer->ts,timer->period);
+	  push(queue, timer);
 	}
       else
-	break;
+	{
+	  timer->next = queue->free;
+	  queue->free = timer;
+	}
     }
 }
 
 
-int polltimer_next_ms(struct polltimer* queue_head)
+int polltimer_next_ms(t_polltimer_queue* queue)
 {
   struct timespec ts;  
   long msec;
 
-  if (queue_head != NULL )
+  if ( queue->count > 0 )
     {
-      clock_gettime(CLOCK_REALTIME,&ts);
-      msec = (queue_head->ts.tv_sec - ts.tv_sec)*1000 +
-	(queue_head->ts.tv_nsec - ts.tv_nsec)/1000000 +1;
+      clock_gettime(CLOCK_MONOTONIC,&ts);
+      msec = (queue->heap[0]->ts.tv_sec - ts.tv_sec)*1000 +
+	(queue->heap[0]->ts.tv_nsec - ts.tv_nsec + 999999)/1000000;
       
       return (msec<0 ? 0 : (int) msec);
     }
@@ -200,25 +318,36 @@ int polltimer_next_ms(struct polltimer* queue_head)
     return -1;
 }
 
+int polltimer_fd(t_polltimer_queue* queue)
+{
+  return queue->timerfd;
+}
 
 
-void polltimer_cancel(struct polltimer** queue_head,
-		      struct polltimer* canceltimer)
+void polltimer_cancel(t_polltimer_queue* queue,
+		      t_polltimer** timer)
 {
-  struct polltimer* current=*queue_head;
-  struct polltimer** previousnext=queue_head;
+  t_polltimer* canceltimer = *timer;
 
-  while ( current != NULL )
+  if ( canceltimer == NULL )
+    return;
+
+  /* no stale handle left to a node that goes back to the pool */
+  *timer = NULL;
+
+  /* periodic timer cancelled from its own handler */
+  if ( canceltimer == queue->running )
     {
-      if ( current == canceltimer )
-	{
-	  *previousnext=current->next;
-	  free(current);
-	  return;
-	}
-      
-      previousnext=&(current->next);
-      current=current->next;
+      canceltimer->period = 0;
+      return;
     }
-}
 
+  if ( canceltimer->index < 0 || canceltimer->index >= queue->count ||
+       queue->heap[canceltimer->index] != canceltimer )
+    return;
+
+  remove_timer(queue, canceltimer);
+
+  canceltimer->next = queue->free;
+  queue->free = canceltimer;
+}
@@ -21,27 +21,38 @@
 #define _POLLTIMER_H
 
 struct polltimer;
+struct polltimer_queue;
 
-struct polltimer* polltimer_start(struct polltimer** queue_head,
+/*
+ * timers of one thread, nodes come from a pool of size preallocated ones,
+ * with use_timerfd the queue keeps a timerfd armed for its next expiry
+ */
+struct polltimer_queue* polltimer_queue_new(int size, int use_timerfd);
+
+struct polltimer* polltimer_start(struct polltimer_queue* queue,
 				  void (*timer_handler)(void *), 
 				  int msec,void* param);
 
-void polltimer_cancel(struct polltimer** queue_head,
-		      struct polltimer* canceltimer);
-
+/*
+ * cancels *timer and clears the handle, a NULL handle is ignored; nodes
+ * are reused, handlers of one shot timers clear their handle as well
+ */
+void polltimer_cancel(struct polltimer_queue* queue,
+		      struct polltimer** timer);
 
 
-struct polltimer_periodic;
+/* restarted msec after each expiry until cancelled */
+struct polltimer* polltimer_periodic_start(struct polltimer_queue* queue,
+					   void (*timer_handler)(void *), 
+					   int msec,void* param);
 
-void  polltimer_periodic_start(struct polltimer** queue_head,
-			       struct polltimer_periodic** periodic,
-			       void (*timer_handler)(void *), 
-			       int msec,void* param);
 
+void polltimer_call_next(struct polltimer_queue* queue);
 
-void polltimer_call_next(struct polltimer** queue_head);
 
+int polltimer_next_ms(struct polltimer_queue* queue);
 
-int polltimer_next_ms(struct polltimer* queue_head);
+/* readable on expiry, -1 without timerfd */
+int polltimer_fd(struct polltimer_queue* queue);
 
 #endif
@@ -19,14 +19,22 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "satip_config.h"
 #include "log.h"
 
-/* PID handling */
-#define PID_VALID  0
-#define PID_IGNORE 1
-#define PID_ADD    2
-#define PID_DELETE 3
+/* PID handling, pids set in target but not current are to be added etc. */
+#define PID_ADD    0
+#define PID_DELETE 1
+#define PID_TARGET 2
+
+/* what satip_prepare_pids() put in the query, see pid_prepared */
+#define PIDS_MOD   1   /* addpids/delpids */
+#define PIDS_LIST  2   /* pids= */
+#define PIDS_ALL   3   /* pids=all */
+
+#define PID_WORD(pid) ((pid)>>6)
+#define PID_BIT(pid)  ((uint64_t)1 << ((pid)&63))
 
 #ifndef SYS_DVBT2
 #define SYS_DVBT2 16
@@ -66,26 +74,15 @@ t_satip_config* satip_new_config(int frontend)
 
 static void pidupdate_status(t_satip_config* cfg)
 {
-  int i;
-  int mod_found=0;
-
-  for (i=0; i<SATIPCFG_MAX_PIDS; i++)
-    if ( cfg->mod_pid[i] == PID_ADD ||
-	 cfg->mod_pid[i] == PID_DELETE )
-      {
-	mod_found=1;
-	break;
-      }
-
   switch (cfg->status)
     {
     case SATIPCFG_SETTLED:
-      if (mod_found)
+      if (cfg->pid_diff > 0)
 	cfg->status = SATIPCFG_PID_CHANGED;
       break;
 
     case SATIPCFG_PID_CHANGED:
-      if (!mod_found)
+      if (cfg->pid_diff == 0)
 	cfg->status = SATIPCFG_SETTLED;
       break;
 
@@ -96,43 +93,40 @@ static void pidupdate_status(t_satip_config* cfg)
     }
 }
 
-void satip_del_allpid(t_satip_config* cfg)
+/* after bulk changes of the target */
+static void pidupdate_diff(t_satip_config* cfg)
 {
   int i;
 
-  for ( i=0; i<SATIPCFG_MAX_PIDS; i++ )
-    satip_del_pid(cfg, cfg->pid[i]);
+  cfg->pid_diff = 0;
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    cfg->pid_diff += __builtin_popcountll(cfg->pid_target[i] ^ cfg->pid_current[i]);
+
+  pidupdate_status(cfg);
+}
+
+void satip_del_allpid(t_satip_config* cfg)
+{
+  memset(cfg->pid_target, 0, sizeof(cfg->pid_target));
+  pidupdate_diff(cfg);
 }
 
 
 int satip_del_pid(t_satip_config* cfg,unsigned short pid)
 {
-  int i;
+  if ( pid >= 8192 || !( cfg->pid_target[PID_WORD(pid)] & PID_BIT(pid) ) )
+    /* pid was not requested, ignore request */
+    return SATIPCFG_NOCHANGE;
 
-  for (i=0; i<SATIPCFG_MAX_PIDS; i++)
-    {
-      if ( cfg->pid[i] == pid )
-	switch (cfg->mod_pid[i])
-	  {
-	  case PID_VALID: /* mark it for deletion */
-	    cfg->mod_pid[i] = PID_DELETE;
-	    pidupdate_status(cfg);
-	    return SATIPCFG_OK;
-
-	  case PID_ADD:   /* pid shall be added, ignore it */
-	    cfg->mod_pid[i] = PID_IGNORE;
-	    pidupdate_status(cfg);
-	    return SATIPCFG_OK;
-
-	  case PID_IGNORE:
-	    break;
-
-	  case PID_DELETE: /* pid already deleted*/
-	    return SATIPCFG_NOCHANGE;
-	  }
-    }
+  cfg->pid_target[PID_WORD(pid)] &= ~PID_BIT(pid);
+
+  /* to be deleted, or pending add dropped */
+  if ( cfg->pid_current[PID_WORD(pid)] & PID_BIT(pid) )
+    cfg->pid_diff++;
+  else
+    cfg->pid_diff--;
 
-  /* pid was not found, ignore request */
+  pidupdate_status(cfg);
   return SATIPCFG_OK;
 }
 
@@ -147,44 +141,23 @@ void satip_add_default_pids(t_satip_config *cfg)
 
 int satip_add_pid(t_satip_config* cfg,unsigned short pid)
 {
-  int i;
+  if ( pid >= 8192 )
+    return SATIPCFG_ERROR;
 
-  /* check if pid is present and valid, to be added, to be deleted */
-  for (i=0; i<SATIPCFG_MAX_PIDS; i++)
-    {
-      if ( cfg->pid[i] == pid )
-	switch (cfg->mod_pid[i])
-	  {
-	  case PID_VALID: /* already present */
-	  case PID_ADD:   /* pid shall be already added */
-	    /* just return current status, no update required */
-	    return SATIPCFG_NOCHANGE;
-
-	  case PID_IGNORE:
-	    break;
-
-	  case PID_DELETE:
-	    /* pid shall be deleted, make it valid again */
-	    cfg->mod_pid[i] = PID_VALID;
-	    pidupdate_status(cfg);
-	    return SATIPCFG_OK;
-	  }
-    }
+  /* already present or to be added, no update required */
+  if ( cfg->pid_target[PID_WORD(pid)] & PID_BIT(pid) )
+    return SATIPCFG_NOCHANGE;
 
-  /* pid was not found, add it */
-  for ( i=0; i<SATIPCFG_MAX_PIDS; i++)
-    {
-      if (cfg->mod_pid[i] == PID_IGNORE )
-	{
-	  cfg->mod_pid[i] = PID_ADD;
-	  cfg->pid[i] = pid;
-	  pidupdate_status(cfg);
-	  return SATIPCFG_OK;
-	}
-    }
+  cfg->pid_target[PID_WORD(pid)] |= PID_BIT(pid);
 
-  /* could not add it */
-  return SATIPCFG_ERROR;
+  /* pending delete dropped, or to be added */
+  if ( cfg->pid_current[PID_WORD(pid)] & PID_BIT(pid) )
+    cfg->pid_diff--;
+  else
+    cfg->pid_diff++;
+
+  pidupdate_status(cfg);
+  return SATIPCFG_OK;
 }
 
 int satip_set_dvbs(t_satip_config* cfg, unsigned int freq, t_polarization pol, unsigned int modtype, unsigned int symrate, t_fec_inner fecinner)
@@ -276,6 +249,79 @@ int satip_set_position(t_satip_config* cfg, int position)
   return SATIPCFG_OK;
 }
 
+/* new session, e.g. on another server: send tuning and all pids again */
+void satip_force_tuning(t_satip_config* cfg)
+{
+  if ( cfg->status == SATIPCFG_SETTLED || cfg->status == SATIPCFG_PID_CHANGED )
+    cfg->status = SATIPCFG_CHANGED;
+}
+
+/* one stream can serve both tunings */
+int satip_same_transponder(t_satip_config* a, t_satip_config* b)
+{
+  if ( a->delsys != b->delsys || a->frequency != b->frequency )
+    return 0;
+
+  if ( a->delsys == SYS_DVBS || a->delsys == SYS_DVBS2 )
+    return ( a->polarization == b->polarization && a->position == b->position );
+
+  return 1;
+}
+
+/* take over tuning of src, pids are left as they are */
+void satip_copy_tuning(t_satip_config* dst, t_satip_config* src)
+{
+  int i;
+
+  dst->delsys = src->delsys;
+  dst->frequency = src->frequency;
+  dst->polarization = src->polarization;
+  dst->roll_off = src->roll_off;
+  dst->mod_type = src->mod_type;
+  dst->pilots = src->pilots;
+  dst->symbol_rate = src->symbol_rate;
+  dst->fec_inner = src->fec_inner;
+  dst->inversion = src->inversion;
+  dst->bandwidth = src->bandwidth;
+  dst->transmission_mode = src->transmission_mode;
+  dst->guard_interval = src->guard_interval;
+  dst->position = src->position;
+  dst->tune_id = src->tune_id;
+  dst->prefetch = src->prefetch;
+
+  for ( i=0; i<src->pmt_count; i++ )
+    dst->pmt_pids[i] = src->pmt_pids[i];
+  dst->pmt_count = src->pmt_count;
+  dst->ci_slot = src->ci_slot;
+
+  dst->status = SATIPCFG_CHANGED;
+}
+
+/* add requested pids to bitmap map (8192 bits) */
+void satip_get_pidmap(t_satip_config* cfg, unsigned char* map)
+{
+  int i,j;
+
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    for ( j=0; j<8; j++ )
+      map[i*8+j] |= cfg->pid_target[i] >> (j*8);
+}
+
+/* request exactly the pids of bitmap map */
+void satip_set_pidmap(t_satip_config* cfg, const unsigned char* map)
+{
+  int i,j;
+
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    {
+      cfg->pid_target[i] = 0;
+      for ( j=0; j<8; j++ )
+	cfg->pid_target[i] |= (uint64_t)map[i*8+j] << (j*8);
+    }
+
+  pidupdate_diff(cfg);
+}
+
 void satip_close(t_satip_config *cfg)
 {
   cfg->status = SATIPCFG_CLOSING;
@@ -302,28 +348,66 @@ int satip_pid_update_required(t_satip_config* cfg)
 }
 
 
-static int setpidlist(t_satip_config* cfg, char* str,int maxlen,const char* firststr,int modtype1, int modtype2)
+static uint64_t pidlist_word(t_satip_config* cfg, int i, int modtype)
 {
-  int i;
+  switch (modtype)
+    {
+    case PID_ADD:
+      return cfg->pid_target[i] & ~cfg->pid_current[i];
+    case PID_DELETE:
+      return cfg->pid_current[i] & ~cfg->pid_target[i];
+    default:
+      return cfg->pid_target[i];
+    }
+}
+
+/* only complete entries that fit into maxlen, the pids listed are marked sent */
+static int setpidlist(t_satip_config* cfg, char* str,int maxlen,const char* firststr,int modtype)
+{
+  char entry[16];
+  uint64_t word;
+  int i,pid,len;
   int printed=0;
   int first=1;
 
-  for ( i=0; i<SATIPCFG_MAX_PIDS; i++ )
-	if ( cfg->mod_pid[i] == modtype1 ||
-	     cfg->mod_pid[i] == modtype2 )
-	  {
-	    printed += snprintf(str+printed, maxlen-printed, "%s%d",
-			       first ? firststr : ",",
-			       cfg->pid[i]);
-	    first=0;
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    {
+      word = pidlist_word(cfg, i, modtype);
+
+      while ( word )
+	{
+	  pid = i*64 + __builtin_ctzll(word);
+	  len = snprintf(entry, sizeof(entry), "%s%d", first ? firststr : ",", pid);
 
-	    if ( printed>=maxlen )
-	      return printed;
-	  }
+	  if ( printed+len >= maxlen )
+	    return printed;
+
+	  memcpy(str+printed, entry, len+1);
+	  printed += len;
+	  first=0;
+	  cfg->pid_sent[i] |= word & -word;
+	  word &= word-1;
+	}
+    }
 
   return printed;
 }
 
+/* length of the complete "pids=" list */
+static int pidlist_length(t_satip_config* cfg)
+{
+  int i,pid;
+  int len=4;
+
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    if ( cfg->pid_target[i] )
+      for ( pid=i*64; pid<i*64+64; pid++ )
+	if ( cfg->pid_target[i] & PID_BIT(pid) )
+	  len += pid<10 ? 2 : pid<100 ? 3 : pid<1000 ? 4 : 5;
+
+  return len;
+}
+
 
 int satip_prepare_tuning(t_satip_config* cfg, char* str, int maxlen)
 {
@@ -395,28 +479,40 @@ int satip_prepare_tuning(t_satip_config* cfg, char* str, int maxlen)
 }
 
 
+/*
+ * pid part of the query within maxlen, a list too long is split and the
+ * remaining pids stay pending for the next request after settling
+ */
 int satip_prepare_pids(t_satip_config* cfg, char* str, int maxlen,int modpid)
 {
   int printed;
 
-  if (modpid)
-    {
-      printed = setpidlist(cfg,str,maxlen,"addpids=",PID_ADD, PID_ADD);
+  memset(cfg->pid_sent, 0, sizeof(cfg->pid_sent));
 
-      if ( printed>=maxlen )
-	return printed;
+  /* leaving "pids=all" needs the complete list */
+  if (modpid && !cfg->pid_all)
+    {
+      cfg->pid_prepared = PIDS_MOD;
+      printed = setpidlist(cfg,str,maxlen,"addpids=",PID_ADD);
 
       printed += setpidlist(cfg, str+printed,maxlen-printed,
-			    printed>0 ? "&delpids=" : "delpids=",PID_DELETE, PID_DELETE);
+			    printed>0 ? "&delpids=" : "delpids=",PID_DELETE);
+    }
+  else if ( pidlist_length(cfg) >= maxlen*SATIPCFG_SPLIT_MAX )
+    {
+      cfg->pid_prepared = PIDS_ALL;
+      printed = snprintf(str,maxlen,"pids=all");
     }
   else
     {
-      printed = setpidlist(cfg,str,maxlen,"pids=",PID_VALID, PID_ADD);
+      cfg->pid_prepared = PIDS_LIST;
+      printed = setpidlist(cfg,str,maxlen,"pids=",PID_TARGET);
     }
 
   /* nothing was added, use "none" */
   if ( printed == 0 )
     {
+      cfg->pid_prepared = PIDS_LIST;
       printed = snprintf(str,maxlen,"pids=none");
     }
 
@@ -434,14 +530,33 @@ int satip_settle_config(t_satip_config* cfg)
     {
     case SATIPCFG_CHANGED:
     case SATIPCFG_PID_CHANGED:
-      /* clear up addpids delpids */
-      for ( i=0; i<SATIPCFG_MAX_PIDS; i++)
-	if ( cfg->mod_pid[i] == PID_ADD )
-	  cfg->mod_pid[i] = PID_VALID;
-	else if (cfg->mod_pid[i] == PID_DELETE )
-	  cfg->mod_pid[i] = PID_IGNORE;
-      /* now settled */
+      /* clear up addpids delpids, only those sent of a split list */
+      switch (cfg->pid_prepared)
+	{
+	case PIDS_MOD:
+	  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+	    cfg->pid_current[i] = ( cfg->pid_current[i] & ~cfg->pid_sent[i] ) |
+	      ( cfg->pid_target[i] & cfg->pid_sent[i] );
+	  break;
+
+	case PIDS_LIST:
+	  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+	    cfg->pid_current[i] = cfg->pid_target[i] & cfg->pid_sent[i];
+	  cfg->pid_all = 0;
+	  break;
+
+	case PIDS_ALL:
+	  cfg->pid_all = 1;
+	  /* fall through */
+	default:
+	  memcpy(cfg->pid_current, cfg->pid_target, sizeof(cfg->pid_current));
+	  break;
+	}
+      cfg->pid_prepared = 0;
+
+      /* now settled, unless the list was split */
       cfg->status = SATIPCFG_SETTLED;
+      pidupdate_diff(cfg);
       break;
 
     case SATIPCFG_SETTLED:
@@ -459,12 +574,13 @@ int satip_settle_config(t_satip_config* cfg)
 
 void satip_clear_config(t_satip_config* cfg)
 {
-  int i;
-
   cfg->status    = SATIPCFG_INCOMPLETE;
 
-  for ( i=0; i<SATIPCFG_MAX_PIDS; i++)
-    cfg->mod_pid[i]=PID_IGNORE;
+  memset(cfg->pid_target, 0, sizeof(cfg->pid_target));
+  memset(cfg->pid_current, 0, sizeof(cfg->pid_current));
+  cfg->pid_diff = 0;
+  cfg->pid_prepared = 0;
+  cfg->pid_all = 0;
 
   /* Initialize PMT and CI slot */
   satip_clear_pmt(cfg);
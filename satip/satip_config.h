@@ -20,6 +20,7 @@
 #ifndef _SATIP_CONFIG_H
 #define _SATIP_CONFIG_H
 
+#include <stdint.h>
 #include "vtuner.h"
 
 #define UNUSED(x) (void)(x)
@@ -108,7 +109,28 @@ typedef enum
 
 
 
+/*
+ * vtuner devices (-d) of one instance, more are refused at startup; the
+ * tables of shared streams, RTP sinks, sessions per RTSP connection,
+ * metrics and shared memory statistics are sized by it
+ */
+#define SATIP_MAX_TUNERS 16
+
+/*
+ * private directories, mode 0700 and owned by the user the daemon runs
+ * as: no other user can put a link in place of the files written there
+ */
+#define SATIP_RUN_DIR    "/run/satip"
+#define SATIP_CACHE_DIR  "/var/cache/satip"
+
+/* last log messages kept in memory are written there on a crash */
+#define SATIP_CRASH_FILE SATIP_RUN_DIR "/satip.crash"
+
 #define SATIPCFG_MAX_PIDS MAX_PIDTAB_LEN
+#define SATIPCFG_PID_WORDS (8192/64)
+
+/* a pid list longer than this many requests is replaced by "pids=all" */
+#define SATIPCFG_SPLIT_MAX 4
 
 typedef struct satip_config
 {
@@ -132,11 +154,19 @@ typedef struct satip_config
   /* remote frontend */
   int               frontend;
 
-  /* pids */
-  unsigned short    pid[SATIPCFG_MAX_PIDS];
+  /* pids requested and pids last sent, bit per pid */
+  uint64_t          pid_target[SATIPCFG_PID_WORDS];
+  uint64_t          pid_current[SATIPCFG_PID_WORDS];
+
+  /* number of pids differing, for addpids/delpids cmd */
+  int               pid_diff;
+
+  /* pids of the last prepared list, which may have been split */
+  uint64_t          pid_sent[SATIPCFG_PID_WORDS];
+  int               pid_prepared;  /* 0, or SATIPCFG_PIDS_* sent */
 
-  /* delta info for addpids/delpids cmd */
-  unsigned short    mod_pid[SATIPCFG_MAX_PIDS];
+  /* server streams all pids, the list was too long */
+  int               pid_all;
 
   /* sat number as position  */
   int               position;
@@ -144,6 +174,9 @@ typedef struct satip_config
   /* tune id */
   unsigned char     tune_id;
 
+  /* pids requested ahead of the application on tuning, SATIPCFG_PREFETCH_* */
+  int               prefetch;
+
   /* PMT PIDs for decryption */
   unsigned short    pmt_pids[SATIPCFG_MAX_PIDS];
   int               pmt_count;
@@ -156,6 +189,11 @@ typedef struct satip_config
 
 
 
+#define SATIPCFG_PREFETCH_NONE      0
+#define SATIPCFG_PREFETCH_PSI       1  /* PSI only, no cached service */
+#define SATIPCFG_PREFETCH_PREDICTED 2  /* and the pids of a cached service */
+#define SATIPCFG_PREFETCH_KINDS     3
+
 #define SATIPCFG_NOCHANGE -1
 #define SATIPCFG_OK       0
 #define SATIPCFG_ERROR    1
@@ -188,8 +226,14 @@ void satip_clear_pmt(t_satip_config* cfg);
 int satip_set_ci_slot(t_satip_config* cfg, int slot);
 
 int satip_settle_config(t_satip_config* cfg);
+void satip_force_tuning(t_satip_config* cfg);
 void satip_clear_config(t_satip_config* cfg);
 
+int satip_same_transponder(t_satip_config* a, t_satip_config* b);
+void satip_copy_tuning(t_satip_config* dst, t_satip_config* src);
+void satip_get_pidmap(t_satip_config* cfg, unsigned char* map);
+void satip_set_pidmap(t_satip_config* cfg, const unsigned char* map);
+
 void satip_close(t_satip_config* cfg);
 int satip_close_requested(t_satip_config* cfg);
 #endif
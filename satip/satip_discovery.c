@@ -0,0 +1,490 @@
+/*
+ * satip: SSDP discovery of SAT>IP servers
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "satip_discovery.h"
+#include "log.h"
+
+#define SSDP_ST "urn:ses-com:device:SatIPServer:1"
+
+#define HTTP_TIMEOUT 2  /* sec */
+#define MAX_DESCRIPTION 16384
+
+
+/* copy value of header "name" from message */
+static int header_value(const char* msg, const char* name, char* value, int len)
+{
+  int namelen=strlen(name);
+  const char* line=msg;
+
+  while ( line!=NULL )
+    {
+      if ( strncasecmp(line,name,namelen)==0 && line[namelen]==':' )
+	{
+	  int n;
+
+	  line+=namelen+1;
+	  while ( *line==' ' || *line=='\t' )
+	    line++;
+
+	  n=strcspn(line,"\r\n");
+	  if ( n>=len )
+	    return 0;
+
+	  memcpy(value,line,n);
+	  value[n]=0;
+	  return 1;
+	}
+
+      line=strchr(line,'\n');
+      if ( line!=NULL )
+	line++;
+    }
+
+  return 0;
+}
+
+/* "http://host[:port]/path" */
+static int parse_location(const char* url, char* host, int hostlen,
+			  char* port, int portlen, const char** path)
+{
+  const char* p;
+  int n;
+
+  if ( strncasecmp(url,"http://",7)!=0 )
+    return 0;
+  url+=7;
+
+  *path=strchr(url,'/');
+  if ( *path==NULL )
+    *path="/";
+
+  n=strcspn(url,":/");
+  if ( n==0 || n>=hostlen )
+    return 0;
+  memcpy(host,url,n);
+  host[n]=0;
+
+  p=url+n;
+  if ( *p==':' )
+    {
+      n=strcspn(++p,"/");
+      if ( n==0 || n>=portlen )
+	return 0;
+      memcpy(port,p,n);
+      port[n]=0;
+    }
+  else
+    strcpy(port,"80");
+
+  return 1;
+}
+
+static int http_get(const char* host, const char* port, const char* path,
+		    char* buf, int len)
+{
+  struct addrinfo hints;
+  struct addrinfo* result;
+  struct timeval tv;
+  int sockfd;
+  int rec,total=0;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if ( getaddrinfo(host, port, &hints, &result) != 0 )
+    return -1;
+
+  sockfd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if ( sockfd<0 )
+    {
+      freeaddrinfo(result);
+      return -1;
+    }
+
+  /* also bounds connect() */
+  tv.tv_sec = HTTP_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  if ( connect(sockfd, result->ai_addr, result->ai_addrlen) < 0 )
+    {
+      freeaddrinfo(result);
+      close(sockfd);
+      return -1;
+    }
+  freeaddrinfo(result);
+
+  total = snprintf(buf, len, "GET %s HTTP/1.0\r\nHost: %s:%s\r\n\r\n", path, host, port);
+  if ( total>=len || send(sockfd, buf, total, 0) != total )
+    {
+      close(sockfd);
+      return -1;
+    }
+
+  total=0;
+  while ( total<len-1 &&
+	  (rec=recv(sockfd, buf+total, len-1-total, 0)) > 0 )
+    total+=rec;
+  buf[total]=0;
+
+  close(sockfd);
+
+  return total;
+}
+
+/* fetch device description and read tuner counts from X_SATIPCAP */
+static void read_description(const char* location, t_satip_server* server)
+{
+  char host[64];
+  char port[8];
+  const char* path;
+  char* buf;
+  char* cap;
+  char* end;
+
+  if ( !parse_location(location, host, sizeof(host), port, sizeof(port), &path) )
+    {
+      DEBUG(MSG_NET,"SSDP: invalid location %s\n",location);
+      return;
+    }
+
+  strcpy(server->host, host);
+
+  buf=(char*)malloc(MAX_DESCRIPTION);
+
+  if ( http_get(host, port, path, buf, MAX_DESCRIPTION) <= 0 ||
+       strncmp(buf,"HTTP/1.",7)!=0 || strncmp(buf+8," 200",4)!=0 )
+    {
+      DEBUG(MSG_NET,"SSDP: no description from %s\n",location);
+      free(buf);
+      return;
+    }
+
+  cap=strstr(buf,"X_SATIPCAP");
+  if ( cap!=NULL && (cap=strchr(cap,'>'))!=NULL &&
+       (end=strchr(++cap,'<'))!=NULL )
+    {
+      *end=0;
+      satip_sdp_parse_caps(cap, server->tuners);
+    }
+
+  free(buf);
+}
+
+static int parse_target(const char* target, struct sockaddr_in* addr)
+{
+  char host[64];
+  const char* colon=strrchr(target,':');
+  int n = colon ? colon-target : (int)strlen(target);
+
+  if ( n>=(int)sizeof(host) )
+    return 0;
+  memcpy(host,target,n);
+  host[n]=0;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(colon ? atoi(colon+1) : 1900);
+
+  return inet_aton(host, &addr->sin_addr);
+}
+
+int satip_discover(const char* target, int timeout, t_satip_server* servers, int max)
+{
+  struct sockaddr_in addr;
+  struct pollfd pfd;
+  struct timespec start, now;
+  char msg[1024];
+  char location[256];
+  char usn[128];
+  char* p;
+  int sockfd;
+  int count=0;
+  int printed;
+  int left;
+  int i;
+
+  if ( !parse_target(target, &addr) )
+    {
+      ERROR(MSG_NET,"SSDP: invalid target %s\n",target);
+      return 0;
+    }
+
+  sockfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if ( sockfd<0 )
+    return 0;
+
+  printed = snprintf(msg, sizeof(msg),
+		     "M-SEARCH * HTTP/1.1\r\n"
+		     "HOST: %s\r\n"
+		     "MAN: \"ssdp:discover\"\r\n"
+		     "MX: %d\r\n"
+		     "ST: " SSDP_ST "\r\n\r\n",
+		     target, timeout/1000 > 1 ? timeout/1000-1 : 1);
+
+  DEBUG(MSG_NET,"SSDP: >>\n%s<<\n",msg);
+
+  if ( sendto(sockfd, msg, printed, 0, (struct sockaddr*) &addr, sizeof(addr)) != printed )
+    {
+      ERROR(MSG_NET,"SSDP: M-SEARCH to %s failed\n",target);
+      close(sockfd);
+      return 0;
+    }
+
+  clock_gettime(CLOCK_MONOTONIC,&start);
+
+  pfd.fd = sockfd;
+  pfd.events = POLLIN;
+
+  while ( count<max )
+    {
+      int rec;
+
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      left = timeout - ( (now.tv_sec - start.tv_sec)*1000 +
+			 (now.tv_nsec - start.tv_nsec)/1000000 );
+      if ( left<=0 || poll(&pfd, 1, left) <= 0 )
+	break;
+
+      rec = recv(sockfd, msg, sizeof(msg)-1, 0);
+      if ( rec<=0 )
+	continue;
+      msg[rec]=0;
+
+      if ( strstr(msg, SSDP_ST)==NULL ||
+	   !header_value(msg, "LOCATION", location, sizeof(location)) )
+	continue;
+
+      if ( !header_value(msg, "USN", usn, sizeof(usn)) )
+	snprintf(usn, sizeof(usn), "%.127s", location);
+
+      /* "uuid:<device>::urn:..." */
+      p = strstr(usn, "::");
+      if ( p!=NULL )
+	*p=0;
+
+      /* several answers per server */
+      for ( i=0; i<count; i++ )
+	if ( strcmp(servers[i].uuid, usn)==0 )
+	  break;
+      if ( i<count )
+	continue;
+
+      memset(&servers[count], 0, sizeof(t_satip_server));
+      snprintf(servers[count].uuid, sizeof(servers[count].uuid), "%.63s", usn);
+      strcpy(servers[count].port, "554");
+      servers[count].seen = time(NULL);
+
+      read_description(location, &servers[count]);
+      if ( servers[count].host[0]==0 )
+	continue;
+
+      INFO(MSG_NET,"SSDP: server %s at %s, tuners %d,%d,%d\n",
+	   servers[count].uuid, servers[count].host,
+	   servers[count].tuners[SATIP_MSYS_SAT],
+	   servers[count].tuners[SATIP_MSYS_TER],
+	   servers[count].tuners[SATIP_MSYS_CAB]);
+      count++;
+    }
+
+  close(sockfd);
+
+  return count;
+}
+
+/* one server per line: host port uuid sat,ter,cab seen */
+int satip_discovery_load(const char* path, t_satip_server* servers, int max)
+{
+  FILE* f=NULL;
+  struct stat st;
+  char line[256];
+  int count=0;
+  int fd;
+
+  /* trusted only as written by us, never through a link */
+  fd=open(path,O_RDONLY|O_NOFOLLOW);
+  if ( fd<0 )
+    return 0;
+  if ( fstat(fd,&st)<0 || !S_ISREG(st.st_mode) || st.st_uid!=geteuid() ||
+       (f=fdopen(fd,"r"))==NULL )
+    {
+      WARN(MSG_NET,"%s not written by us, ignored\n",path);
+      close(fd);
+      return 0;
+    }
+
+  while ( count<max && fgets(line,sizeof(line),f)!=NULL )
+    {
+      t_satip_server* server=&servers[count];
+      long seen;
+
+      if ( line[0]=='#' )
+	continue;
+
+      if ( sscanf(line, "%63s %7s %63s %d,%d,%d %ld",
+		  server->host, server->port, server->uuid,
+		  &server->tuners[SATIP_MSYS_SAT],
+		  &server->tuners[SATIP_MSYS_TER],
+		  &server->tuners[SATIP_MSYS_CAB],
+		  &seen) == 7 )
+	{
+	  server->seen = seen;
+	  count++;
+	}
+    }
+
+  fclose(f);
+
+  DEBUG(MSG_NET,"%d server(s) cached in %s\n",count,path);
+
+  return count;
+}
+
+int satip_discovery_save(const char* path, t_satip_server* servers, int count)
+{
+  char tmp[256];
+  FILE* f=NULL;
+  int i,fd;
+
+  if ( snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp) )
+    return -1;
+
+  /* new file of its own, mode 0600 */
+  fd=mkstemp(tmp);
+  if ( fd>=0 && (f=fdopen(fd,"w"))==NULL )
+    {
+      close(fd);
+      unlink(tmp);
+    }
+  if ( f==NULL )
+    {
+      ERROR(MSG_NET,"cannot write %s\n",tmp);
+      return -1;
+    }
+
+  fprintf(f, "# host port uuid sat,ter,cab seen\n");
+  for ( i=0; i<count; i++ )
+    fprintf(f, "%s %s %s %d,%d,%d %ld\n",
+	    servers[i].host, servers[i].port, servers[i].uuid,
+	    servers[i].tuners[SATIP_MSYS_SAT],
+	    servers[i].tuners[SATIP_MSYS_TER],
+	    servers[i].tuners[SATIP_MSYS_CAB],
+	    (long)servers[i].seen);
+
+  fclose(f);
+
+  /* readers never see a partial file */
+  if ( rename(tmp, path) < 0 )
+    {
+      unlink(tmp);
+      return -1;
+    }
+  return 0;
+}
+
+t_satip_server* satip_discovery_pick(t_satip_server* servers, int count, t_satip_msys msys)
+{
+  t_satip_server* best=NULL;
+  int i;
+
+  for ( i=0; i<count; i++ )
+    {
+      t_satip_server* server=&servers[i];
+      int known = server->tuners[SATIP_MSYS_SAT] + server->tuners[SATIP_MSYS_TER] +
+	server->tuners[SATIP_MSYS_CAB];
+
+      /* without X_SATIPCAP any system may work */
+      if ( msys!=SATIP_MSYS_UNKNOWN && known>0 && server->tuners[msys]==0 )
+	continue;
+
+      if ( best==NULL || server->seen > best->seen )
+	best=server;
+    }
+
+  return best;
+}
+
+
+typedef struct revalidate
+{
+  char* path;
+  char* target;
+  char* uuid;
+} t_revalidate;
+
+static void* revalidate_thread(void* param)
+{
+  t_revalidate* rv=(t_revalidate*)param;
+  t_satip_server servers[SATIP_MAX_SERVERS];
+  int count;
+  int i;
+
+  count = satip_discover(rv->target, SATIP_SSDP_TIMEOUT, servers, SATIP_MAX_SERVERS);
+
+  /* nothing answered, network may be down: keep what we know */
+  if ( count>0 )
+    {
+      satip_discovery_save(rv->path, servers, count);
+
+      for ( i=0; i<count; i++ )
+	if ( strcmp(servers[i].uuid, rv->uuid)==0 )
+	  break;
+      if ( i==count )
+	INFO(MSG_NET,"SSDP: cached server %s did not answer\n",rv->uuid);
+    }
+
+  free(rv->path);
+  free(rv->target);
+  free(rv->uuid);
+  free(rv);
+
+  return NULL;
+}
+
+void satip_discovery_revalidate(const char* path, const char* target, const char* uuid)
+{
+  t_revalidate* rv=(t_revalidate*)malloc(sizeof(t_revalidate));
+  pthread_t thread;
+
+  rv->path=strdup(path);
+  rv->target=strdup(target);
+  rv->uuid=strdup(uuid);
+
+  if ( pthread_create(&thread, NULL, revalidate_thread, rv) == 0 )
+    pthread_detach(thread);
+  else
+    revalidate_thread(rv);
+}
@@ -0,0 +1,55 @@
+/*
+ * satip: SSDP discovery of SAT>IP servers
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_DISCOVERY_H
+#define _SATIP_DISCOVERY_H
+
+#include <time.h>
+
+#include "satip_config.h"
+#include "satip_sdp.h"
+
+#define SATIP_SSDP_TARGET  "239.255.255.250:1900"
+#define SATIP_SSDP_TIMEOUT 3000   /* msec to collect answers */
+#define SATIP_SERVER_CACHE SATIP_CACHE_DIR "/servers"
+
+#define SATIP_MAX_SERVERS 16
+
+typedef struct satip_server
+{
+  char host[64];
+  char port[8];                   /* RTSP */
+  char uuid[64];
+  int tuners[SATIP_MSYS_COUNT];   /* from X_SATIPCAP */
+  time_t seen;
+} t_satip_server;
+
+/* M-SEARCH to target "addr:port", returns number of servers found */
+int satip_discover(const char* target, int timeout, t_satip_server* servers, int max);
+
+int satip_discovery_load(const char* path, t_satip_server* servers, int max);
+int satip_discovery_save(const char* path, t_satip_server* servers, int count);
+
+/* most recently seen server with tuners for msys */
+t_satip_server* satip_discovery_pick(t_satip_server* servers, int count, t_satip_msys msys);
+
+/* rediscover in a thread, refresh cache and check that server uuid is still there */
+void satip_discovery_revalidate(const char* path, const char* target, const char* uuid);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * satip: epoll event loop
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+
+#include "satip_evloop.h"
+#include "log.h"
+
+#define EV_FREE     0
+#define EV_ACTIVE   1
+#define EV_RELEASED 2   /* deleted while events of this round may refer to it */
+
+
+typedef struct satip_ev
+{
+  int state;
+  int fd;
+  t_satip_ev_handler handler;
+  void* param;
+} t_satip_ev;
+
+typedef struct satip_evloop
+{
+  int epfd;
+  int dispatching;
+  t_satip_ev ev[SATIP_EVLOOP_MAX];
+} t_satip_evloop;
+
+/* signalfd of one signal, drained on each event */
+typedef struct satip_ev_signal
+{
+  t_satip_ev_handler handler;
+  void* param;
+} t_satip_ev_signal;
+
+
+t_satip_evloop* satip_evloop_new(void)
+{
+  t_satip_evloop* loop;
+
+  loop = (t_satip_evloop*)calloc(1, sizeof(t_satip_evloop));
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if ( loop->epfd < 0 )
+    {
+      ERROR(MSG_MAIN,"epoll_create1: %s\n",strerror(errno));
+      free(loop);
+      return NULL;
+    }
+
+  return loop;
+}
+
+static t_satip_ev* find_ev(t_satip_evloop* loop, int fd)
+{
+  int i;
+
+  for ( i=0; i<SATIP_EVLOOP_MAX; i++ )
+    if ( loop->ev[i].state == EV_ACTIVE && loop->ev[i].fd == fd )
+      return &loop->ev[i];
+
+  return NULL;
+}
+
+int satip_evloop_add(t_satip_evloop* loop, int fd, unsigned int events,
+		     t_satip_ev_handler handler, void* param)
+{
+  struct epoll_event event;
+  t_satip_ev* ev=NULL;
+  int i;
+
+  for ( i=0; i<SATIP_EVLOOP_MAX && ev==NULL; i++ )
+    if ( loop->ev[i].state == EV_FREE )
+      ev = &loop->ev[i];
+
+  if ( ev == NULL )
+    {
+      ERROR(MSG_MAIN,"event loop: more than %d fds\n",SATIP_EVLOOP_MAX);
+      return -1;
+    }
+
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = ev;
+
+  if ( epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) )
+    {
+      ERROR(MSG_MAIN,"event loop: cannot add fd %d: %s\n",fd,strerror(errno));
+      return -1;
+    }
+
+  ev->state = EV_ACTIVE;
+  ev->fd = fd;
+  ev->handler = handler;
+  ev->param = param;
+  return 0;
+}
+
+int satip_evloop_modify(t_satip_evloop* loop, int fd, unsigned int events)
+{
+  struct epoll_event event;
+  t_satip_ev* ev=find_ev(loop, fd);
+
+  if ( ev == NULL )
+    return -1;
+
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = ev;
+
+  return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/* before the fd gets closed */
+void satip_evloop_del(t_satip_evloop* loop, int fd)
+{
+  t_satip_ev* ev=find_ev(loop, fd);
+
+  if ( ev == NULL )
+    return;
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  ev->state = loop->dispatching ? EV_RELEASED : EV_FREE;
+}
+
+
+static void signal_event(int fd, unsigned int events, void* param)
+{
+  t_satip_ev_signal* sig=(t_satip_ev_signal*)param;
+  struct signalfd_siginfo info;
+
+  while ( read(fd, &info, sizeof(info)) == sizeof(info) )
+    (sig->handler)(info.ssi_signo, events, sig->param);
+}
+
+int satip_evloop_add_signal(t_satip_evloop* loop, int signo,
+			    t_satip_ev_handler handler, void* param)
+{
+  t_satip_ev_signal* sig;
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+
+  if ( sigprocmask(SIG_BLOCK, &mask, NULL) ||
+       ( fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC) ) < 0 )
+    {
+      ERROR(MSG_MAIN,"signalfd: %s\n",strerror(errno));
+      return -1;
+    }
+
+  sig = (t_satip_ev_signal*)malloc(sizeof(t_satip_ev_signal));
+  sig->handler = handler;
+  sig->param = param;
+
+  /* drained completely, edge triggered is enough */
+  return satip_evloop_add(loop, fd, EPOLLIN|EPOLLET, signal_event, sig);
+}
+
+
+int satip_evloop_run(t_satip_evloop* loop, int timeout)
+{
+  struct epoll_event events[SATIP_EVLOOP_MAX];
+  t_satip_ev* ev;
+  int i,n;
+
+  n = epoll_wait(loop->epfd, events, SATIP_EVLOOP_MAX, timeout);
+  if ( n < 0 )
+    return errno == EINTR ? 0 : -1;
+
+  /* handlers may add and delete fds, deleted ones are skipped */
+  loop->dispatching = 1;
+  for ( i=0; i<n; i++ )
+    {
+      ev = (t_satip_ev*)events[i].data.ptr;
+      if ( ev->state == EV_ACTIVE )
+	(ev->handler)(ev->fd, events[i].events, ev->param);
+    }
+  loop->dispatching = 0;
+
+  for ( i=0; i<SATIP_EVLOOP_MAX; i++ )
+    if ( loop->ev[i].state == EV_RELEASED )
+      loop->ev[i].state = EV_FREE;
+
+  return n;
+}
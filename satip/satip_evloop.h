@@ -0,0 +1,46 @@
+/*
+ * satip: epoll event loop
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_EVLOOP_H
+#define _SATIP_EVLOOP_H
+
+#include <sys/epoll.h>
+
+#define SATIP_EVLOOP_MAX 64
+
+struct satip_evloop;
+
+/* events as EPOLLIN, EPOLLOUT, EPOLLPRI, EPOLLHUP... */
+typedef void (*t_satip_ev_handler)(int fd, unsigned int events, void* param);
+
+struct satip_evloop* satip_evloop_new(void);
+
+int  satip_evloop_add(struct satip_evloop* loop, int fd, unsigned int events,
+		      t_satip_ev_handler handler, void* param);
+int  satip_evloop_modify(struct satip_evloop* loop, int fd, unsigned int events);
+void satip_evloop_del(struct satip_evloop* loop, int fd);
+
+/* signo is blocked and delivered by a signalfd, call before starting threads */
+int  satip_evloop_add_signal(struct satip_evloop* loop, int signo,
+			     t_satip_ev_handler handler, void* param);
+
+/* wait up to timeout msec (-1 = no limit) and call the handlers */
+int  satip_evloop_run(struct satip_evloop* loop, int timeout);
+
+#endif
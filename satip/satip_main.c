@@ -23,9 +23,10 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
-#include <poll.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <signal.h>
 #include <pwd.h>
@@ -37,6 +38,13 @@
 #include "satip_vtuner.h"
 #include "satip_rtsp.h"
 #include "satip_rtp.h"
+#include "satip_discovery.h"
+#include "satip_share.h"
+#include "satip_evloop.h"
+#include "satip_metrics.h"
+#include "satip_shm.h"
+#include "satip_trace.h"
+#include "satip_pmtcache.h"
 #include "log.h"
 #include "polltimer.h"
 
@@ -51,12 +59,34 @@ int test_counter = 0;
 
 #define TEST_DVBS2 1
 
-static void test_sequencer_loop(void* param)
+/* RTP threads in daemon mode unless set by -W */
+#define DAEMON_WORKERS 2
+
+/*
+ * request, linger, keep alive and prefetch timer per tuner, test
+ * sequencer, statistics, PMT cache, metrics clients
+ */
+#define TIMER_POOL (4*SATIP_MAX_TUNERS+3+SATIP_METRICS_MAX_CLIENTS)
+
+typedef struct satip_tuner
 {
-  t_satip_config* sc=(t_satip_config*)param;
+  char* device;
+  t_satip_config* satconf;
+  t_satip_config* session;  /* differs from satconf if streams are shared */
+  struct satip_vtuner* satvt;
+  struct satip_rtp* srtp;
+  struct satip_rtsp* srtsp;
+} t_satip_tuner;
 
-  test_counter++;
-  
+static t_satip_tuner tuners[SATIP_MAX_TUNERS];
+static int tuner_count = 0;
+static t_satip_share* share = NULL;
+
+/* tuning may have changed, run the updates after the current events */
+static int update_pending = 1;
+
+static void test_sequencer_step(t_satip_config* sc)
+{
   switch (test_counter)
     {
     case 1:
@@ -92,12 +122,72 @@ static void test_sequencer_loop(void* param)
     }
 }
 
+static void test_sequencer_loop(void* param)
+{
+  int i;
 
-static void set_user(char *suser)
+  UNUSED(param);
+
+  test_counter++;
+
+  /* all test tuners follow the same sequence */
+  for ( i=0; i<tuner_count; i++ )
+    test_sequencer_step(tuners[i].satconf);
+
+  update_pending = 1;
+}
+
+
+static struct passwd* find_user(char *suser)
 {
   char *e = suser;
   uid_t uid = (uid_t)strtol(suser, &e, 10);
-  struct passwd *user = (e > suser && *e == '\0') ? getpwuid(uid) : getpwnam(suser);
+  return (e > suser && *e == '\0') ? getpwuid(uid) : getpwnam(suser);
+}
+
+/*
+ * dir created if missing, refused unless a real directory of root or
+ * suser, then owned by suser (NULL = as running) with mode 0700
+ */
+static int private_dir(const char* dir, char* suser)
+{
+  struct passwd* user = suser != NULL ? find_user(suser) : NULL;
+  uid_t uid = user != NULL ? user->pw_uid : geteuid();
+  gid_t gid = user != NULL ? user->pw_gid : getegid();
+  struct stat st;
+  int fd;
+
+  if ( mkdir(dir, 0700) < 0 && errno != EEXIST )
+    {
+      WARN(MSG_MAIN, "cannot create %s: %s\n", dir, strerror(errno));
+      return -1;
+    }
+
+  fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+  if ( fd < 0 || fstat(fd, &st) < 0 )
+    {
+      WARN(MSG_MAIN, "cannot open %s: %s\n", dir, strerror(errno));
+      if ( fd >= 0 )
+	close(fd);
+      return -1;
+    }
+
+  if ( ( st.st_uid != 0 && st.st_uid != uid ) ||
+       ( ( st.st_uid != uid || st.st_gid != gid ) && fchown(fd, uid, gid) < 0 ) ||
+       ( ( st.st_mode & 0777 ) != 0700 && fchmod(fd, 0700) < 0 ) )
+    {
+      ERROR(MSG_MAIN, "%s is not private, not used\n", dir);
+      close(fd);
+      return -1;
+    }
+
+  close(fd);
+  return 0;
+}
+
+static void set_user(char *suser)
+{
+  struct passwd *user = find_user(suser);
   if (!user) {
     ERROR(MSG_MAIN, "unknown user: '%s'\n", suser);
     return;
@@ -138,79 +228,335 @@ static void set_user(char *suser)
 }
 
 
-static void enable_rt_scheduling()
+static t_satip_sched_stats* enable_rt_scheduling(const t_satip_sched* sched)
 {
-  struct sched_param schedp;
-  
   if ( mlockall(MCL_CURRENT|MCL_FUTURE) )    
     DEBUG(MSG_MAIN,"Pages not locked\n");
   else
     DEBUG(MSG_MAIN,"Pages locked\n");
 
-  schedp.sched_priority = sched_get_priority_min(SCHED_FIFO);
-  
-  if ( sched_setscheduler(0, SCHED_FIFO, &schedp) )
-    DEBUG(MSG_MAIN,"No realtime scheduling\n");
+  return satip_sched_apply(sched, "main", 0);
+}
+
+
+/* -s ssdp: pick a cached server right away and revalidate in background */
+static t_satip_server* discover_server(const char* cache, const char* target, const char* delsys)
+{
+  static t_satip_server servers[SATIP_MAX_SERVERS];
+  t_satip_msys msys = delsys ? satip_sdp_msys_by_name(delsys) : SATIP_MSYS_UNKNOWN;
+  t_satip_server* server;
+  int count;
+
+  count = satip_discovery_load(cache, servers, SATIP_MAX_SERVERS);
+  server = satip_discovery_pick(servers, count, msys);
+
+  if ( server != NULL )
+    {
+      satip_discovery_revalidate(cache, target, server->uuid);
+      return server;
+    }
+
+  count = satip_discover(target, SATIP_SSDP_TIMEOUT, servers, SATIP_MAX_SERVERS);
+  if ( count > 0 )
+    satip_discovery_save(cache, servers, count);
+
+  return satip_discovery_pick(servers, count, msys);
+}
+
+
+/* config file keys, each stands for the command line option */
+static const struct
+{
+  const char* name;
+  char opt;
+  int has_arg;
+} config_keys[] =
+  {
+    { "server",          's', 1 },
+    { "port",            'p', 1 },
+    { "device",          'd', 1 },
+    { "delsys",          'D', 1 },
+    { "frontend",        'f', 1 },
+    { "loglevel",        'l', 1 },
+    { "logmask",         'm', 1 },
+    { "recorder",        'j', 1 },
+    { "rtp-port",        'r', 1 },
+    { "report-interval", 'R', 1 },
+    { "rtcp-keepalive",  'k', 0 },
+    { "probe",           'P', 1 },
+    { "url-max",         'Q', 1 },
+    { "server-cache",    'x', 1 },
+    { "ssdp-target",     'X', 1 },
+    { "user",            'u', 1 },
+    { "warm",            'w', 1 },
+    { "linger",          'L', 1 },
+    { "timeouts",        't', 1 },
+    { "workers",         'W', 1 },
+    { "shared-rtp",      'U', 0 },
+    { "affinity",        'A', 1 },
+    { "main-affinity",   'M', 1 },
+    { "metrics",         'e', 1 },
+    { "stats-interval",  'g', 1 },
+    { "pmt-cache",       'y', 1 },
+    { "prefetch",        'G', 1 },
+    { "foreground",      'F', 0 },
+  };
+
+/*
+ * "key value" lines of file as options, put in front of the command line
+ * options in argv so those override the file
+ */
+static int read_config(const char* file, int* argc, char*** argv)
+{
+  char line[256];
+  char** args;
+  int nargs=1;
+  int lineno=0;
+  int max=*argc+1;
+  unsigned int i;
+  FILE* f;
+
+  f = fopen(file,"r");
+  if ( f == NULL )
+    {
+      fprintf(stderr,"cannot open %s: %s\n",file,strerror(errno));
+      return -1;
+    }
+
+  args = (char**)malloc(max*sizeof(char*));
+  args[0] = (*argv)[0];
+
+  while ( fgets(line, sizeof(line), f) != NULL )
+    {
+      char* key;
+      char* value;
+
+      lineno++;
+      key = strtok(line," \t\r\n");
+      if ( key == NULL || key[0] == '#' )
+	continue;
+      value = strtok(NULL," \t\r\n");
+
+      for ( i=0; i<sizeof(config_keys)/sizeof(config_keys[0]); i++ )
+	if ( strcmp(key,config_keys[i].name) == 0 )
+	  break;
+
+      if ( i == sizeof(config_keys)/sizeof(config_keys[0]) ||
+	   ( config_keys[i].has_arg && value == NULL ) )
+	{
+	  fprintf(stderr,"%s:%d: invalid line\n",file,lineno);
+	  fclose(f);
+	  return -1;
+	}
+
+      if ( nargs+2 >= max )
+	{
+	  max *= 2;
+	  args = (char**)realloc(args, max*sizeof(char*));
+	}
+
+      args[nargs] = (char*)malloc(3);
+      sprintf(args[nargs++], "-%c", config_keys[i].opt);
+      if ( config_keys[i].has_arg )
+	args[nargs++] = strdup(value);
+    }
+  fclose(f);
+
+  /* command line follows */
+  if ( nargs + *argc >= max )
+    args = (char**)realloc(args, (nargs + *argc)*sizeof(char*));
+  for ( i=1; i<(unsigned int)*argc; i++ )
+    args[nargs++] = (*argv)[i];
+  args[nargs] = NULL;
+
+  *argc = nargs;
+  *argv = args;
+  return 0;
+}
+
+
+static void signal_event(int sig, unsigned int events, void* param)
+{
+  UNUSED(events);
+  UNUSED(param);
+
+  if ( sig == SIGUSR2 )
+    satip_sched_log();
+  else if ( sig == SIGUSR1 )
+    {
+      char file[64];
+
+      snprintf(file, sizeof(file), SATIP_TRACE_FILE, (int)getpid());
+      satip_trace_dump(file);
+    }
   else
-    DEBUG(MSG_MAIN,"Realtime scheduling enabled at prio %d\n",schedp.sched_priority);
-    
+    {
+      abort_all = 1;
+      update_pending = 1;
+    }
 }
 
+static void vtuner_event(int fd, unsigned int events, void* param)
+{
+  UNUSED(fd);
+  UNUSED(events);
+
+  satip_vtuner_event((struct satip_vtuner*)param);
+  update_pending = 1;
+}
 
-void hangup(int sig)
+static void timer_event(int fd, unsigned int events, void* param)
 {
-   UNUSED(sig);
-   abort_all=1;
+  UNUSED(fd);
+  UNUSED(events);
+
+  polltimer_call_next((struct polltimer_queue*)param);
+}
+
+/* adapters on the same transponder, then any updates on rtsp */
+static void update_tuners(void)
+{
+  int i;
+
+  if ( share )
+    satip_share_update(share);
+  for ( i=0; i<tuner_count; i++ )
+    satip_rtsp_check_update(tuners[i].srtsp, abort_all);
+  if (abort_all) exit(0);
 }
 
 void usage(char *name)
 {
   fprintf(stderr,
-     "usage: %s -s satip_receiver [options]\n\n"
+     "usage: %s -s satip_receiver [options]\n"
+     "       %s -c config_file [options]\n\n"
+     "  -c\tdaemon mode, options from config_file with one \"key value\" per line\n"
+     "    \tkeys: server port device delsys frontend loglevel logmask recorder rtp-port report-interval\n"
+     "    \trtcp-keepalive probe url-max server-cache ssdp-target user warm linger timeouts workers shared-rtp\n"
+     "    \taffinity main-affinity metrics stats-interval pmt-cache prefetch\n"
+     "    \tforeground\n"
+     "  -F\tdaemon mode stays in foreground\n"
+     "  -W\tnumber of RTP threads for all tuners, 0 = one per tuner (defaults to 0, with -c to 2)\n"
+     "  -A\tRTP thread placement cpulist[:policy[:prio[:node]]], e.g. 2-3:fifo:10:0\n"
+     "    \trepeat for each RTP thread in order of creation, the last one applies to the rest\n"
+     "    \tpolicy: fifo rr other batch idle (defaults to fifo), node = NUMA node of RX buffers\n"
+     "  -M\tmain thread placement, same format as -A (defaults to fifo at lowest prio)\n"
+     "    \tSIGUSR2 logs wakeups and CPU migrations of all threads at info level\n"
+     "    \tSIGUSR1 writes the recent zaps as Chrome trace JSON to " SATIP_RUN_DIR "/trace-<pid>.json\n"
+     "  -e\tserve metrics in Prometheus text format on [host:]port (host defaults to 127.0.0.1)\n"
+     "    \tor on a unix socket if a path is given\n"
+     "  -g\tinterval in ms of the statistics in shared memory /dev/shm/" SATIP_SHM_PREFIX "<pid>, read by satip-stat\n"
+     "    \t(defaults to %d, 0 = off)\n"
+     "  -U\tall tuners receive on one RTP/RTCP port pair (-r or 45000), streams told apart by SSRC\n"
+     "  -s\tsatip receiver host, or ssdp to discover one\n"
+     "    \tcomma separated list host[:port] for a pool, new tunings go to the least loaded\n"
      "  -p\tport of satip receiver (defaults to 554)\n"
      "  -d\tvtuner device (defaults to /dev/vtunerc0)\n"
+     "    \trepeat for up to %d tuners, sessions to the same server share one RTSP connection\n"
+     "    \tand tuners on the same transponder share one stream\n"
      "  -D\tvtuner frontend delivery system, values: DVBS DVBS2 DVBT DVBT2 DVBC DVBC_B DVBC_C (defaults to all)\n"
      "  -Cn\tvtuner CA ids in hex for slot n, e.g. 0xd98,0x98c (defaults to none)\n"
      "  -Sn\tvtuner CA sids for slot n, e.g. 4911,5301 (defaults to none)\n"
      "  -f\tfrontend on satip receiver, number between 1 to N (defaults to let receiver decide)\n"
+     "    \tcomma separated list for failover on busy tuners, 0 = let receiver decide, e.g. 2,3,0\n"
      "  -l\tloglevel: 1 = error, 2 = warnings, 3 = info, 4 = debug (defaults to error)\n"
      "  -m\tmask for logs: 1 = main, 2 = net, 4 = data, 7 = all (defaults to main + net)\n"
+     "  -j\tloglevel of messages of any type kept in memory and written to " SATIP_CRASH_FILE "\n"
+     "    \ton a crash, besides the last ones logged (defaults to 0 = only those)\n"
      "  -r\tfixed rtp port (e.g. 45200)\n"
+     "  -x\tserver cache file for -s ssdp (defaults to " SATIP_SERVER_CACHE ")\n"
+     "  -X\tSSDP search address (defaults to " SATIP_SSDP_TARGET ")\n"
+     "  -y\tcache file of services, PMT pids of scrambled ones are sent as x_pmt with the first PLAY\n"
+     "    \t(defaults to " SATIP_PMT_CACHE ", - = off)\n"
+     "  -G\tms PSI and the pids of the service last seen on a transponder are requested on tuning,\n"
+     "    \tthose the application does not ask for are dropped after (defaults to %d, 0 = off)\n"
      "  -T\ttest mode without vtuner, ts packets gets written to stdout!!\n"
      "  -u\trun as user\n"
-     ,name
+     "  -L\tlinger time in ms before a closed session is torn down (defaults to 0)\n"
+     "  -t\tmin,max RTSP request timeout in ms, adapted to measured round trip time (defaults to 1000,10000)\n"
+     "  -Q\tmaximum URL length the server accepts, longer pid lists are sent in several PLAYs\n"
+     "    \tor as pids=all (defaults to %d, lowered on \"414 Request-URI Too Long\")\n"
+     "  -P\tprobe server by DESCRIBE before SETUP, state cached for n seconds (defaults to off)\n"
+     "  -R\tRTCP receiver report interval in ms, 0 disables (defaults to 5000)\n"
+     "  -k\tkeep the session alive by RTCP receiver reports instead of RTSP OPTIONS\n"
+     "    \tOPTIONS are still sent while no report goes out, e.g. server address not yet known\n"
+     "  -w\tkeep a warm RTSP connection, verified every n seconds (defaults to off)\n"
+     ,name,name,SATIP_SHM_INTERVAL,SATIP_MAX_TUNERS,SATIP_PREFETCH_GRACE,SATIP_RTSP_URL_MAX
      );
 }
 
 int main(int argc, char** argv)
 {
   char* host = NULL;
-  char* port = "554";
-  char* device = "/dev/vtunerc0";
+  char* port = NULL;
   char* delsys = NULL;
   char* user = NULL;
   char* caids[VTUNER_MAX_CAIDS] = {};
   char* sids[VTUNER_MAX_SIDS] = {};
   int frontend = -1;
+  int fe_list[16];
+  int fe_count = 0;
   int fixed_rtp_port = -1;
+  int warm_interval = 0;
+  int linger = 0;
+  int rto_min = 0;
+  int rto_max = 0;
+  int report_interval = 5000;
+  int rtcp_keepalive = 0;
+  int probe_interval = 0;
+  int url_max = SATIP_RTSP_URL_MAX;
+  char* server_cache = SATIP_SERVER_CACHE;
+  char* ssdp_target = SATIP_SSDP_TARGET;
+  char* config_file = NULL;
+  int foreground = 0;
+  int workers = -1;
+  int shared_rtp = 0;
+  t_satip_sched rtp_sched[SATIP_SCHED_MAX_THREADS];
+  int rtp_nsched = 0;
+  t_satip_sched main_sched;
+  t_satip_sched_stats* main_stats;
+  int recorder_level = 0;
+  char* metrics_addr = NULL;
+  int stats_interval = SATIP_SHM_INTERVAL;
+  char* pmt_cache = SATIP_PMT_CACHE;
+  int prefetch_grace = SATIP_PREFETCH_GRACE;
+
+  t_satip_tuner* tuner;
+  t_satip_pool* pool = NULL;
+
+  struct satip_evloop* evloop;
+  struct polltimer_queue* timerq;
 
-  t_satip_config* satconf;
-  struct satip_rtsp* srtsp;
-  struct satip_rtp* srtp;
-  struct satip_vtuner* satvt;
+  int opt;
+  int i;
 
-  struct pollfd pollfds[2];
-  int poll_idx;
-  struct polltimer* timerq=NULL;
+  log_configure(0);
 
-  int opt;
+  /* signals by signalfd, blocked before any thread is started */
+  evloop = satip_evloop_new();
+  if ( evloop == NULL )
+    exit(1);
+  satip_evloop_add_signal(evloop, SIGHUP, signal_event, NULL);
+  satip_evloop_add_signal(evloop, SIGINT, signal_event, NULL);
+  satip_evloop_add_signal(evloop, SIGTERM, signal_event, NULL);
+  satip_evloop_add_signal(evloop, SIGUSR1, signal_event, NULL);
+  satip_evloop_add_signal(evloop, SIGUSR2, signal_event, NULL);
 
-  signal(SIGHUP, hangup);
-  signal(SIGINT, hangup);
-  signal(SIGTERM, hangup);
+  satip_sched_init(&main_sched);
 
-  char optfmt[80] = "s:Tp:d:D:f:m:l:r:u:h::SC";
-  for (int i=0; i<VTUNER_MAX_SLOTS;i++) optfmt[24+i]=48+i;
+  char optfmt[80] = "s:Tp:d:D:f:m:l:j:r:R:kP:Q:u:w:L:t:x:X:c:FW:UA:M:e:g:y:G:h::SC";
+  int optlen = strlen(optfmt);
+  for (int i=0; i<VTUNER_MAX_SLOTS;i++) optfmt[optlen+i]=48+i;
+
+  /* config file options go first, the command line overrides them */
+  for ( i=1; i<argc-1; i++ )
+    if ( strcmp(argv[i],"-c") == 0 )
+      {
+	config_file = argv[i+1];
+	if ( read_config(config_file, &argc, &argv) )
+	  exit(1);
+	break;
+      }
 
 
   while((opt = getopt(argc, argv, optfmt)) != -1 ) {
@@ -229,7 +575,12 @@ int main(int argc, char** argv)
 	break;
 
       case 'd': 
-	device = optarg;
+	if ( tuner_count == SATIP_MAX_TUNERS )
+	  {
+	    fprintf(stderr, "more than %d vtuner devices\n", SATIP_MAX_TUNERS);
+	    exit(1);
+	  }
+	tuners[tuner_count++].device = optarg;
 	break;
 
       case 'D':
@@ -237,7 +588,16 @@ int main(int argc, char** argv)
         break;
 
       case 'f': 
-	frontend = atoi(optarg);
+	{
+	  char *token = strtok(optarg, ",");
+	  while (token != NULL && fe_count < 16)
+	    {
+	      fe_list[fe_count++] = atoi(token);
+	      token = strtok(NULL, ",");
+	    }
+	  if (fe_count > 0)
+	    frontend = fe_list[0];
+	}
 	break;	
 
       case 'm':
@@ -248,18 +608,108 @@ int main(int argc, char** argv)
 	dbg_level = atoi(optarg);
 	break;
 
+      case 'j':
+	recorder_level = atoi(optarg);
+	break;
+
       case 'r':
 	fixed_rtp_port = atoi(optarg);
 	break;
 
+      case 'R':
+	report_interval = atoi(optarg);
+	break;
+
+      case 'k':
+	rtcp_keepalive = 1;
+	break;
+
+      case 'P':
+	probe_interval = atoi(optarg);
+	break;
+
+      case 'Q':
+	url_max = atoi(optarg);
+	break;
+
+      case 'x':
+	server_cache = optarg;
+	break;
+
+      case 'X':
+	ssdp_target = optarg;
+	break;
+
       case 'T':
 	test_sequencer = 1;
         break;
 
+      case 'c':
+	/* read already */
+	break;
+
+      case 'F':
+	foreground = 1;
+	break;
+
+      case 'W':
+	workers = atoi(optarg);
+	break;
+
+      case 'U':
+	shared_rtp = 1;
+	break;
+
+      case 'A':
+	if ( rtp_nsched == SATIP_SCHED_MAX_THREADS ||
+	     satip_sched_parse(optarg, &rtp_sched[rtp_nsched]) )
+	  {
+	    fprintf(stderr,"invalid thread placement: %s\n",optarg);
+	    exit(1);
+	  }
+	rtp_nsched++;
+	break;
+
+      case 'M':
+	if ( satip_sched_parse(optarg, &main_sched) )
+	  {
+	    fprintf(stderr,"invalid thread placement: %s\n",optarg);
+	    exit(1);
+	  }
+	break;
+
+      case 'e':
+	metrics_addr = optarg;
+	break;
+
+      case 'g':
+	stats_interval = atoi(optarg);
+	break;
+
+      case 'y':
+	pmt_cache = strcmp(optarg,"-") ? optarg : NULL;
+	break;
+
+      case 'G':
+	prefetch_grace = atoi(optarg);
+	break;
+
       case 'u': 
 	user = optarg;
 	break;
 
+      case 'w':
+	warm_interval = atoi(optarg);
+	break;
+
+      case 'L':
+	linger = atoi(optarg);
+	break;
+
+      case 't':
+	sscanf(optarg, "%d,%d", &rto_min, &rto_max);
+	break;
+
       case 'C':
 	if (argv[optind] && argv[optind+1] && argv[optind+1][0]!='-') {
 		char *endptr;
@@ -297,82 +747,191 @@ int main(int argc, char** argv)
     exit(1);
   }
         
+  if ( config_file!=NULL )
+    {
+      /* fixed ports per tuner for firewall rules, few RTP threads for all tuners */
+      if ( fixed_rtp_port == -1 )
+	fixed_rtp_port = SATIP_RTP_PORT_BASE;
+      if ( workers == -1 )
+	workers = DAEMON_WORKERS;
+
+      if ( !foreground && !test_sequencer )
+	{
+	  if ( daemon(0,0) )
+	    {
+	      perror("daemon");
+	      exit(1);
+	    }
+	  use_syslog = 1;
+	}
+    }
+
+  /* pid of the daemon, writer runs without RT priority of the main thread */
+  log_configure(recorder_level);
+
+  /* written as the user, only crash dumps and traces in run dir */
+  private_dir(SATIP_CACHE_DIR, user);
+  log_start_writer(private_dir(SATIP_RUN_DIR, user) ? NULL : SATIP_CRASH_FILE);
+
   if ( user!=NULL )
     set_user(user);
 
-  enable_rt_scheduling();
+  /* timer nodes are taken before pages get locked */
+  timerq = polltimer_queue_new(TIMER_POOL, 1);
+  if ( polltimer_fd(timerq) >= 0 )
+    satip_evloop_add(evloop, polltimer_fd(timerq), EPOLLIN|EPOLLET, timer_event, timerq);
+  satip_rtsp_set_evloop(evloop);
+
+  main_stats = enable_rt_scheduling(&main_sched);
+
+  if ( rtp_nsched > 0 )
+    satip_rtp_set_sched(rtp_sched, rtp_nsched);
+
+  if ( shared_rtp )
+    {
+      if ( satip_rtp_share_socket(fixed_rtp_port != -1 ? fixed_rtp_port : SATIP_RTP_PORT_BASE,
+				  workers) )
+	exit(1);
+    }
+  else if ( workers > 0 && satip_rtp_start_workers(workers) )
+    exit(1);
 
-  satconf = satip_new_config(frontend);
+  if ( strcmp(host,"ssdp")==0 )
+    {
+      t_satip_server* server = discover_server(server_cache, ssdp_target, delsys);
+
+      if ( server == NULL )
+	{
+	  ERROR(MSG_MAIN,"no satip receiver found\n");
+	  exit(1);
+	}
+
+      INFO(MSG_MAIN,"using satip receiver %s (%s)\n",server->host,server->uuid);
+      host = server->host;
+      if ( port == NULL )
+	port = server->port;
+    }
+
+  if ( port == NULL )
+    port = "554";
+
+  if ( strchr(host,',') != NULL )
+    {
+      pool = satip_pool_new(host, port);
+      if ( pool->count == 0 )
+	{
+	  ERROR(MSG_MAIN,"no valid server in %s\n", host);
+	  exit(1);
+	}
+      host = strdup(pool->server[0].host);
+      port = strdup(pool->server[0].port);
+    }
+
+  if ( tuner_count == 0 )
+    tuners[tuner_count++].device = "/dev/vtunerc0";
+
+  /* read as the user it gets written as */
+  satip_pmtcache_load(pmt_cache, timerq);
 
   if (test_sequencer) {
 
-    struct polltimer_periodic* periodic;
+    polltimer_periodic_start(timerq,
+			     test_sequencer_loop,
+			     10,
+			     NULL);
+  }
 
-    device = device;
-    satvt = NULL;
-    polltimer_periodic_start(&timerq,
-			   &periodic,
-			   test_sequencer_loop,
-			   10,
-			   (void*)satconf);
-  
-    srtp  = satip_rtp_new(1, fixed_rtp_port);
-  
-    /* no vtuner fd*/
-    poll_idx=0;
+  if ( tuner_count > 1 )
+    share = satip_share_new();
 
-  } else {
+  for ( i=0; i<tuner_count; i++ )
+    {
+      tuner = &tuners[i];
+      tuner->satconf = satip_new_config(frontend);
+      tuner->session = share ? satip_new_config(frontend) : tuner->satconf;
 
-    satvt = satip_vtuner_new( device, delsys, caids, sids, satconf );
-  
-    if ( satvt == NULL )
-      {
-        fprintf(stderr,"cannot open %s\n", device);
-        exit(1);
+      if (test_sequencer) {
+
+	tuner->satvt = NULL;
+	tuner->srtp  = satip_rtp_new(1, fixed_rtp_port>0 ? fixed_rtp_port+2*i : fixed_rtp_port);
+
+      } else {
+
+	tuner->satvt = satip_vtuner_new( tuner->device, delsys, caids, sids, tuner->satconf );
+
+	if ( tuner->satvt == NULL )
+	  {
+	    ERROR(MSG_MAIN,"cannot open %s\n", tuner->device);
+	    exit(1);
+	  }
+
+	tuner->srtp  = satip_rtp_new(satip_vtuner_fd(tuner->satvt),
+				     fixed_rtp_port>0 ? fixed_rtp_port+2*i : fixed_rtp_port);
+	satip_vtuner_set_prefetch(tuner->satvt, timerq, prefetch_grace, &update_pending);
+
+	/* one message per event, level triggered */
+	if ( satip_evloop_add(evloop, satip_vtuner_fd(tuner->satvt), EPOLLPRI,
+			      vtuner_event, tuner->satvt) )
+	  exit(1);
       }
 
-    srtp  = satip_rtp_new(satip_vtuner_fd(satvt), fixed_rtp_port);
+      if ( tuner->srtp == NULL )
+	{
+	  ERROR(MSG_MAIN,"cannot open rtp/rtcp ports for %s\n", tuner->device);
+	  exit(1);
+	}
+
+      satip_rtp_set_report_interval(tuner->srtp, report_interval);
+
+      if ( share )
+	satip_share_add(share, tuner->satconf, tuner->session, tuner->srtp,
+			tuner->satvt ? satip_vtuner_fd(tuner->satvt) : 1);
+
+      tuner->srtsp = satip_rtsp_new(tuner->session,timerq, host, port, tuner->srtp);
+      satip_rtsp_set_warm(tuner->srtsp, warm_interval*1000);
+      satip_rtsp_set_linger(tuner->srtsp, linger);
+      if (fe_count > 1)
+	satip_rtsp_set_frontends(tuner->srtsp, fe_list, fe_count);
+      satip_rtsp_set_timeouts(tuner->srtsp, rto_min, rto_max);
+      satip_rtsp_set_probe(tuner->srtsp, probe_interval*1000);
+      satip_rtsp_set_url_max(tuner->srtsp, url_max);
+      /* one pool for all tuners, their sessions count in its load */
+      if (pool != NULL)
+	satip_rtsp_set_pool(tuner->srtsp, pool);
+      if (rtcp_keepalive && report_interval > 0)
+	satip_rtsp_set_rtcp_keepalive(tuner->srtsp, 1);
+
+      satip_metrics_add_tuner(tuner->device, tuner->srtp, tuner->srtsp, tuner->satvt);
+      satip_shm_add_tuner(tuner->device, tuner->session, tuner->srtp, tuner->srtsp);
+    }
 
-    pollfds[0].fd=satip_vtuner_fd(satvt);
-    pollfds[0].events = POLLPRI;
-    poll_idx=1;
-  }
+  satip_shm_start(timerq, stats_interval);
 
-  srtsp = satip_rtsp_new(satconf,&timerq, host, port, srtp);
+  if ( metrics_addr != NULL && satip_metrics_listen(evloop, timerq, metrics_addr) )
+    exit(1);
 
   while (1)
     {
-      /* apply any updates on rtsp  */
-      satip_rtsp_check_update(srtsp, abort_all);
-      if (abort_all) exit(0);
+      if ( update_pending )
+	{
+	  update_pending = 0;
+	  update_tuners();
+	}
 
-      /* vt control events */
-      pollfds[0].revents = 0;
-      
-      /* rtsp socket may be closed */
-      pollfds[poll_idx].fd = satip_rtsp_socket(srtsp);
-      pollfds[poll_idx].events = satip_rtsp_pollflags(srtsp);
-      pollfds[poll_idx].revents = 0;
-      
-      /* poll and timeout on next pending timer */
-      if ( poll(pollfds, pollfds[poll_idx].events == 0 ? poll_idx : poll_idx+1 , 
-		polltimer_next_ms(timerq) ) ==-1 && 
-	   errno!=EINTR )
+      /* timeout on next pending timer, unless there is a timerfd */
+      if ( satip_evloop_run(evloop, polltimer_fd(timerq) < 0 ?
+			    polltimer_next_ms(timerq) : -1) < 0 )
 	{
 	  perror(NULL);
 	  exit(1);
 	}
+      satip_sched_wakeup(main_stats);
 
-      /* schedule timer callbacks */
-      polltimer_call_next(&timerq);
-	
-      /* vt control event handling */
-      if ( poll_idx>0 && pollfds[0].revents !=0 )
-	satip_vtuner_event(satvt);
-
-      /* rtsp event handling */
-      if ( pollfds[poll_idx].revents !=0 ) 
-	satip_rtsp_pollevents(srtsp, pollfds[poll_idx].revents);  
+      if ( polltimer_fd(timerq) < 0 )
+	{
+	  polltimer_call_next(timerq);
+	  update_pending = 1;
+	}
     }
   
   return 0;
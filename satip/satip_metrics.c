@@ -0,0 +1,540 @@
+/*
+ * satip: metrics in Prometheus text format
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "satip_metrics.h"
+#include "satip_config.h"
+#include "satip_rtsp.h"
+#include "satip_vtuner.h"
+#include "satip_sched.h"
+#include "polltimer.h"
+#include "log.h"
+
+#define REQUEST_MAX   1024
+#define OUTBUF_INITIAL 8192
+
+/* msec from accept until the response is sent */
+#define CLIENT_TIMEOUT 5000
+
+typedef struct metrics_tuner
+{
+  const char* device;
+  t_satip_rtp* srtp;
+  struct satip_rtsp* rtsp;
+  struct satip_vtuner* vt;
+  t_satip_rtp_counters counters;  /* snapshot of the current scrape */
+} t_metrics_tuner;
+
+typedef struct metrics_client
+{
+  int fd;                 /* -1 = free */
+  char request[REQUEST_MAX];
+  int request_len;
+  char* out;
+  int out_len;
+  int out_sent;
+  struct polltimer* timer;
+} t_metrics_client;
+
+static t_metrics_tuner tuners[SATIP_METRICS_MAX_TUNERS];
+static int tuner_count = 0;
+static t_metrics_client clients[SATIP_METRICS_MAX_CLIENTS];
+static struct satip_evloop* evloop = NULL;
+static struct polltimer_queue* timer_queue = NULL;
+
+/* counters of the RTP side, all per tuner */
+static const struct
+{
+  const char* name;
+  const char* help;
+  size_t offset;
+} rtp_metrics[] =
+  {
+    { "satip_rtp_datagrams_total", "RTP datagrams received",
+      offsetof(t_satip_rtp_counters, datagrams) },
+    { "satip_rtp_bytes_total", "RTP bytes received",
+      offsetof(t_satip_rtp_counters, bytes) },
+    { "satip_rtp_sequence_lost_total", "RTP sequence numbers missing",
+      offsetof(t_satip_rtp_counters, seq_lost) },
+    { "satip_rtp_sequence_resets_total", "RTP sequence jumps restarting the statistics",
+      offsetof(t_satip_rtp_counters, seq_resets) },
+    { "satip_rtp_filler_writes_total", "filler packets written for datagrams without TS",
+      offsetof(t_satip_rtp_counters, fillers) },
+    { "satip_rtcp_packets_total", "RTCP datagrams received",
+      offsetof(t_satip_rtp_counters, rtcp) },
+  };
+
+
+/* response grows on demand, returns -1 without memory */
+static int out_printf(t_metrics_client* c, int* size, const char* fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  while (1)
+    {
+      va_start(ap, fmt);
+      n = vsnprintf(c->out+c->out_len, *size-c->out_len, fmt, ap);
+      va_end(ap);
+
+      if ( n < 0 )
+	return -1;
+      if ( c->out_len+n < *size )
+	break;
+
+      *size *= 2;
+      c->out = (char*)realloc(c->out, *size);
+      if ( c->out == NULL )
+	return -1;
+    }
+
+  c->out_len += n;
+  return 0;
+}
+
+#define OUT(...) \
+  do { if ( out_printf(c, &size, __VA_ARGS__) ) return -1; } while (0)
+
+static int format_metrics(t_metrics_client* c, int* psize)
+{
+  static const int bounds[SATIP_RTP_ZAP_BUCKETS] = SATIP_RTP_ZAP_BOUNDS;
+  static const char* prefetch[SATIPCFG_PREFETCH_KINDS] = { "none", "psi", "predicted" };
+  const t_satip_sched_stats* thread;
+  struct timespec cpu;
+  int size = *psize;
+  unsigned int m;
+  int i,j,k,r;
+
+  for ( i=0; i<tuner_count; i++ )
+    satip_rtp_get_counters(tuners[i].srtp, &tuners[i].counters);
+
+#define TUNER "tuner=\"%d\",device=\"%s\""
+#define PREFETCH "prefetch=\"%s\""
+
+  for ( m=0; m<sizeof(rtp_metrics)/sizeof(rtp_metrics[0]); m++ )
+    {
+      OUT("# HELP %s %s\n# TYPE %s counter\n",
+	  rtp_metrics[m].name, rtp_metrics[m].help, rtp_metrics[m].name);
+      for ( i=0; i<tuner_count; i++ )
+	OUT("%s{" TUNER "} %llu\n", rtp_metrics[m].name, i, tuners[i].device,
+	    (unsigned long long)*(uint64_t*)((char*)&tuners[i].counters + rtp_metrics[m].offset));
+    }
+
+  OUT("# HELP satip_rtp_socket_drops_total datagrams dropped by the kernel on the RTP socket\n"
+      "# TYPE satip_rtp_socket_drops_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    {
+      long drops = satip_rtp_socket_drops(tuners[i].srtp);
+      if ( drops >= 0 )
+	OUT("satip_rtp_socket_drops_total{" TUNER "} %ld\n", i, tuners[i].device, drops);
+    }
+
+  /* one per socket of the group, whatever streams it carried */
+  OUT("# HELP satip_rtp_shared_socket_drops_total datagrams dropped by the kernel on a shared RTP socket\n"
+      "# TYPE satip_rtp_shared_socket_drops_total counter\n");
+  for ( i=0; ; i++ )
+    {
+      long drops = satip_rtp_shared_socket_drops(i);
+      if ( drops < 0 )
+	break;
+      OUT("satip_rtp_shared_socket_drops_total{socket=\"%d\"} %ld\n", i, drops);
+    }
+
+  OUT("# HELP satip_signal_level signal level of the last RTCP report, 0-255\n"
+      "# TYPE satip_signal_level gauge\n");
+  for ( i=0; i<tuner_count; i++ )
+    OUT("satip_signal_level{" TUNER "} %d\n", i, tuners[i].device, tuners[i].counters.signallevel);
+
+  OUT("# HELP satip_signal_quality signal quality of the last RTCP report, 0-15\n"
+      "# TYPE satip_signal_quality gauge\n");
+  for ( i=0; i<tuner_count; i++ )
+    OUT("satip_signal_quality{" TUNER "} %d\n", i, tuners[i].device, tuners[i].counters.quality);
+
+  OUT("# HELP satip_signal_lock frontend lock of the last RTCP report\n"
+      "# TYPE satip_signal_lock gauge\n");
+  for ( i=0; i<tuner_count; i++ )
+    if ( tuners[i].counters.lock >= 0 )
+      OUT("satip_signal_lock{" TUNER "} %d\n", i, tuners[i].device, tuners[i].counters.lock);
+
+  /* split by the pids prefetched with the tuning, the saving reads off directly */
+  OUT("# HELP satip_zap_seconds time from tuning request to first TS data\n"
+      "# TYPE satip_zap_seconds histogram\n");
+  for ( i=0; i<tuner_count; i++ )
+    for ( k=0; k<SATIPCFG_PREFETCH_KINDS; k++ )
+      {
+	t_satip_rtp_counters* rc=&tuners[i].counters;
+	uint64_t sum=0;
+
+	for ( j=0; j<SATIP_RTP_ZAP_BUCKETS-1; j++ )
+	  {
+	    sum += rc->zap_bucket[k][j];
+	    OUT("satip_zap_seconds_bucket{" TUNER "," PREFETCH ",le=\"%g\"} %llu\n",
+		i, tuners[i].device, prefetch[k], bounds[j]/1000.0, (unsigned long long)sum);
+	  }
+	OUT("satip_zap_seconds_bucket{" TUNER "," PREFETCH ",le=\"+Inf\"} %llu\n",
+	    i, tuners[i].device, prefetch[k], (unsigned long long)rc->zaps[k]);
+	OUT("satip_zap_seconds_sum{" TUNER "," PREFETCH "} %.6f\n",
+	    i, tuners[i].device, prefetch[k], rc->zap_usec[k]/1000000.0);
+	OUT("satip_zap_seconds_count{" TUNER "," PREFETCH "} %llu\n",
+	    i, tuners[i].device, prefetch[k], (unsigned long long)rc->zaps[k]);
+      }
+
+  /* RTSP is handled by this thread, no snapshot needed */
+  OUT("# HELP satip_rtsp_requests_total RTSP requests by type and result\n"
+      "# TYPE satip_rtsp_requests_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    {
+      const t_satip_rtsp_counters* rc=satip_rtsp_get_counters(tuners[i].rtsp);
+      static const char* results[] = { "ok", "error", "none" };
+
+      for ( j=0; j<SATIP_RTSP_REQUEST_TYPES; j++ )
+	for ( r=0; r<3; r++ )
+	  OUT("satip_rtsp_requests_total{" TUNER ",request=\"%s\",result=\"%s\"} %lu\n",
+	      i, tuners[i].device, satip_rtsp_request_name(j), results[r], rc->requests[j][r]);
+    }
+
+  OUT("# HELP satip_rtsp_connects_total RTSP connection attempts\n"
+      "# TYPE satip_rtsp_connects_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    OUT("satip_rtsp_connects_total{" TUNER "} %lu\n", i, tuners[i].device,
+	satip_rtsp_get_counters(tuners[i].rtsp)->connects);
+
+  OUT("# HELP satip_rtsp_timeouts_total RTSP requests or connects timed out\n"
+      "# TYPE satip_rtsp_timeouts_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    OUT("satip_rtsp_timeouts_total{" TUNER "} %lu\n", i, tuners[i].device,
+	satip_rtsp_get_counters(tuners[i].rtsp)->timeouts);
+
+  /* vtuner is handled by this thread as well, none in test mode */
+  OUT("# HELP satip_prefetch_tunings_total tunings with pids requested in advance\n"
+      "# TYPE satip_prefetch_tunings_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    if ( tuners[i].vt != NULL )
+      OUT("satip_prefetch_tunings_total{" TUNER "} %lu\n", i, tuners[i].device,
+	  satip_vtuner_get_counters(tuners[i].vt)->tunings);
+
+  OUT("# HELP satip_prefetch_predicted_total tunings with the pids of a cached service\n"
+      "# TYPE satip_prefetch_predicted_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    if ( tuners[i].vt != NULL )
+      OUT("satip_prefetch_predicted_total{" TUNER "} %lu\n", i, tuners[i].device,
+	  satip_vtuner_get_counters(tuners[i].vt)->predicted);
+
+  OUT("# HELP satip_prefetch_pids_total predicted pids by whether the application asked for them\n"
+      "# TYPE satip_prefetch_pids_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    if ( tuners[i].vt != NULL )
+      {
+	const t_satip_vtuner_counters* vc=satip_vtuner_get_counters(tuners[i].vt);
+
+	OUT("satip_prefetch_pids_total{" TUNER ",result=\"used\"} %lu\n",
+	    i, tuners[i].device, vc->pids_used);
+	OUT("satip_prefetch_pids_total{" TUNER ",result=\"trimmed\"} %lu\n",
+	    i, tuners[i].device, vc->pids_trimmed);
+      }
+
+  OUT("# HELP satip_prefetch_ahead_seconds_total lead of predicted pids over the application asking for them\n"
+      "# TYPE satip_prefetch_ahead_seconds_total counter\n");
+  for ( i=0; i<tuner_count; i++ )
+    if ( tuners[i].vt != NULL )
+      OUT("satip_prefetch_ahead_seconds_total{" TUNER "} %.6f\n", i, tuners[i].device,
+	  satip_vtuner_get_counters(tuners[i].vt)->ahead_usec/1000000.0);
+
+#undef TUNER
+
+  OUT("# HELP satip_thread_cpu_seconds_total CPU time of the thread\n"
+      "# TYPE satip_thread_cpu_seconds_total counter\n");
+  for ( i=0; (thread=satip_sched_thread(i))!=NULL; i++ )
+    if ( thread->cpuclock != (clockid_t)-1 && clock_gettime(thread->cpuclock, &cpu) == 0 )
+      OUT("satip_thread_cpu_seconds_total{thread=\"%s\",tid=\"%d\"} %ld.%06ld\n",
+	  thread->name, (int)thread->tid, (long)cpu.tv_sec, cpu.tv_nsec/1000);
+
+  OUT("# HELP satip_thread_wakeups_total loop iterations of the thread\n"
+      "# TYPE satip_thread_wakeups_total counter\n");
+  for ( i=0; (thread=satip_sched_thread(i))!=NULL; i++ )
+    OUT("satip_thread_wakeups_total{thread=\"%s\",tid=\"%d\"} %lu\n",
+	thread->name, (int)thread->tid, thread->wakeups);
+
+  OUT("# HELP satip_thread_migrations_total wakeups on another CPU than before\n"
+      "# TYPE satip_thread_migrations_total counter\n");
+  for ( i=0; (thread=satip_sched_thread(i))!=NULL; i++ )
+    OUT("satip_thread_migrations_total{thread=\"%s\",tid=\"%d\"} %lu\n",
+	thread->name, (int)thread->tid, thread->migrations);
+
+  *psize = size;
+  return 0;
+}
+
+static void client_close(t_metrics_client* c)
+{
+  polltimer_cancel(timer_queue, &c->timer);
+  satip_evloop_del(evloop, c->fd);
+  close(c->fd);
+  c->fd = -1;
+  free(c->out);
+  c->out = NULL;
+}
+
+/* header and body, any GET of / or /metrics gets the metrics */
+static int build_response(t_metrics_client* c)
+{
+  int size = OUTBUF_INITIAL;
+  int header_len;
+  char header[160];
+
+  c->out = (char*)malloc(size);
+  c->out_len = 0;
+  c->out_sent = 0;
+  if ( c->out == NULL )
+    return -1;
+
+  if ( strncmp(c->request, "GET / ", 6) && strncmp(c->request, "GET /metrics", 12) )
+    {
+      c->out_len = snprintf(c->out, size,
+			    "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      return 0;
+    }
+
+  /* body first, the header needs its length */
+  if ( format_metrics(c, &size) )
+    return -1;
+
+  header_len = snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %d\r\n"
+			"Connection: close\r\n\r\n", c->out_len);
+
+  if ( c->out_len+header_len >= size &&
+       (c->out = (char*)realloc(c->out, c->out_len+header_len+1)) == NULL )
+    return -1;
+  memmove(c->out+header_len, c->out, c->out_len);
+  memcpy(c->out, header, header_len);
+  c->out_len += header_len;
+  return 0;
+}
+
+static void client_event(int fd, unsigned int events, void* param)
+{
+  t_metrics_client* c=(t_metrics_client*)param;
+  int n;
+
+  UNUSED(fd);
+
+  if ( c->out == NULL && ( events & EPOLLIN ) )
+    {
+      n = recv(c->fd, c->request+c->request_len, REQUEST_MAX-1-c->request_len, 0);
+      if ( n <= 0 )
+	{
+	  if ( n == 0 || errno != EAGAIN )
+	    client_close(c);
+	  return;
+	}
+      c->request_len += n;
+      c->request[c->request_len] = 0;
+
+      /* the rest of the request is of no interest */
+      if ( strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL &&
+	   c->request_len < REQUEST_MAX-1 )
+	return;
+
+      if ( build_response(c) )
+	{
+	  ERROR(MSG_MAIN,"metrics: out of memory\n");
+	  client_close(c);
+	  return;
+	}
+      satip_evloop_modify(evloop, c->fd, EPOLLOUT);
+      events |= EPOLLOUT;
+    }
+
+  if ( c->out != NULL && ( events & EPOLLOUT ) )
+    {
+      n = send(c->fd, c->out+c->out_sent, c->out_len-c->out_sent, MSG_NOSIGNAL);
+      if ( n < 0 && errno == EAGAIN )
+	return;
+      if ( n > 0 )
+	c->out_sent += n;
+      if ( n <= 0 || c->out_sent == c->out_len )
+	client_close(c);
+      return;
+    }
+
+  if ( events & ( EPOLLHUP | EPOLLERR ) )
+    client_close(c);
+}
+
+/* a client that never completes its request keeps no slot */
+static void timeout_client(void* param)
+{
+  t_metrics_client* c=(t_metrics_client*)param;
+
+  /* timer expired, clear it */
+  c->timer = NULL;
+
+  DEBUG(MSG_MAIN,"metrics: client timed out\n");
+  client_close(c);
+}
+
+static void listen_event(int fd, unsigned int events, void* param)
+{
+  int sock;
+  int i;
+
+  UNUSED(events);
+  UNUSED(param);
+
+  while ( ( sock = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC) ) >= 0 )
+    {
+      for ( i=0; i<SATIP_METRICS_MAX_CLIENTS && clients[i].fd >= 0; i++ )
+	;
+
+      if ( i == SATIP_METRICS_MAX_CLIENTS ||
+	   satip_evloop_add(evloop, sock, EPOLLIN, client_event, &clients[i]) )
+	{
+	  DEBUG(MSG_MAIN,"metrics: too many clients\n");
+	  close(sock);
+	  continue;
+	}
+
+      clients[i].fd = sock;
+      clients[i].request_len = 0;
+      clients[i].out = NULL;
+      clients[i].timer = polltimer_start(timer_queue, timeout_client,
+					 CLIENT_TIMEOUT, &clients[i]);
+    }
+}
+
+static int listen_unix(const char* path)
+{
+  struct sockaddr_un addr;
+  int sock;
+
+  if ( strlen(path) >= sizeof(addr.sun_path) )
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ( sock < 0 )
+    return -1;
+  if ( bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(sock, 4) )
+    {
+      close(sock);
+      return -1;
+    }
+  return sock;
+}
+
+static int listen_tcp(const char* addr)
+{
+  char host[64] = "127.0.0.1";
+  const char* port = addr;
+  const char* colon = strrchr(addr, ':');
+  struct addrinfo hints;
+  struct addrinfo* result;
+  struct addrinfo* rp;
+  int sock = -1;
+  int one = 1;
+
+  if ( colon != NULL )
+    {
+      snprintf(host, sizeof(host), "%.*s", (int)(colon-addr), addr);
+      port = colon+1;
+    }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  if ( getaddrinfo(host, port, &hints, &result) )
+    return -1;
+
+  for ( rp = result; rp != NULL; rp = rp->ai_next )
+    {
+      sock = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+      if ( sock < 0 )
+	continue;
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if ( bind(sock, rp->ai_addr, rp->ai_addrlen) == 0 && listen(sock, 4) == 0 )
+	break;
+      close(sock);
+      sock = -1;
+    }
+
+  freeaddrinfo(result);
+  return sock;
+}
+
+int satip_metrics_listen(struct satip_evloop* loop, struct polltimer_queue* queue,
+			 const char* addr)
+{
+  int sock;
+  int i;
+
+  sock = addr[0] == '/' ? listen_unix(addr) : listen_tcp(addr);
+  if ( sock < 0 )
+    {
+      ERROR(MSG_MAIN,"metrics: cannot listen on %s: %s\n", addr, strerror(errno));
+      return -1;
+    }
+
+  for ( i=0; i<SATIP_METRICS_MAX_CLIENTS; i++ )
+    clients[i].fd = -1;
+
+  evloop = loop;
+  timer_queue = queue;
+  if ( satip_evloop_add(loop, sock, EPOLLIN, listen_event, NULL) )
+    {
+      close(sock);
+      return -1;
+    }
+
+  INFO(MSG_MAIN,"metrics on %s\n", addr);
+  return 0;
+}
+
+void satip_metrics_add_tuner(const char* device, t_satip_rtp* srtp, struct satip_rtsp* rtsp,
+			     struct satip_vtuner* vt)
+{
+  if ( tuner_count == SATIP_METRICS_MAX_TUNERS )
+    return;
+
+  tuners[tuner_count].device = device != NULL ? device : "";
+  tuners[tuner_count].srtp = srtp;
+  tuners[tuner_count].rtsp = rtsp;
+  tuners[tuner_count].vt = vt;
+  tuner_count++;
+}
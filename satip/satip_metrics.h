@@ -0,0 +1,45 @@
+/*
+ * satip: metrics in Prometheus text format
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_METRICS_H
+#define _SATIP_METRICS_H
+
+#include "satip_rtp.h"
+#include "satip_evloop.h"
+
+#define SATIP_METRICS_MAX_TUNERS  SATIP_MAX_TUNERS
+#define SATIP_METRICS_MAX_CLIENTS 4
+
+struct satip_rtsp;
+struct satip_vtuner;
+struct polltimer_queue;
+
+/*
+ * HTTP listener on "[host:]port" (host defaults to 127.0.0.1) or on a
+ * unix socket if addr is a path, served by the main event loop, clients
+ * not done within a deadline on timers of queue are closed
+ */
+int  satip_metrics_listen(struct satip_evloop* loop, struct polltimer_queue* queue,
+			  const char* addr);
+
+/* vt is NULL in test mode */
+void satip_metrics_add_tuner(const char* device, t_satip_rtp* srtp, struct satip_rtsp* rtsp,
+			     struct satip_vtuner* vt);
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * satip: persistent cache of PMT pids for x_pmt
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <linux/dvb/frontend.h>
+
+#include "satip_pmtcache.h"
+#include "polltimer.h"
+#include "log.h"
+
+/* pids below are PAT, CAT, NIT, SDT,.. of every service */
+#define SERVICE_PID_MIN 0x20
+
+/* a service opened pid by pid within this time is one entry */
+#define GROW_SECONDS    10
+
+/* msec a learned PMT waits for more before the file is written */
+#define SAVE_DELAY      5000
+
+typedef struct pmt_entry
+{
+  /* transponder, as in satip_same_transponder() */
+  unsigned int delsys;
+  unsigned int frequency;
+  int polarization;
+  int position;
+
+  /* service: hash of its pids without the PMT, the first ones kept */
+  uint32_t pids_hash;
+  int pids;
+  unsigned short pid[SATIP_PMT_CACHE_PIDS];
+
+  int pmt;             /* -1 = not scrambled or not reported */
+  time_t used;
+} t_pmt_entry;
+
+static t_pmt_entry entries[SATIP_PMT_CACHE_ENTRIES];
+static int entry_count = 0;
+static char* cache_path = NULL;
+static int cache_dirty = 0;
+static struct polltimer_queue* save_queue = NULL;
+static struct polltimer* save_timer = NULL;
+
+
+static void set_transponder(t_pmt_entry* e, t_satip_config* cfg)
+{
+  int sat = ( cfg->delsys == SYS_DVBS || cfg->delsys == SYS_DVBS2 );
+
+  e->delsys = cfg->delsys;
+  e->frequency = cfg->frequency;
+  e->polarization = sat ? (int)cfg->polarization : 0;
+  e->position = sat ? cfg->position : 0;
+}
+
+static int same_transponder(const t_pmt_entry* a, const t_pmt_entry* b)
+{
+  return ( a->delsys == b->delsys && a->frequency == b->frequency &&
+	   a->polarization == b->polarization && a->position == b->position );
+}
+
+/* requested service pids in ascending order, FNV-1a over all of them */
+static void set_service(t_pmt_entry* e, const uint64_t* pids, int skip)
+{
+  uint32_t hash = 2166136261U;
+  int i,pid;
+
+  e->pids = 0;
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    {
+      uint64_t word = pids[i];
+
+      while ( word )
+	{
+	  pid = i*64 + __builtin_ctzll(word);
+	  word &= word-1;
+
+	  if ( pid < SERVICE_PID_MIN || pid == skip )
+	    continue;
+	  hash = ( hash ^ (pid & 0xff) ) * 16777619U;
+	  hash = ( hash ^ (pid >> 8) ) * 16777619U;
+	  if ( e->pids < SATIP_PMT_CACHE_PIDS )
+	    e->pid[e->pids] = pid;
+	  e->pids++;
+	}
+    }
+
+  e->pids_hash = hash;
+}
+
+static int pid_requested(const uint64_t* pids, int pid)
+{
+  return ( pids[pid/64] >> (pid&63) ) & 1;
+}
+
+/* pids of a kept within b or its PMT, both ascending */
+static int subset(const t_pmt_entry* a, const t_pmt_entry* b)
+{
+  int i,j=0;
+
+  for ( i=0; i<a->pids && i<SATIP_PMT_CACHE_PIDS; i++ )
+    {
+      if ( a->pid[i] == b->pmt )
+	continue;
+      while ( j<b->pids && j<SATIP_PMT_CACHE_PIDS && b->pid[j] < a->pid[i] )
+	j++;
+      if ( j==b->pids || j==SATIP_PMT_CACHE_PIDS || b->pid[j] != a->pid[i] )
+	return 0;
+    }
+  return 1;
+}
+
+/*
+ * entry for key: a just opened part of the same service on the
+ * transponder, else a new one or the least recently used
+ */
+static t_pmt_entry* new_entry(const t_pmt_entry* key)
+{
+  t_pmt_entry* e;
+  int i;
+
+  for ( i=0; i<entry_count; i++ )
+    {
+      e=&entries[i];
+      if ( e->pmt < 0 && same_transponder(e, key) &&
+	   e->used + GROW_SECONDS >= key->used && subset(e, key) )
+	return e;
+    }
+
+  if ( entry_count < SATIP_PMT_CACHE_ENTRIES )
+    return &entries[entry_count++];
+
+  for ( e=&entries[0], i=1; i<entry_count; i++ )
+    if ( entries[i].used < e->used )
+      e=&entries[i];
+  return e;
+}
+
+static void cache_save(void)
+{
+  char tmp[256];
+  FILE* f=NULL;
+  int i,j,fd;
+
+  if ( snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cache_path) >= (int)sizeof(tmp) )
+    return;
+
+  /* new file of its own, mode 0600 */
+  fd=mkstemp(tmp);
+  if ( fd>=0 && (f=fdopen(fd,"w"))==NULL )
+    {
+      close(fd);
+      unlink(tmp);
+    }
+  if ( f==NULL )
+    {
+      ERROR(MSG_MAIN,"cannot write %s\n",tmp);
+      return;
+    }
+
+  fprintf(f, "# delsys freq pol src pmt used pids hash pid,..\n");
+  for ( i=0; i<entry_count; i++ )
+    {
+      t_pmt_entry* e=&entries[i];
+
+      fprintf(f, "%u %u %d %d %d %ld %d %08x ",
+	      e->delsys, e->frequency, e->polarization, e->position,
+	      e->pmt, (long)e->used, e->pids, e->pids_hash);
+      for ( j=0; j<e->pids && j<SATIP_PMT_CACHE_PIDS; j++ )
+	fprintf(f, "%s%u", j ? "," : "", e->pid[j]);
+      fprintf(f, "%s\n", e->pids ? "" : "-");
+    }
+
+  fclose(f);
+
+  /* readers never see a partial file */
+  if ( rename(tmp, cache_path) < 0 )
+    unlink(tmp);
+  cache_dirty = 0;
+}
+
+/* recently used services of the last run for the prediction */
+static void cache_exit(void)
+{
+  if ( cache_dirty )
+    cache_save();
+}
+
+static void timeout_save(void* param)
+{
+  UNUSED(param);
+
+  /* timer expired, clear it */
+  save_timer = NULL;
+
+  if ( cache_dirty )
+    cache_save();
+}
+
+/* zaps in a row end up in one write, not on the zap itself */
+static void schedule_save(void)
+{
+  cache_dirty = 1;
+
+  if ( save_timer == NULL && save_queue != NULL )
+    save_timer = polltimer_start(save_queue, timeout_save, SAVE_DELAY, NULL);
+}
+
+int satip_pmtcache_load(const char* path, struct polltimer_queue* queue)
+{
+  char line[512];
+  FILE* f=NULL;
+  struct stat st;
+  int fd;
+
+  if ( path == NULL || path[0] == 0 )
+    return 0;
+
+  if ( cache_path == NULL )
+    atexit(cache_exit);
+  cache_path = strdup(path);
+  save_queue = queue;
+  entry_count = 0;
+
+  /* trusted only as written by us, never through a link */
+  fd=open(path,O_RDONLY|O_NOFOLLOW);
+  if ( fd<0 )
+    return 0;
+  if ( fstat(fd,&st)<0 || !S_ISREG(st.st_mode) || st.st_uid!=geteuid() ||
+       (f=fdopen(fd,"r"))==NULL )
+    {
+      WARN(MSG_MAIN,"%s not written by us, ignored\n",path);
+      close(fd);
+      return 0;
+    }
+
+  while ( entry_count<SATIP_PMT_CACHE_ENTRIES && fgets(line,sizeof(line),f)!=NULL )
+    {
+      t_pmt_entry* e=&entries[entry_count];
+      char* pids;
+      long used;
+      int n,i;
+
+      if ( line[0]=='#' )
+	continue;
+
+      if ( sscanf(line, "%u %u %d %d %d %ld %d %x %n",
+		  &e->delsys, &e->frequency, &e->polarization, &e->position,
+		  &e->pmt, &used, &e->pids, &e->pids_hash, &n) != 8 ||
+	   e->pmt >= 8192 || e->pids < 0 )
+	continue;
+
+      pids = line+n;
+      for ( i=0; i<e->pids && i<SATIP_PMT_CACHE_PIDS; i++ )
+	{
+	  e->pid[i] = strtoul(pids, &pids, 10) & 0x1fff;
+	  if ( *pids == ',' )
+	    pids++;
+	}
+      e->used = used;
+      entry_count++;
+    }
+
+  fclose(f);
+
+  DEBUG(MSG_MAIN,"%d service(s) cached in %s\n",entry_count,path);
+
+  return entry_count;
+}
+
+void satip_pmtcache_learn(t_satip_config* cfg, const uint64_t* pids, unsigned short pmt)
+{
+  t_pmt_entry key;
+  t_pmt_entry* e=NULL;
+  int i;
+
+  if ( cache_path == NULL || !satip_valid_config(cfg) )
+    return;
+
+  set_transponder(&key, cfg);
+  set_service(&key, pids, pmt);
+  key.pmt = pmt;
+  key.used = time(NULL);
+
+  /* one entry per PMT of a transponder */
+  for ( i=0; i<entry_count; i++ )
+    if ( entries[i].pmt == pmt && same_transponder(&entries[i], &key) )
+      {
+	e=&entries[i];
+	break;
+      }
+
+  if ( e!=NULL && ( e->pids_hash == key.pids_hash || key.pids == 0 ) )
+    {
+      /* known, no pids yet tell nothing new either */
+      e->used = key.used;
+      cache_dirty = 1;
+      return;
+    }
+
+  if ( e==NULL )
+    e=new_entry(&key);
+
+  *e = key;
+  DEBUG(MSG_MAIN,"cached PMT pid %d for %d pids at %u\n",pmt,key.pids,key.frequency);
+  schedule_save();
+}
+
+int satip_pmtcache_service(t_satip_config* cfg, const uint64_t* pids)
+{
+  t_pmt_entry key;
+  t_pmt_entry* e;
+  int i,match=-1;
+
+  if ( cache_path == NULL || !satip_valid_config(cfg) )
+    return -1;
+
+  set_transponder(&key, cfg);
+  set_service(&key, pids, -1);
+  key.pmt = -1;
+  key.used = time(NULL);
+
+  for ( i=0; i<entry_count; i++ )
+    {
+      e=&entries[i];
+
+      if ( !same_transponder(e, &key) )
+	continue;
+
+      /* same pids as the service, or its PMT requested itself */
+      if ( key.pids > 0 && e->pids == key.pids && e->pids_hash == key.pids_hash )
+	{
+	  match = i;
+	  break;
+	}
+      if ( match < 0 && e->pmt >= 0 && pid_requested(pids, e->pmt) )
+	match = i;
+    }
+
+  if ( match >= 0 )
+    {
+      e=&entries[match];
+      e->used = key.used;
+      cache_dirty = 1;
+      return e->pmt;
+    }
+
+  /* not scrambled, or the driver has not found its PMT yet */
+  if ( key.pids > 0 )
+    {
+      *new_entry(&key) = key;
+      cache_dirty = 1;
+    }
+  return -1;
+}
+
+int satip_pmtcache_predict(t_satip_config* cfg, unsigned short* pids, int* pmt)
+{
+  t_pmt_entry key;
+  t_pmt_entry* best=NULL;
+  int i;
+
+  *pmt = -1;
+  if ( cache_path == NULL || !satip_valid_config(cfg) )
+    return 0;
+
+  set_transponder(&key, cfg);
+  for ( i=0; i<entry_count; i++ )
+    if ( same_transponder(&entries[i], &key) &&
+	 ( best == NULL || entries[i].used > best->used ) )
+      best=&entries[i];
+
+  if ( best == NULL )
+    return 0;
+
+  for ( i=0; i<best->pids && i<SATIP_PMT_CACHE_PIDS; i++ )
+    pids[i] = best->pid[i];
+  *pmt = best->pmt;
+  return i;
+}
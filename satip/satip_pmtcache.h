@@ -0,0 +1,67 @@
+/*
+ * satip: persistent cache of PMT pids for x_pmt
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_PMTCACHE_H
+#define _SATIP_PMTCACHE_H
+
+#include "satip_config.h"
+
+struct polltimer_queue;
+
+#define SATIP_PMT_CACHE SATIP_CACHE_DIR "/pmt"
+
+/* services kept, least recently used ones are dropped */
+#define SATIP_PMT_CACHE_ENTRIES 256
+
+/* pids kept per service for the prediction */
+#define SATIP_PMT_CACHE_PIDS    32
+
+/*
+ * The vtuner driver reports the PMT pid of a scrambled service only
+ * after it has parsed the PAT, one PLAY later than needed. A service is
+ * known here by its transponder and the pids requested for it, there is
+ * no service id in the pid list. Services without PMT are kept as well,
+ * the last one of a transponder predicts the pids of the next tuning.
+ * Shared by all tuners, main thread only.
+ */
+
+/*
+ * reads path and keeps it updated by timers of queue, and at exit,
+ * NULL or "" = no cache
+ */
+int  satip_pmtcache_load(const char* path, struct polltimer_queue* queue);
+
+/*
+ * pids is the bitmap of the pids requested by the application,
+ * SATIPCFG_PID_WORDS words, cfg the transponder they are on
+ */
+
+/* PMT pid reported by the driver for the requested pids */
+void satip_pmtcache_learn(t_satip_config* cfg, const uint64_t* pids, unsigned short pmt);
+
+/* service of the requested pids, remembered, returns its PMT pid or -1 if unknown */
+int  satip_pmtcache_service(t_satip_config* cfg, const uint64_t* pids);
+
+/*
+ * pids (up to SATIP_PMT_CACHE_PIDS) and PMT pid (or -1) of the service
+ * last used on the transponder of cfg, returns the number of pids
+ */
+int  satip_pmtcache_predict(t_satip_config* cfg, unsigned short* pids, int* pmt);
+
+#endif
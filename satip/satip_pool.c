@@ -0,0 +1,190 @@
+/*
+ * satip: pool of SAT>IP servers with least-loaded selection
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "satip_pool.h"
+#include "log.h"
+
+/* msec before a server is selected again */
+#define RETRY_BUSY      2000
+#define RETRY_FAILED    5000   /* doubled per failure in a row */
+#define RETRY_FAILED_MAX 60000
+
+
+t_satip_pool* satip_pool_new(const char* hosts, const char* port)
+{
+  t_satip_pool* pool;
+  const char* p=hosts;
+
+  pool=(t_satip_pool*)malloc(sizeof(t_satip_pool));
+  memset(pool, 0, sizeof(t_satip_pool));
+  pool->current = -1;
+
+  while ( *p && pool->count < SATIP_POOL_MAX )
+    {
+      t_satip_pool_server* server=&pool->server[pool->count];
+      int len=strcspn(p,",");
+      int hostlen=strcspn(p,":,");
+
+      if ( hostlen>0 && hostlen<(int)sizeof(server->host) )
+	{
+	  memcpy(server->host, p, hostlen);
+	  server->host[hostlen]=0;
+
+	  if ( p[hostlen]==':' && len-hostlen-1 < (int)sizeof(server->port) )
+	    {
+	      memcpy(server->port, p+hostlen+1, len-hostlen-1);
+	      server->port[len-hostlen-1]=0;
+	    }
+	  else
+	    snprintf(server->port, sizeof(server->port), "%s", port);
+
+	  DEBUG(MSG_NET,"pool: server %s:%s\n",server->host,server->port);
+	  pool->count++;
+	}
+
+      p+=len;
+      if ( *p==',' )
+	p++;
+    }
+
+  return pool;
+}
+
+static int waiting(t_satip_pool_server* server, struct timespec* now)
+{
+  return ( server->retry.tv_sec > now->tv_sec ||
+	   ( server->retry.tv_sec == now->tv_sec &&
+	     server->retry.tv_nsec > now->tv_nsec ) );
+}
+
+/* share of tuners in use in 0.1%, busy answers count as used tuners */
+static int load(t_satip_pool_server* server)
+{
+  return ( server->used + server->busy ) * 1000 /
+    ( server->tuners > 0 ? server->tuners : 1 );
+}
+
+t_satip_pool_server* satip_pool_select(t_satip_pool* pool)
+{
+  struct timespec now;
+  int i,idx;
+  int best=-1;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+
+  /* equally loaded servers take turns */
+  for ( i=0; i<pool->count; i++ )
+    {
+      idx = (pool->current+1+i) % pool->count;
+
+      if ( waiting(&pool->server[idx], &now) )
+	continue;
+
+      if ( best<0 || load(&pool->server[idx]) < load(&pool->server[best]) )
+	best=idx;
+    }
+
+  /* all wait for a retry, take the one that waits shortest */
+  if ( best<0 )
+    for ( idx=0; idx<pool->count; idx++ )
+      if ( best<0 || waiting(&pool->server[best], &pool->server[idx].retry) )
+	best=idx;
+
+  pool->current = best;
+
+  DEBUG(MSG_NET,"pool: selected %s:%s, load %d.%d%%\n",
+	pool->server[best].host, pool->server[best].port,
+	load(&pool->server[best])/10, load(&pool->server[best])%10);
+
+  return &pool->server[best];
+}
+
+int satip_pool_available(t_satip_pool* pool)
+{
+  struct timespec now;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+
+  for ( i=0; i<pool->count; i++ )
+    if ( !waiting(&pool->server[i], &now) )
+      return 1;
+
+  return 0;
+}
+
+static void retry_after(t_satip_pool_server* server, int msec)
+{
+  clock_gettime(CLOCK_MONOTONIC,&server->retry);
+
+  server->retry.tv_sec += msec/1000;
+  server->retry.tv_nsec += (msec%1000)*1000000;
+  if ( server->retry.tv_nsec >= 1000000000 )
+    {
+      server->retry.tv_sec++;
+      server->retry.tv_nsec -= 1000000000;
+    }
+}
+
+void satip_pool_probed(t_satip_pool_server* server, int tuners, int used)
+{
+  server->tuners = tuners;
+  server->used = used;
+}
+
+void satip_pool_success(t_satip_pool_server* server)
+{
+  server->used++;
+  server->busy = 0;
+  server->failures = 0;
+}
+
+void satip_pool_release(t_satip_pool_server* server)
+{
+  if ( server->used > 0 )
+    server->used--;
+}
+
+void satip_pool_busy(t_satip_pool_server* server)
+{
+  server->busy++;
+  retry_after(server, RETRY_BUSY);
+
+  INFO(MSG_NET,"pool: %s:%s has no free tuner\n",server->host,server->port);
+}
+
+void satip_pool_failed(t_satip_pool_server* server)
+{
+  int msec=RETRY_FAILED;
+  int i;
+
+  for ( i=0; i<server->failures && msec<RETRY_FAILED_MAX; i++ )
+    msec*=2;
+  if ( msec>RETRY_FAILED_MAX )
+    msec=RETRY_FAILED_MAX;
+
+  server->failures++;
+  retry_after(server, msec);
+
+  INFO(MSG_NET,"pool: %s:%s failed, retry in %d ms\n",server->host,server->port,msec);
+}
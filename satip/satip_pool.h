@@ -0,0 +1,65 @@
+/*
+ * satip: pool of SAT>IP servers with least-loaded selection
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_POOL_H
+#define _SATIP_POOL_H
+
+#include <time.h>
+
+#define SATIP_POOL_MAX 16
+
+typedef struct satip_pool_server
+{
+  char host[64];
+  char port[8];
+  int tuners;             /* for the tuning's system as probed, 0 = unknown */
+  int used;               /* frontends in use as probed, and by our sessions since */
+  int busy;               /* busy answers since last successful SETUP */
+  int failures;           /* connection failures in a row */
+  struct timespec retry;  /* not selected before unless all others wait too */
+} t_satip_pool_server;
+
+typedef struct satip_pool
+{
+  int count;
+  int current;
+  t_satip_pool_server server[SATIP_POOL_MAX];
+} t_satip_pool;
+
+/* "host1,host2:port,..." with port defaulting to port */
+t_satip_pool* satip_pool_new(const char* hosts, const char* port);
+
+/* server for the next connection, becomes current */
+t_satip_pool_server* satip_pool_select(t_satip_pool* pool);
+
+/* any server that is not waiting for a retry */
+int satip_pool_available(t_satip_pool* pool);
+
+/*
+ * outcomes on a selected server, one pool serves all tuners: a session
+ * holds a frontend from its first successful SETUP until it is released
+ * by TEARDOWN or when it moves elsewhere
+ */
+void satip_pool_probed(t_satip_pool_server* server, int tuners, int used);
+void satip_pool_success(t_satip_pool_server* server);
+void satip_pool_release(t_satip_pool_server* server);
+void satip_pool_busy(t_satip_pool_server* server);
+void satip_pool_failed(t_satip_pool_server* server);
+
+#endif
@@ -17,8 +17,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -29,58 +31,441 @@
 #include <arpa/inet.h>
 #include <poll.h>
 #include <sched.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <linux/sock_diag.h>
 
 #include "satip_rtp.h"
+#include "satip_trace.h"
 #include "log.h"
 
 #include "vtuner.h"
 
+/* minimum time between signal updates, lock changes are sent at once */
+#define SIGNAL_INTERVAL_MS 1000
+
+/* rough CNR estimate per quality step (0-15) in 0.001 dB */
+#define CNR_PER_QUALITY 1000
+
+/* receive buffer of a stream or worker thread */
+#define RTP_RXBUF 32768
+
+/* events taken per epoll_wait of a worker */
+#define RTP_WORKER_EVENTS 16
+
+/* shared socket mode: threads, datagrams per recvmmsg and their size */
+#define RTP_SHARED_MAX 8
+#define RTP_BATCH 16
+#define RTP_PACKET_MAX 2048
+
+/* sequence number checks, RFC 3550 A.1 */
+#define RTP_MAX_DROPOUT  3000
+#define RTP_MAX_MISORDER 100
+
+/* MPEG-TS timestamp clock */
+#define RTP_CLOCK 90000
+
+/* counters have a single writer, readers get whole values */
+#define COUNT(field, n) __atomic_store_n(&(field), (field)+(n), __ATOMIC_RELAXED)
+
+#define RTCP_SR   200
+#define RTCP_RR   201
+#define RTCP_SDES 202
+#define RTCP_SDES_CNAME 1
+
+/* tuner status of SAT>IP RTCP APP packet */
+typedef struct rtcp_tuner
+{
+  int fe;
+  int level;     /* 0-255 */
+  int lock;
+  int quality;   /* 0-15 */
+  int frequency; /* MHz, fraction dropped */
+} t_rtcp_tuner;
+
 static void set_signal(int fd, int level, int quality)
 {
 	struct vtuner_signal sig;
 	memset(&sig,0,sizeof(struct vtuner_signal));
-	sig.strength.len = 2;
 	// level 0-255
 	sig.strength.len = 2;
 	if (level>0) {
 	   sig.strength.stat[0].scale = VT_SCALE_DECIBEL; // in 0.001 dB steps
-	   sig.strength.stat[0].u.svalue = 1000.0 * (40.0 * (level - 32)/ 192.0 - 65.0);
+	   sig.strength.stat[0].u.svalue = (level - 32) * 625 / 3 - 65000;
 	}
 
 	sig.strength.stat[1].scale = VT_SCALE_RELATIVE; // 0-100% as 0-65535
 	sig.strength.stat[1].u.uvalue = level * 257;
 
-	sig.cnr.len = 1;
 	// quality 15-0
+	sig.cnr.len = 2;
+	sig.cnr.stat[0].scale = VT_SCALE_DECIBEL; // estimate, in 0.001 dB steps
+	sig.cnr.stat[0].u.svalue = quality * CNR_PER_QUALITY;
 
-	// missing conversion from 15 to 0 into decibel values...
-	sig.cnr.stat[0].scale = VT_SCALE_RELATIVE; // 0-100% as 0-65535
-	sig.cnr.stat[0].u.uvalue = quality * 65535 / 15; 
+	sig.cnr.stat[1].scale = VT_SCALE_RELATIVE; // 0-100% as 0-65535
+	sig.cnr.stat[1].u.uvalue = quality * 65535 / 15;
 
 	ioctl(fd, VTUNER_SET_SIGNAL, &sig);
 }
 
-static void rtp_data(int fd, t_satip_rtp_last *last, unsigned char* buffer, int rx)
+static void set_status(int fd, unsigned char tune_id, int lock, int level)
+{
+	struct vtuner_status st;
+
+	st.tune_id = tune_id;
+	if (lock)
+	   st.status = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI | FE_HAS_SYNC | FE_HAS_LOCK;
+	else
+	   st.status = level>0 ? FE_HAS_SIGNAL : 0;
+
+	ioctl(fd, VTUNER_SET_STATUS, &st);
+}
+
+/*
+ * parse "tuner=feID,level,lock,quality,frequency,..." from
+ * "ver=1.0;src=1;tuner=...;pids=..." in place
+ */
+static int parse_tuner(const char* info, int len, t_rtcp_tuner* tuner)
+{
+  const char* end=info+len;
+  const char* p=info;
+  int* field[5];
+  int nr;
+
+  while ( end-p<6 || memcmp(p,"tuner=",6) )
+    {
+      p = memchr(p,';',end-p);
+      if ( p==NULL )
+	return 0;
+      p++;
+    }
+  p+=6;
+
+  field[0]=&tuner->fe;
+  field[1]=&tuner->level;
+  field[2]=&tuner->lock;
+  field[3]=&tuner->quality;
+  field[4]=&tuner->frequency;
+
+  for ( nr=0; nr<5 && p<end && *p!=';'; nr++ )
+    {
+      int value=0;
+
+      while ( p<end && *p>='0' && *p<='9' )
+	value = value*10 + *p++ - '0';
+      *field[nr]=value;
+
+      /* skip fraction, end of field */
+      while ( p<end && *p!=',' && *p!=';' )
+	p++;
+      if ( p<end && *p==',' )
+	p++;
+    }
+
+  return ( nr==5 );
+}
+
+/* first occurrence of points since the tuning was answered */
+static void trace_points(t_satip_rtp* srtp, unsigned int points, int arg)
+{
+  unsigned int hit;
+  int point;
+
+  hit = __atomic_fetch_and(&srtp->trace_pending, ~points, __ATOMIC_RELAXED) & points;
+  for ( point=0; hit; point++, hit>>=1 )
+    if ( hit & 1 )
+      satip_trace(srtp->fd, point, arg);
+}
+
+static void update_signal(t_satip_rtp* srtp, t_rtcp_tuner* tuner)
+{
+  t_satip_rtp_last* last=&srtp->last;
+  struct timespec now;
+  long elapsed;
+  int lock_changed;
+  int i;
+
+  /* server still reports previous tuning */
+  if ( srtp->frequency && abs(tuner->frequency - (int)srtp->frequency) > 2 )
+    return;
+
+  if ( last->tune_id != srtp->tune_id )
+    {
+      last->tune_id = srtp->tune_id;
+      last->lock = -1;
+    }
+
+  if ( tuner->lock &&
+       ( __atomic_load_n(&srtp->trace_pending, __ATOMIC_RELAXED) & SATIP_TRACE_BIT(SATIP_TRACE_LOCK) ) )
+    trace_points(srtp, SATIP_TRACE_BIT(SATIP_TRACE_LOCK), tuner->level);
+
+  lock_changed = ( tuner->lock != last->lock );
+  if ( lock_changed )
+    {
+      DEBUG(MSG_NET,"RTCP: fe %d lock=%d\n",tuner->fe,tuner->lock);
+      if ( !srtp->sinks_only )
+	set_status(srtp->fd, srtp->tune_id, tuner->lock, tuner->level);
+      pthread_mutex_lock(&srtp->sink_lock);
+      for ( i=0; i<srtp->nsinks; i++ )
+	set_status(srtp->sink[i].fd, srtp->sink[i].tune_id, tuner->lock, tuner->level);
+      pthread_mutex_unlock(&srtp->sink_lock);
+      last->lock = tuner->lock;
+    }
+
+  if ( tuner->level == last->signallevel && tuner->quality == last->quality )
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  elapsed = (now.tv_sec - last->update.tv_sec)*1000 +
+    (now.tv_nsec - last->update.tv_nsec)/1000000;
+
+  if ( !lock_changed && elapsed < SIGNAL_INTERVAL_MS )
+    return;
+
+  last->signallevel = tuner->level;
+  last->quality = tuner->quality;
+  last->update = now;
+
+  DEBUG(MSG_NET,"RTCP: update signallevel=%i quality=%i\n",last->signallevel,last->quality);
+  if ( !srtp->sinks_only )
+    set_signal(srtp->fd, last->signallevel, last->quality);
+  pthread_mutex_lock(&srtp->sink_lock);
+  for ( i=0; i<srtp->nsinks; i++ )
+    set_signal(srtp->sink[i].fd, last->signallevel, last->quality);
+  pthread_mutex_unlock(&srtp->sink_lock);
+}
+
+static void init_seq(t_satip_rtp_stats* st, uint16_t seq)
+{
+  st->base_seq = seq;
+  st->max_seq = seq;
+  st->cycles = 0;
+  st->received = 0;
+  st->expected_prior = 0;
+  st->received_prior = 0;
+}
+
+static void rtp_stats(t_satip_rtp* srtp, unsigned char* hdr, struct timespec* now)
+{
+  t_satip_rtp_stats* st=&srtp->stats;
+  uint16_t seq = hdr[2]<<8 | hdr[3];
+  uint32_t timestamp = ntohl(*(uint32_t*)&hdr[4]);
+  uint32_t ssrc = ntohl(*(uint32_t*)&hdr[8]);
+  uint16_t udelta = seq - st->max_seq;
+  uint32_t arrival, transit;
+  int32_t d;
+
+  if ( st->received == 0 || ssrc != st->ssrc )
+    {
+      /* new session, server RTCP address has to be learned again */
+      if ( ssrc != st->ssrc )
+	srtp->peer_rtcp = 0;
+
+      st->ssrc = ssrc;
+      st->jitter = 0;
+      init_seq(st, seq);
+    }
+  else if ( udelta < RTP_MAX_DROPOUT )
+    {
+      if ( udelta > 1 )
+	COUNT(srtp->counters.seq_lost, udelta-1);
+      if ( seq < st->max_seq )
+	st->cycles += 65536;
+      st->max_seq = seq;
+    }
+  else if ( udelta <= 65536 - RTP_MAX_MISORDER )
+    {
+      DEBUG(MSG_DATA,"RTP: sequence jump %d -> %d\n",st->max_seq,seq);
+      COUNT(srtp->counters.seq_resets, 1);
+      init_seq(st, seq);
+    }
+  /* else duplicate or reordered */
+
+  st->received++;
+
+  arrival = (uint32_t)now->tv_sec*RTP_CLOCK +
+    (uint32_t)((uint64_t)now->tv_nsec*RTP_CLOCK/1000000000);
+  transit = arrival - timestamp;
+
+  if ( st->received > 1 )
+    {
+      d = transit - st->transit;
+      if ( d < 0 )
+	d = -d;
+      st->jitter += d - ((st->jitter + 8) >> 4);
+    }
+  st->transit = transit;
+}
+
+static unsigned char* put32(unsigned char* p, uint32_t val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+  return p+4;
+}
+
+/* compound RR + SDES CNAME */
+static void send_report(t_satip_rtp* srtp, struct timespec* now)
+{
+  t_satip_rtp_stats* st=&srtp->stats;
+  unsigned char pkt[32+8+2+sizeof(srtp->cname)+4];
+  unsigned char* p=pkt;
+  unsigned char* sdes;
+  uint32_t extended_max, expected, expected_interval, received_interval;
+  int32_t lost, lost_interval;
+  uint32_t fraction=0;
+  uint32_t dlsr=0;
+  int cname_len=strlen(srtp->cname);
+  int len;
+
+  extended_max = st->cycles + st->max_seq;
+  expected = extended_max - st->base_seq + 1;
+  lost = expected - st->received;
+  if ( lost > 0x7fffff )
+    lost = 0x7fffff;
+  else if ( lost < -0x800000 )
+    lost = -0x800000;
+
+  expected_interval = expected - st->expected_prior;
+  st->expected_prior = expected;
+  received_interval = st->received - st->received_prior;
+  st->received_prior = st->received;
+  lost_interval = expected_interval - received_interval;
+  if ( expected_interval != 0 && lost_interval > 0 )
+    fraction = ( (uint32_t)lost_interval << 8 ) / expected_interval;
+
+  /* delay since last SR in 1/65536 s */
+  if ( st->lsr )
+    dlsr = ( now->tv_sec - st->lsr_time.tv_sec ) * 65536 +
+      ( ( (int64_t)( now->tv_nsec - st->lsr_time.tv_nsec ) << 16 ) / 1000000000 );
+
+  /* nothing received yet: empty RR, still refreshes the session */
+  if ( st->received == 0 )
+    {
+      p = put32(p, 0x80000000 | RTCP_RR<<16 | 1);
+      p = put32(p, srtp->ssrc);
+    }
+  else
+    {
+      p = put32(p, 0x81000000 | RTCP_RR<<16 | 7);
+      p = put32(p, srtp->ssrc);
+      p = put32(p, st->ssrc);
+      p = put32(p, fraction<<24 | ( lost & 0xffffff ));
+      p = put32(p, extended_max);
+      p = put32(p, st->jitter >> 4);
+      p = put32(p, st->lsr);
+      p = put32(p, dlsr);
+    }
+
+  /* chunk terminated by at least one null octet, padded to 32 bits */
+  sdes = p;
+  len = ( 4 + 4 + 2 + cname_len + 1 + 3 ) & ~3;
+  memset(sdes, 0, len);
+  p = put32(p, 0x81000000 | RTCP_SDES<<16 | ( len/4 - 1 ));
+  p = put32(p, srtp->ssrc);
+  *p++ = RTCP_SDES_CNAME;
+  *p++ = cname_len;
+  memcpy(p, srtp->cname, cname_len);
+
+  len += sdes - pkt;
+  if ( srtp->peer.sin_port == 0 )
+    DEBUG(MSG_DATA,"RTCP: server address unknown, no report\n");
+  else if ( sendto(srtp->rtcp_socket, pkt, len, 0,
+	      (struct sockaddr*) &srtp->peer, sizeof(srtp->peer)) < 0 )
+    DEBUG(MSG_NET,"RTCP: sending report failed\n");
+  else
+    {
+      srtp->report_sent = now->tv_sec;
+      DEBUG(MSG_DATA,"RTCP: RR to %s:%d ext_max %u lost %d fraction %u jitter %u\n",
+	    inet_ntoa(srtp->peer.sin_addr), ntohs(srtp->peer.sin_port),
+	    extended_max, lost, fraction, st->jitter >> 4);
+    }
+}
+
+/* randomized by +/- 50% against synchronized senders */
+static void next_report(t_satip_rtp* srtp, struct timespec* now, struct timespec* next)
+{
+  long msec = srtp->report_interval/2 + random() % ( srtp->report_interval + 1 );
+
+  next->tv_sec = now->tv_sec + msec/1000;
+  next->tv_nsec = now->tv_nsec + (msec%1000)*1000000;
+  if ( next->tv_nsec >= 1000000000 )
+    {
+      next->tv_sec++;
+      next->tv_nsec -= 1000000000;
+    }
+}
+
+/* pass the packets of their PIDs on to the adapters fed as sinks */
+static void write_sinks(t_satip_rtp* srtp, unsigned char* buf, int len)
+{
+  t_satip_rtp_sink* sink;
+  int i,j,pid;
+
+  pthread_mutex_lock(&srtp->sink_lock);
+
+  for ( j=0; j<srtp->nsinks; j++ )
+    {
+      sink=&srtp->sink[j];
+
+      for ( i=0; i<len; i+=188 )
+	{
+	  pid = ( buf[i+1] & 0x1f ) << 8 | buf[i+2];
+	  if ( !( sink->pidmap[pid>>3] & ( 1 << (pid&7) ) ) )
+	    continue;
+
+	  buf[i] = 0x47 | (sink->tune_id << 3);
+	  if ( write(sink->fd,&buf[i],188) != 188 )
+	    DEBUG(MSG_DATA,"RTP: sink %d write failed\n",sink->id);
+	}
+    }
+
+  pthread_mutex_unlock(&srtp->sink_lock);
+}
+
+static void write_sinks_filler(t_satip_rtp* srtp, char* filler)
+{
+  int j;
+
+  pthread_mutex_lock(&srtp->sink_lock);
+  for ( j=0; j<srtp->nsinks; j++ )
+    if ( write(srtp->sink[j].fd,filler,188) != 188 )
+      DEBUG(MSG_DATA,"RTP: sink %d write failed\n",srtp->sink[j].id);
+  pthread_mutex_unlock(&srtp->sink_lock);
+}
+
+static void rtp_data(t_satip_rtp* srtp, unsigned char* buffer, int rx)
 {
   int done=0;
   uint32_t* buf=(uint32_t*) buffer;
   uint32_t val;
   int plen;
   int pt;
-  char infobuf[200];
-
-  int update_status=0;
+  t_rtcp_tuner tuner;
 
-  while(done<rx)
+  while(done+4<=rx)
     {
       val= ntohl(*buf);
       pt= ( val  & 0x00ff0000 ) >>16 ;
       plen= val & 0x0000ffff;
 
+      if ( done+(plen+1)*4 > rx )
+	break;
+
       switch(pt)
 	{
+	case RTCP_SR:
+	  if (plen>=6)
+	    {
+	      srtp->stats.lsr = ntohl(buf[2])<<16 | ntohl(buf[3])>>16;
+	      clock_gettime(CLOCK_MONOTONIC,&srtp->stats.lsr_time);
+	    }
+	  break;
+
 	case 204:
-	  if (plen>1)
+	  if (plen>2)
 	    {
 	      val=buf[2];
 	      DEBUG(MSG_DATA,"RTCP: app defined (204) name: %c%c%c%c\n",
@@ -89,32 +474,12 @@ static void rtp_data(int fd, t_satip_rtp_last *last, unsigned char* buffer, int
 		    val>>16 & 0x000000ff,
 		    val>>24 & 0x000000ff);
 
-	      val=htonl(buf[3]);
-	      if ( val <200 )
+	      val=ntohl(buf[3]);
+	      if ( val <= (uint32_t)(plen-3)*4 )
 		{
-		  snprintf(infobuf,val,"%s",(char*) &buf[4]);
-		  infobuf[val]=0;
-		  DEBUG(MSG_DATA,"RTCP: app info: %s\n",infobuf);
-		  char *token;
-		  char *rest = infobuf;
-		  int nr=0;
-		  while ((token = strtok_r(rest, ",", &rest)))
-		  {
-			if (nr==1) {
-				// Signal level (0-255)
-				int act_signallevel=atoi(token);
-				if (act_signallevel!=last->signallevel) update_status=1;
-				last->signallevel=act_signallevel;
-			}
-			if (nr==3) {
-				// Quality (0-15)
-				int act_quality=atoi(token);
-				if (act_quality!=last->quality) update_status=1;
-				last->quality=act_quality;
-			}
-			if (nr>5) break;
-			nr++;
-		  }
+		  DEBUG(MSG_DATA,"RTCP: app info: %.*s\n",val,(char*) &buf[4]);
+		  if ( parse_tuner((char*) &buf[4],val,&tuner) )
+		    update_signal(srtp,&tuner);
 		}
 	    }
 
@@ -124,32 +489,198 @@ static void rtp_data(int fd, t_satip_rtp_last *last, unsigned char* buffer, int
 	  DEBUG(MSG_DATA,"RTCP: packet type %d len %d\n",pt,plen);
 	}
 
-      if (update_status) {
-	      DEBUG(MSG_NET,"RTCP: update signallevel=%i quality=%i\n",last->signallevel,last->quality);
-	      set_signal(fd, last->signallevel, last->quality);
-	      update_status=0;
-      }
-
       buf+=plen+1;
       done+=(plen+1)*4;
     }
 }
 
+static void init_filler(char* filler)
+{
+  memset(filler,0xff,188);
+  filler[0]=0x47;
+  filler[1]=0x1F;
+  filler[2]=0xFF;
+  filler[3]=0x20; // only adaption, no payload
+  filler[4]=0xB7; // adaption field length
+  filler[5]=0x00; // adaption fields (none)
+}
+
+static t_satip_sched* rtp_sched = NULL;
+static int rtp_nsched = 0;
+static int rtp_threads = 0;
+
+/* placement of the n-th RTP thread, the last one given repeats */
+static const t_satip_sched* thread_sched(int index)
+{
+  if ( rtp_nsched == 0 )
+    return NULL;
+  return &rtp_sched[index < rtp_nsched ? index : rtp_nsched-1];
+}
+
+void satip_rtp_set_sched(const t_satip_sched* sched, int count)
+{
+  rtp_sched = (t_satip_sched*)malloc(count*sizeof(t_satip_sched));
+  memcpy(rtp_sched, sched, count*sizeof(t_satip_sched));
+  rtp_nsched = count;
+}
+
+/* first TS data after a tuning was answered */
+static void zap_done(t_satip_rtp* srtp, struct timespec* now)
+{
+  static const int bounds[SATIP_RTP_ZAP_BUCKETS] = SATIP_RTP_ZAP_BOUNDS;
+  t_satip_rtp_counters* c=&srtp->counters;
+  uint64_t start = __atomic_exchange_n(&srtp->zap_start, 0, __ATOMIC_ACQ_REL);
+  uint64_t usec;
+  int i,k;
+
+  if ( start == 0 )
+    return;
+  k = srtp->zap_prefetch;
+
+  usec = (uint64_t)now->tv_sec*1000000 + now->tv_nsec/1000 - start;
+  for ( i=0; i<SATIP_RTP_ZAP_BUCKETS-1 && usec > (uint64_t)bounds[i]*1000; i++ )
+    ;
+
+  COUNT(c->zap_bucket[k][i], 1);
+  COUNT(c->zap_usec[k], usec);
+  COUNT(c->zaps[k], 1);
+  DEBUG(MSG_DATA,"RTP: zap took %lu ms\n",(unsigned long)(usec/1000));
+}
+
+static void rtp_packet(t_satip_rtp* srtp, unsigned char* rxbuf, int rx,
+		       struct sockaddr_in* from, char* filler, struct timespec* now)
+{
+  int wr=0;
+
+  if ( rx>0 )
+    {
+      COUNT(srtp->counters.datagrams, 1);
+      COUNT(srtp->counters.bytes, rx);
+      if ( __atomic_load_n(&srtp->trace_pending, __ATOMIC_RELAXED) )
+	trace_points(srtp, SATIP_TRACE_BIT(SATIP_TRACE_FIRST_RTP) |
+		     ( rx>12 && rxbuf[12] == 0x47 ? SATIP_TRACE_BIT(SATIP_TRACE_FIRST_TS) : 0 ), rx);
+    }
+
+  if ( rx>=12 && ( rxbuf[0] & 0xc0 ) == 0x80 )
+    {
+      rtp_stats(srtp, rxbuf, now);
+
+      /* until the server sends RTCP, assume it uses RTP port + 1 */
+      if ( !srtp->peer_rtcp )
+	{
+	  srtp->peer = *from;
+	  srtp->peer.sin_port = htons(ntohs(from->sin_port)+1);
+	}
+    }
+
+  if ( rx>12 && rxbuf[12] == 0x47 )
+    {
+	int len = rx-12;
+	int tailsize = len % 188;
+	len -= tailsize;
+	unsigned char *buf=&rxbuf[12];
+	if ( __atomic_load_n(&srtp->zap_start, __ATOMIC_RELAXED) )
+	  zap_done(srtp, now);
+	if ( !srtp->sinks_only )
+	  for (int i=0; i < len; i+= 188) {
+	     if (srtp->tune_id) {
+	        buf[i]=0x47 | (srtp->tune_id << 3);
+	     }
+	     wr = write(srtp->fd,&buf[i],188);
+	  }
+	if ( srtp->nsinks > 0 )
+	  write_sinks(srtp, buf, len);
+	DEBUG(MSG_DATA,"RTP: rd %d  wr %d\n",rx,wr);
+    }
+    else
+    {
+	// send filler packet
+	COUNT(srtp->counters.fillers, 1);
+	if ( !srtp->sinks_only )
+	  wr = write(srtp->fd,filler,188);
+	if ( srtp->nsinks > 0 )
+	  write_sinks_filler(srtp, filler);
+	DEBUG(MSG_DATA,"RTP: send filler %d\n",rx);
+    }
+}
+
+static void rtp_receive(t_satip_rtp* srtp, unsigned char* rxbuf, int size,
+			char* filler, struct timespec* now)
+{
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  int rx;
+
+  fromlen = sizeof(from);
+  rx = recvfrom(srtp->rtp_socket, rxbuf, size, 0,
+		(struct sockaddr*) &from, &fromlen);
+  DEBUG(MSG_DATA,"RTP: rd %d\n",rx);
+
+  rtp_packet(srtp, rxbuf, rx, &from, filler, now);
+}
+
+static void rtcp_packet(t_satip_rtp* srtp, unsigned char* rxbuf, int rx,
+			struct sockaddr_in* from)
+{
+  if ( rx>0 )
+    {
+      srtp->peer = *from;
+      srtp->peer_rtcp = 1;
+      COUNT(srtp->counters.rtcp, 1);
+    }
+  rtp_data(srtp, rxbuf,rx);
+  DEBUG(MSG_DATA,"RTCP: rd %d\n",rx);
+}
+
+static void rtcp_receive(t_satip_rtp* srtp, unsigned char* rxbuf, int size)
+{
+  struct sockaddr_in from;
+  socklen_t fromlen;
+  int rx;
+
+  fromlen = sizeof(from);
+  rx=recvfrom(srtp->rtcp_socket, rxbuf, size, 0,
+	      (struct sockaddr*) &from, &fromlen);
+  rtcp_packet(srtp, rxbuf, rx, &from);
+}
+
+/* send receiver report if due, returns msec until the next one, -1 = none */
+static int rtp_report(t_satip_rtp* srtp, struct timespec* now)
+{
+  int timeout;
+
+  if ( srtp->report_interval <= 0 )
+    return -1;
+
+  if ( now->tv_sec > srtp->report_due.tv_sec ||
+       ( now->tv_sec == srtp->report_due.tv_sec && now->tv_nsec >= srtp->report_due.tv_nsec ) )
+    {
+      /* also without RTP, the reports keep the session alive */
+      send_report(srtp, now);
+      next_report(srtp, now, &srtp->report_due);
+    }
+
+  timeout = (srtp->report_due.tv_sec - now->tv_sec)*1000 +
+    (srtp->report_due.tv_nsec - now->tv_nsec)/1000000;
+
+  return timeout < 0 ? 0 : timeout;
+}
+
+/* thread of its own for one stream */
 static void* rtp_receiver(void* param)
 {
-  unsigned char rxbuf[32768];
+  const t_satip_sched* sched;
+  t_satip_sched_stats* stats;
+  unsigned char* rxbuf;
   struct pollfd pollfds[2];
-  struct sched_param schedp;
   char filler[188];
   t_satip_rtp* srtp=(t_satip_rtp*)param;
+  struct timespec now;
+  int timeout;
 
-  schedp.sched_priority = sched_get_priority_min(SCHED_FIFO)+1;
-
-  if ( sched_setscheduler(0, SCHED_FIFO, &schedp) )
-    DEBUG(MSG_MAIN,"RTP: No realtime scheduling\n");
-  else
-    DEBUG(MSG_MAIN,"RTP: Realtime scheduling enabled at prio %d\n",schedp.sched_priority);
-
+  sched = thread_sched(srtp->sched_index);
+  stats = satip_sched_apply(sched, "RTP", 1);
+  rxbuf = (unsigned char*)satip_sched_alloc(sched, RTP_RXBUF);
 
   pollfds[0].fd = srtp->rtp_socket;
   pollfds[0].events = POLLIN;
@@ -159,71 +690,399 @@ static void* rtp_receiver(void* param)
   pollfds[1].events = POLLIN;
   pollfds[1].revents = 0;
 
-  memset(&filler,0xff,sizeof(filler));
-  filler[0]=0x47;
-  filler[1]=0x1F;
-  filler[2]=0xFF;
-  filler[3]=0x20; // only adaption, no payload
-  filler[4]=0xB7; // adaption field length
-  filler[5]=0x00; // adaption fields (none)
+  init_filler(filler);
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  srtp->report_due = now;
 
   while(1)
     {
-      poll(pollfds,2,-1);
+      timeout = rtp_report(srtp, &now);
+
+      poll(pollfds,2,timeout);
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      satip_sched_wakeup(stats);
 
       if ( pollfds[0].revents & POLLIN )
 	{
-	  int rx,wr;
 	  pollfds[0].revents = 0;
-
-	  rx = recv(pollfds[0].fd, rxbuf, 32768,0);
-	  DEBUG(MSG_DATA,"RTP: rd %d   wr %d\n",rx,wr);
-	  if ( rx>12 && rxbuf[12] == 0x47 )
-	    {
-		int len = rx-12;
-		int tailsize = len % 188;
-		len -= tailsize;
-		unsigned char *buf=&rxbuf[12];
-		for (int i=0; i < len; i+= 188) {
-                   if (srtp->tune_id) {
-		      buf[i]=0x47 | (srtp->tune_id << 3);
-		   }
-		   wr = write(srtp->fd,&buf[i],188);
-		}
-		DEBUG(MSG_DATA,"RTP: rd %d  wr %d\n",rx,wr);
-	    }
-	    else
-	    {
-	        // send filler packet
-                wr = write(srtp->fd,&filler,sizeof(filler));
-	        DEBUG(MSG_DATA,"RTP: send filler %d\n",rx);
-	    }
+	  rtp_receive(srtp, rxbuf, RTP_RXBUF, filler, &now);
 	}
 
       if ( pollfds[1].revents & POLLIN )
 	{
-	  int rx;
 	  pollfds[1].revents = 0;
+	  rtcp_receive(srtp, rxbuf, RTP_RXBUF);
+	}
+    }
+  return NULL;
+}
+
+/* one of a fixed number of threads, serving the streams assigned to it */
+static void* rtp_worker(void* param)
+{
+  t_satip_rtp_worker* worker=(t_satip_rtp_worker*)param;
+  const t_satip_sched* sched;
+  t_satip_sched_stats* stats;
+  unsigned char* rxbuf;
+  struct epoll_event events[RTP_WORKER_EVENTS];
+  char filler[188];
+  t_satip_rtp* srtp;
+  struct timespec now;
+  int timeout,next;
+  int i,n;
+
+  sched = thread_sched(worker->sched_index);
+  stats = satip_sched_apply(sched, "RTP worker", 1);
+  rxbuf = (unsigned char*)satip_sched_alloc(sched, RTP_RXBUF);
+
+  init_filler(filler);
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
 
-	  rx=recv(pollfds[1].fd, rxbuf, 32768,0);
-	  rtp_data(srtp->fd, &srtp->last, rxbuf,rx);
-	  DEBUG(MSG_DATA,"RTCP: rd %d\n",rx);
+  while(1)
+    {
+      /* earliest receiver report of all streams */
+      timeout = -1;
+      pthread_mutex_lock(&worker->lock);
+      for ( srtp=worker->first; srtp!=NULL; srtp=srtp->next )
+	{
+	  next = rtp_report(srtp, &now);
+	  if ( next >= 0 && ( timeout < 0 || next < timeout ) )
+	    timeout = next;
 	}
+      pthread_mutex_unlock(&worker->lock);
+
+      n = epoll_wait(worker->epfd, events, RTP_WORKER_EVENTS, timeout);
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      satip_sched_wakeup(stats);
 
+      for ( i=0; i<n; i++ )
+	{
+	  t_satip_rtp_event* ev=(t_satip_rtp_event*)events[i].data.ptr;
+
+	  if ( ev->rtcp )
+	    rtcp_receive(ev->srtp, rxbuf, RTP_RXBUF);
+	  else
+	    rtp_receive(ev->srtp, rxbuf, RTP_RXBUF, filler, &now);
+	}
     }
   return NULL;
 }
 
+static t_satip_rtp_worker* workers = NULL;
+static int worker_count = 0;
+static int worker_next = 0;
 
+/* streams created from now on are served by count threads instead of one each */
+int satip_rtp_start_workers(int count)
+{
+  int i;
 
-t_satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port)
+  if ( count <= 0 || workers != NULL )
+    return 0;
+
+  workers=(t_satip_rtp_worker*)malloc(count*sizeof(t_satip_rtp_worker));
+
+  for ( i=0; i<count; i++ )
+    {
+      workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+      if ( workers[i].epfd < 0 )
+	{
+	  ERROR(MSG_MAIN,"RTP: epoll_create1: %s\n",strerror(errno));
+	  return -1;
+	}
+      workers[i].first = NULL;
+      workers[i].sched_index = rtp_threads++;
+      pthread_mutex_init(&workers[i].lock, NULL);
+      pthread_create( &workers[i].thread, NULL, rtp_worker, &workers[i]);
+    }
+
+  worker_count = count;
+  INFO(MSG_MAIN,"RTP: %d worker threads\n",count);
+  return 0;
+}
+
+static int attach_worker(t_satip_rtp* srtp)
+{
+  t_satip_rtp_worker* worker=&workers[worker_next++ % worker_count];
+  struct epoll_event ev;
+
+  srtp->ev_rtp.srtp = srtp;
+  srtp->ev_rtp.rtcp = 0;
+  srtp->ev_rtcp.srtp = srtp;
+  srtp->ev_rtcp.rtcp = 1;
+  clock_gettime(CLOCK_MONOTONIC,&srtp->report_due);
+
+  pthread_mutex_lock(&worker->lock);
+  srtp->next = worker->first;
+  worker->first = srtp;
+  pthread_mutex_unlock(&worker->lock);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = &srtp->ev_rtp;
+  if ( epoll_ctl(worker->epfd, EPOLL_CTL_ADD, srtp->rtp_socket, &ev) )
+    return -1;
+
+  ev.data.ptr = &srtp->ev_rtcp;
+  if ( epoll_ctl(worker->epfd, EPOLL_CTL_ADD, srtp->rtcp_socket, &ev) )
+    return -1;
+
+  return 0;
+}
+
+
+
+/*
+ * shared mode: all streams on one port pair, RTP socket in a
+ * SO_REUSEPORT group with one socket per thread
+ */
+typedef struct rtp_shared
+{
+  int port;
+  int nsockets;
+  int rtp_socket[RTP_SHARED_MAX];
+  int rtcp_socket;
+  pthread_t thread[RTP_SHARED_MAX];
+  int sched_index;        /* placement of the first thread */
+  pthread_mutex_t lock;   /* stream list and demultiplexing state */
+  t_satip_rtp* first;
+} t_rtp_shared;
+
+static t_rtp_shared shared = { .nsockets = 0, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * stream of a datagram: by SSRC announced in SETUP, else by source
+ * address from the server_port of SETUP or learned before, else the
+ * only stream of that server that has neither; streams not in a session
+ * take nothing
+ */
+static t_satip_rtp* demux(unsigned char* buf, int len, struct sockaddr_in* from, int rtcp)
+{
+  t_satip_rtp* srtp;
+  t_satip_rtp* candidate=NULL;
+  int candidates=0;
+  uint32_t ssrc;
+  uint16_t port;
+
+  /* RTP: SSRC of the source, RTCP: SSRC of the sender of the first packet */
+  if ( len < ( rtcp ? 8 : 12 ) )
+    return NULL;
+  ssrc = ntohl(*(uint32_t*)&buf[rtcp ? 4 : 8]);
+  port = ntohs(from->sin_port) - ( rtcp ? 1 : 0 );
+
+  pthread_mutex_lock(&shared.lock);
+
+  for ( srtp=shared.first; srtp!=NULL; srtp=srtp->next )
+    {
+      if ( srtp->expect_ssrc != 0 )
+	{
+	  if ( srtp->expect_ssrc == ssrc )
+	    break;
+	  continue;
+	}
+
+      if ( srtp->source.sin_port != 0 )
+	{
+	  if ( srtp->source.sin_addr.s_addr == from->sin_addr.s_addr &&
+	       ntohs(srtp->source.sin_port) == port )
+	    break;
+	  continue;
+	}
+
+      if ( !rtcp && srtp->server.sin_family == AF_INET &&
+	   srtp->server.sin_addr.s_addr == from->sin_addr.s_addr )
+	{
+	  candidate = srtp;
+	  candidates++;
+	}
+    }
+
+  if ( srtp == NULL && candidates == 1 )
+    {
+      srtp = candidate;
+      srtp->source = *from;
+      DEBUG(MSG_NET,"RTP: stream port %d from %s:%d\n",srtp->rtp_port,
+	    inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    }
+
+  pthread_mutex_unlock(&shared.lock);
+
+  if ( srtp == NULL )
+    DEBUG(MSG_DATA,"RTP: no stream for ssrc %08x from %s:%d\n",ssrc,
+	  inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+
+  return srtp;
+}
+
+static int shared_reports(struct timespec* now)
 {
   t_satip_rtp* srtp;
+  int timeout=-1;
+  int next;
+
+  pthread_mutex_lock(&shared.lock);
+  for ( srtp=shared.first; srtp!=NULL; srtp=srtp->next )
+    {
+      pthread_mutex_lock(&srtp->lock);
+      next = rtp_report(srtp, now);
+      pthread_mutex_unlock(&srtp->lock);
+
+      if ( next >= 0 && ( timeout < 0 || next < timeout ) )
+	timeout = next;
+    }
+  pthread_mutex_unlock(&shared.lock);
+
+  return timeout;
+}
+
+/* thread per socket of the group, the first one also does RTCP */
+static void* rtp_shared_receiver(void* param)
+{
+  int index=(int)(intptr_t)param;
+  const t_satip_sched* sched;
+  t_satip_sched_stats* stats;
+  unsigned char (*rxbuf)[RTP_PACKET_MAX];
+  struct mmsghdr msgs[RTP_BATCH];
+  struct iovec iov[RTP_BATCH];
+  struct sockaddr_in from[RTP_BATCH];
+  struct pollfd pollfds[2];
+  char filler[188];
+  t_satip_rtp* srtp;
+  struct timespec now;
+  int nfds = index==0 ? 2 : 1;
+  int timeout;
+  int i,j,n;
+
+  sched = thread_sched(shared.sched_index + index);
+  stats = satip_sched_apply(sched, "RTP shared", 1);
+  rxbuf = satip_sched_alloc(sched, RTP_BATCH*RTP_PACKET_MAX);
+
+  init_filler(filler);
+
+  memset(msgs, 0, sizeof(msgs));
+  for ( i=0; i<RTP_BATCH; i++ )
+    {
+      iov[i].iov_base = rxbuf[i];
+      iov[i].iov_len = RTP_PACKET_MAX;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &from[i];
+    }
+
+  pollfds[0].fd = shared.rtp_socket[index];
+  pollfds[0].events = POLLIN;
+  pollfds[1].fd = shared.rtcp_socket;
+  pollfds[1].events = POLLIN;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+
+  while(1)
+    {
+      timeout = index==0 ? shared_reports(&now) : -1;
+
+      pollfds[0].revents = 0;
+      pollfds[1].revents = 0;
+      poll(pollfds,nfds,timeout);
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      satip_sched_wakeup(stats);
+
+      for ( j=0; j<nfds; j++ )
+	{
+	  if ( !( pollfds[j].revents & POLLIN ) )
+	    continue;
+
+	  /* drain the socket, a batch per call */
+	  do
+	    {
+	      for ( i=0; i<RTP_BATCH; i++ )
+		msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+
+	      n = recvmmsg(pollfds[j].fd, msgs, RTP_BATCH, MSG_DONTWAIT, NULL);
+
+	      for ( i=0; i<n; i++ )
+		{
+		  if ( ( srtp = demux(rxbuf[i], msgs[i].msg_len, &from[i], j) ) == NULL )
+		    continue;
+
+		  /* RTP and RTCP of a stream may come in on different threads */
+		  pthread_mutex_lock(&srtp->lock);
+		  if ( j == 0 )
+		    rtp_packet(srtp, rxbuf[i], msgs[i].msg_len, &from[i], filler, &now);
+		  else
+		    rtcp_packet(srtp, rxbuf[i], msgs[i].msg_len, &from[i]);
+		  pthread_mutex_unlock(&srtp->lock);
+		}
+	    }
+	  while ( n == RTP_BATCH );
+	}
+    }
+  return NULL;
+}
+
+static int bind_port(int sock, int port, int reuseport)
+{
+  struct sockaddr_in inaddr;
+  int one=1;
+
+  if ( reuseport &&
+       setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 )
+    return -1;
+
+  memset(&inaddr, 0, sizeof(inaddr));
+  inaddr.sin_family = AF_INET;
+  inaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  inaddr.sin_port = htons(port);
+
+  return bind(sock, (struct sockaddr *) &inaddr, sizeof(inaddr));
+}
+
+/* streams created from now on share port and port+1, served by count threads */
+int satip_rtp_share_socket(int port, int count)
+{
+  int i;
+
+  if ( count < 1 )
+    count = 1;
+  if ( count > RTP_SHARED_MAX )
+    count = RTP_SHARED_MAX;
+
+  for ( i=0; i<count; i++ )
+    {
+      shared.rtp_socket[i] = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+      if ( bind_port(shared.rtp_socket[i], port, count > 1) < 0 )
+	{
+	  ERROR(MSG_NET,"RTP: cannot bind shared port %d: %s\n",port,strerror(errno));
+	  return -1;
+	}
+    }
+
+  shared.rtcp_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if ( bind_port(shared.rtcp_socket, port+1, 0) < 0 )
+    {
+      ERROR(MSG_NET,"RTP: cannot bind shared port %d: %s\n",port+1,strerror(errno));
+      return -1;
+    }
+
+  shared.port = port;
+  shared.nsockets = count;
+  shared.sched_index = rtp_threads;
+  rtp_threads += count;
+
+  for ( i=0; i<count; i++ )
+    pthread_create( &shared.thread[i], NULL, rtp_shared_receiver, (void*)(intptr_t)i);
+
+  INFO(MSG_NET,"rtp/rtcp port %d/%d shared, %d thread%s\n",port,port+1,count,count>1?"s":"");
+  return 0;
+}
+
+/* port pair of a stream of its own, returns the RTP port or -1 */
+static int open_port_pair(int fixed_rtp_port, int* rtp_sockp, int* rtcp_sockp)
+{
   int rtp_sock, rtcp_sock;
   int rtp_port, rtcp_port;
-  struct timespec ts;
   int PORT_RANGE = 2000;
-  int PORT_BASE = 45000;
+  int PORT_BASE = SATIP_RTP_PORT_BASE;
   int attempts;
 
   if (fixed_rtp_port!=-1) {
@@ -231,13 +1090,10 @@ t_satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port)
      PORT_RANGE = 2;
   }
 
-  attempts = PORT_RANGE/2;
-
-  clock_gettime(CLOCK_REALTIME,&ts);
+  /* a fixed port is tried once, it is not ours if bound already */
+  attempts = PORT_RANGE == 2 ? 1 : PORT_RANGE/2;
 
-  srandom(ts.tv_nsec);
-
-  while ( --attempts > 0 || PORT_RANGE == 2)
+  while ( attempts-- > 0 )
     {
       struct sockaddr_in inaddr;
 
@@ -288,11 +1144,146 @@ t_satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port)
 	}
 
       INFO(MSG_NET,"rtp/rtcp port %d/%d\n",rtp_port,rtcp_port);
-      break;
+      *rtp_sockp = rtp_sock;
+      *rtcp_sockp = rtcp_sock;
+      return rtp_port;
+    }
+
+  ERROR(MSG_NET,"no free rtp/rtcp port pair%s\n", PORT_RANGE == 2 ? " at fixed port" : "");
+  return -1;
+}
+
+/* another stream of server without SSRC, or its SETUP not yet answered */
+static int ambiguous(t_satip_rtp* srtp, const struct sockaddr_in* server)
+{
+  t_satip_rtp* other;
+
+  for ( other=shared.first; other!=NULL; other=other->next )
+    if ( other != srtp &&
+	 other->server.sin_family == AF_INET &&
+	 other->server.sin_addr.s_addr == server->sin_addr.s_addr &&
+	 other->expect_ssrc == 0 )
+      return 1;
+
+  return 0;
+}
+
+static void unlink_shared(t_satip_rtp* srtp)
+{
+  t_satip_rtp** p;
+
+  for ( p=&shared.first; *p!=NULL; p=&(*p)->next )
+    if ( *p == srtp )
+      {
+	*p = srtp->next;
+	break;
+      }
+  srtp->next = NULL;
+}
+
+/*
+ * expected sender of the stream as agreed in SETUP, ssrc 0 and port 0 =
+ * not announced, server NULL = session ended
+ */
+void satip_rtp_set_source(t_satip_rtp* srtp, const struct sockaddr* server,
+			  int server_port, uint32_t ssrc)
+{
+  pthread_mutex_lock(&shared.lock);
+
+  memset(&srtp->server, 0, sizeof(srtp->server));
+  if ( server != NULL && server->sa_family == AF_INET )
+    memcpy(&srtp->server, server, sizeof(srtp->server));
+  srtp->expect_ssrc = ssrc;
+  memset(&srtp->source, 0, sizeof(srtp->source));
+  if ( server_port > 0 && srtp->server.sin_family == AF_INET )
+    {
+      srtp->source = srtp->server;
+      srtp->source.sin_port = htons(server_port);
     }
 
-  if (attempts <= 0 && PORT_RANGE > 2)
+  pthread_mutex_unlock(&shared.lock);
+
+  if ( ssrc != 0 )
+    DEBUG(MSG_NET,"RTP: expecting ssrc %08x\n",ssrc);
+  else if ( server_port > 0 )
+    DEBUG(MSG_NET,"RTP: expecting server port %d\n",server_port);
+}
+
+/*
+ * before SETUP to server: a stream on the shared port pair that the
+ * server may not tell apart from another one of its streams on it
+ * without SSRC moves to a port pair of its own
+ */
+int satip_rtp_prepare_setup(t_satip_rtp* srtp, const struct sockaddr* server)
+{
+  int rtp_sock, rtcp_sock;
+  int rtp_port;
+  int own;
+
+  if ( !srtp->shared_port || server == NULL || server->sa_family != AF_INET )
+    return 0;
+
+  pthread_mutex_lock(&shared.lock);
+  own = ambiguous(srtp, (const struct sockaddr_in*)server);
+  if ( !own )
+    {
+      /* pending SETUPs count as unannounced until answered */
+      memcpy(&srtp->server, server, sizeof(srtp->server));
+      srtp->expect_ssrc = 0;
+      memset(&srtp->source, 0, sizeof(srtp->source));
+    }
+  pthread_mutex_unlock(&shared.lock);
+
+  if ( !own )
+    return 0;
+
+  if ( ( rtp_port = open_port_pair(-1, &rtp_sock, &rtcp_sock) ) < 0 )
+    return -1;
+
+  INFO(MSG_NET,"RTP: another stream of %s without SSRC, moved to port %d\n",
+       inet_ntoa(((const struct sockaddr_in*)server)->sin_addr), rtp_port);
+
+  pthread_mutex_lock(&shared.lock);
+  unlink_shared(srtp);
+  pthread_mutex_unlock(&shared.lock);
+
+  /* a shared thread may still be at its last datagram */
+  pthread_mutex_lock(&srtp->lock);
+  srtp->shared_port = 0;
+  srtp->rtp_port    = rtp_port;
+  srtp->rtp_socket  = rtp_sock;
+  srtp->rtcp_port   = rtp_port+1;
+  srtp->rtcp_socket = rtcp_sock;
+  srtp->peer_rtcp = 0;
+  memset(&srtp->peer, 0, sizeof(srtp->peer));
+  pthread_mutex_unlock(&srtp->lock);
+
+  srtp->sched_index = rtp_threads++;
+  pthread_create( &srtp->thread, NULL, rtp_receiver, srtp);
+  return 0;
+}
+
+t_satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port)
+{
+  t_satip_rtp* srtp;
+  int rtp_sock, rtcp_sock;
+  int rtp_port, rtcp_port;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME,&ts);
+
+  srandom(ts.tv_nsec);
+
+  if ( shared.nsockets > 0 )
+    {
+      /* no port pair of its own */
+      rtp_port = shared.port;
+      rtp_sock = shared.rtp_socket[0];
+      rtcp_sock = shared.rtcp_socket;
+    }
+  else if ( ( rtp_port = open_port_pair(fixed_rtp_port, &rtp_sock, &rtcp_sock) ) < 0 )
     return NULL;
+  rtcp_port = rtp_port+1;
 
   srtp=(t_satip_rtp*)malloc(sizeof(t_satip_rtp));
 
@@ -301,12 +1292,215 @@ t_satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port)
   srtp->rtp_socket  = rtp_sock;
   srtp->rtcp_port   = rtcp_port;
   srtp->rtcp_socket = rtcp_sock;
+  srtp->shared_port = ( shared.nsockets > 0 );
+
+  srtp->tune_id = 0;
+  srtp->frequency = 0;
 
   srtp->last.signallevel = 0;
   srtp->last.quality = 0;
+  srtp->last.lock = -1;
+  srtp->last.tune_id = 0;
+  srtp->last.update.tv_sec = 0;
+  srtp->last.update.tv_nsec = 0;
 
-  pthread_create( &srtp->thread, NULL, rtp_receiver, srtp);
+  srtp->report_interval = 0;
+  srtp->ssrc = random();
+  strcpy(srtp->cname, "satip@");
+  if ( gethostname(srtp->cname+6, sizeof(srtp->cname)-6) )
+    strcpy(srtp->cname+6, "localhost");
+  srtp->cname[sizeof(srtp->cname)-1] = 0;
+  srtp->peer_rtcp = 0;
+  memset(&srtp->peer, 0, sizeof(srtp->peer));
+  srtp->report_sent = 0;
+  memset(&srtp->stats, 0, sizeof(srtp->stats));
+  memset(&srtp->counters, 0, sizeof(srtp->counters));
+  srtp->zap_start = 0;
+  srtp->zap_prefetch = SATIPCFG_PREFETCH_NONE;
+  srtp->trace_pending = 0;
+
+  pthread_mutex_init(&srtp->sink_lock, NULL);
+  srtp->nsinks = 0;
+  srtp->sinks_only = 0;
+
+  pthread_mutex_init(&srtp->lock, NULL);
+  srtp->expect_ssrc = 0;
+  memset(&srtp->server, 0, sizeof(srtp->server));
+  memset(&srtp->source, 0, sizeof(srtp->source));
+
+  if ( shared.nsockets > 0 )
+    {
+      pthread_mutex_lock(&shared.lock);
+      srtp->next = shared.first;
+      shared.first = srtp;
+      clock_gettime(CLOCK_MONOTONIC,&srtp->report_due);
+      pthread_mutex_unlock(&shared.lock);
+    }
+  else if ( worker_count > 0 )
+    {
+      if ( attach_worker(srtp) )
+	{
+	  ERROR(MSG_NET,"RTP: cannot add stream to worker: %s\n",strerror(errno));
+	  return NULL;
+	}
+    }
+  else
+    {
+      srtp->sched_index = rtp_threads++;
+      pthread_create( &srtp->thread, NULL, rtp_receiver, srtp);
+    }
 
   return srtp;
 }
 
+void satip_rtp_set_report_interval(t_satip_rtp* srtp, int msec)
+{
+  srtp->report_interval = msec > 0 ? msec : 0;
+}
+
+int satip_rtp_report_age(t_satip_rtp* srtp)
+{
+  struct timespec now;
+  time_t sent = srtp->report_sent;
+
+  if ( srtp->report_interval <= 0 || sent == 0 )
+    return -1;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return now.tv_sec - sent;
+}
+
+/* add or update adapter id, fed with the packets of PIDs set in pidmap */
+int satip_rtp_set_sink(t_satip_rtp* srtp, int id, int fd, unsigned char tune_id,
+		       const unsigned char* pidmap)
+{
+  t_satip_rtp_sink* sink;
+  int i;
+
+  pthread_mutex_lock(&srtp->sink_lock);
+
+  for ( i=0; i<srtp->nsinks && srtp->sink[i].id != id; i++ )
+    ;
+
+  if ( i == SATIP_RTP_MAX_SINKS )
+    {
+      pthread_mutex_unlock(&srtp->sink_lock);
+      return -1;
+    }
+
+  sink=&srtp->sink[i];
+  if ( i == srtp->nsinks || sink->tune_id != tune_id )
+    /* new tuning of the adapter, needs lock status */
+    srtp->last.lock = -1;
+
+  sink->id = id;
+  sink->fd = fd;
+  sink->tune_id = tune_id;
+  memcpy(sink->pidmap, pidmap, SATIP_RTP_PIDMAP_SIZE);
+
+  if ( i == srtp->nsinks )
+    srtp->nsinks++;
+
+  pthread_mutex_unlock(&srtp->sink_lock);
+  return 0;
+}
+
+void satip_rtp_del_sink(t_satip_rtp* srtp, int id)
+{
+  int i;
+
+  pthread_mutex_lock(&srtp->sink_lock);
+
+  for ( i=0; i<srtp->nsinks; i++ )
+    if ( srtp->sink[i].id == id )
+      {
+	srtp->nsinks--;
+	memmove(&srtp->sink[i], &srtp->sink[i+1],
+		(srtp->nsinks-i)*sizeof(t_satip_rtp_sink));
+	break;
+      }
+
+  pthread_mutex_unlock(&srtp->sink_lock);
+}
+
+/* adapters of the stream, its own one included, all get their own PIDs only */
+void satip_rtp_sinks_only(t_satip_rtp* srtp)
+{
+  pthread_mutex_lock(&srtp->sink_lock);
+  srtp->sinks_only = 1;
+  pthread_mutex_unlock(&srtp->sink_lock);
+}
+
+/*
+ * tuning requested at the given time was answered, next TS data ends the
+ * zap, counted by the pids prefetched with it
+ */
+void satip_rtp_zap(t_satip_rtp* srtp, const struct timespec* requested, int prefetch)
+{
+  srtp->zap_prefetch = ( prefetch >= 0 && prefetch < SATIPCFG_PREFETCH_KINDS ) ?
+    prefetch : SATIPCFG_PREFETCH_NONE;
+  __atomic_store_n(&srtp->trace_pending,
+		   SATIP_TRACE_BIT(SATIP_TRACE_FIRST_RTP) | SATIP_TRACE_BIT(SATIP_TRACE_FIRST_TS) |
+		   SATIP_TRACE_BIT(SATIP_TRACE_LOCK), __ATOMIC_RELAXED);
+  __atomic_store_n(&srtp->zap_start,
+		   (uint64_t)requested->tv_sec*1000000 + requested->tv_nsec/1000,
+		   __ATOMIC_RELEASE);
+}
+
+void satip_rtp_get_counters(t_satip_rtp* srtp, t_satip_rtp_counters* counters)
+{
+  t_satip_rtp_counters* c=&srtp->counters;
+  int i,k;
+
+  counters->datagrams  = __atomic_load_n(&c->datagrams, __ATOMIC_RELAXED);
+  counters->bytes      = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+  counters->seq_lost   = __atomic_load_n(&c->seq_lost, __ATOMIC_RELAXED);
+  counters->seq_resets = __atomic_load_n(&c->seq_resets, __ATOMIC_RELAXED);
+  counters->fillers    = __atomic_load_n(&c->fillers, __ATOMIC_RELAXED);
+  counters->rtcp       = __atomic_load_n(&c->rtcp, __ATOMIC_RELAXED);
+  for ( k=0; k<SATIPCFG_PREFETCH_KINDS; k++ )
+    {
+      counters->zaps[k]     = __atomic_load_n(&c->zaps[k], __ATOMIC_RELAXED);
+      counters->zap_usec[k] = __atomic_load_n(&c->zap_usec[k], __ATOMIC_RELAXED);
+      for ( i=0; i<SATIP_RTP_ZAP_BUCKETS; i++ )
+	counters->zap_bucket[k][i] = __atomic_load_n(&c->zap_bucket[k][i], __ATOMIC_RELAXED);
+    }
+
+  counters->signallevel = __atomic_load_n(&srtp->last.signallevel, __ATOMIC_RELAXED);
+  counters->quality     = __atomic_load_n(&srtp->last.quality, __ATOMIC_RELAXED);
+  counters->lock        = __atomic_load_n(&srtp->last.lock, __ATOMIC_RELAXED);
+}
+
+/* datagrams the kernel dropped on the RTP socket, -1 = unknown */
+static long socket_drops(int sock)
+{
+#ifdef SO_MEMINFO
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+
+  if ( getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 &&
+       len > SK_MEMINFO_DROPS*sizeof(uint32_t) )
+    return meminfo[SK_MEMINFO_DROPS];
+#else
+  (void)sock;
+#endif
+  return -1;
+}
+
+/* -1 on the shared port pair, its drops belong to no single stream */
+long satip_rtp_socket_drops(t_satip_rtp* srtp)
+{
+  if ( srtp->shared_port )
+    return -1;
+
+  return socket_drops(srtp->rtp_socket);
+}
+
+/* drops of socket index of the shared port pair, -1 = no such socket */
+long satip_rtp_shared_socket_drops(int index)
+{
+  if ( index < 0 || index >= shared.nsockets )
+    return -1;
+
+  return socket_drops(shared.rtp_socket[index]);
+}
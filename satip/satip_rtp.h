@@ -20,13 +20,83 @@
 #ifndef _SATIP_RTP_H
 #define _SATIP_RTP_H
 
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "satip_config.h"
+#include "satip_sched.h"
+
+#define SATIP_RTP_PORT_BASE 45000
+#define SATIP_RTP_MAX_SINKS SATIP_MAX_TUNERS
+#define SATIP_RTP_PIDMAP_SIZE (8192/8)
 
 typedef struct satip_rtp_last
 {
   int signallevel;
   int quality;
+  int lock;
+  unsigned char tune_id;
+  struct timespec update;  /* last VTUNER_SET_SIGNAL */
 } t_satip_rtp_last;
 
+/* reception statistics for RTCP receiver reports, RFC 3550 A.1 */
+typedef struct satip_rtp_stats
+{
+  uint32_t ssrc;            /* media source */
+  uint16_t max_seq;
+  uint32_t cycles;          /* shifted count of seq number wraps */
+  uint32_t base_seq;
+  uint32_t received;
+  uint32_t expected_prior;  /* at last report */
+  uint32_t received_prior;
+  uint32_t transit;
+  uint32_t jitter;          /* 90 kHz units, scaled by 16 */
+  uint32_t lsr;             /* middle 32 bits of last SR NTP timestamp */
+  struct timespec lsr_time;
+} t_satip_rtp_stats;
+
+/* zap latency histogram, upper bounds in ms */
+#define SATIP_RTP_ZAP_BUCKETS 8
+#define SATIP_RTP_ZAP_BOUNDS { 100, 250, 500, 1000, 2000, 5000, 10000, 0 }
+
+/* for metrics, written by the receiving thread only, read without lock */
+typedef struct satip_rtp_counters
+{
+  uint64_t datagrams;
+  uint64_t bytes;
+  uint64_t seq_lost;        /* missing sequence numbers */
+  uint64_t seq_resets;      /* jumps beyond dropout, statistics start over */
+  uint64_t fillers;         /* datagrams without TS, replaced by a filler */
+  uint64_t rtcp;
+  /* zaps by SATIPCFG_PREFETCH_* of the tuning */
+  uint64_t zaps[SATIPCFG_PREFETCH_KINDS];
+  uint64_t zap_usec[SATIPCFG_PREFETCH_KINDS];  /* sum of zap latencies */
+  uint64_t zap_bucket[SATIPCFG_PREFETCH_KINDS][SATIP_RTP_ZAP_BUCKETS];  /* not cumulative, last = above all bounds */
+  int signallevel;          /* as of last RTCP */
+  int quality;
+  int lock;
+} t_satip_rtp_counters;
+
+/* adapter fed from this stream with its own PIDs, e.g. on the same transponder */
+typedef struct satip_rtp_sink
+{
+  int id;
+  int fd;
+  unsigned char tune_id;
+  unsigned char pidmap[SATIP_RTP_PIDMAP_SIZE];  /* bit per PID passed on */
+} t_satip_rtp_sink;
+
+struct satip_rtp;
+
+/* epoll data of a worker, which socket of which stream */
+typedef struct satip_rtp_event
+{
+  struct satip_rtp* srtp;
+  int rtcp;
+} t_satip_rtp_event;
+
 typedef struct satip_rtp
 {
   int fd;
@@ -34,12 +104,65 @@ typedef struct satip_rtp
   int rtp_socket;
   int rtcp_port;
   int rtcp_socket;
+  int shared_port;         /* on the port pair of all streams, see satip_rtp_share_socket() */
   unsigned char tune_id;
+  unsigned int frequency;  /* MHz of current tuning, 0 = unknown */
   t_satip_rtp_last last;
-  pthread_t thread;
+  int report_interval;     /* msec, 0 = no receiver reports */
+  uint32_t ssrc;           /* our own */
+  char cname[64];
+  struct sockaddr_in peer; /* server RTCP address */
+  int peer_rtcp;           /* learned from RTCP, else guessed from RTP */
+  volatile time_t report_sent;  /* monotonic sec of the last RR, 0 = none */
+  t_satip_rtp_stats stats;
+  pthread_mutex_t sink_lock;
+  int sinks_only;          /* own adapter is a sink as well, or not on this stream */
+  int nsinks;
+  t_satip_rtp_sink sink[SATIP_RTP_MAX_SINKS];
+  struct timespec report_due;
+  pthread_t thread;        /* own thread, unless served by a worker */
+  int sched_index;         /* placement of the own thread */
+  t_satip_rtp_event ev_rtp;
+  t_satip_rtp_event ev_rtcp;
+  struct satip_rtp* next;  /* streams of the same worker or the shared socket */
+  pthread_mutex_t lock;    /* shared socket: RTP and RTCP threads differ */
+  uint32_t expect_ssrc;    /* announced in SETUP, 0 = unknown */
+  struct sockaddr_in server;  /* RTSP server of the session, family 0 = none */
+  struct sockaddr_in source;  /* RTP sender from SETUP or learned, port 0 = none yet */
+  t_satip_rtp_counters counters;
+  uint64_t zap_start;      /* usec, tuning answered, ends on first TS data */
+  int zap_prefetch;        /* SATIPCFG_PREFETCH_* of that tuning */
+  unsigned int trace_pending;  /* trace points still to record for this zap */
 } t_satip_rtp;
 
+typedef struct satip_rtp_worker
+{
+  int epfd;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  t_satip_rtp* first;
+  int sched_index;
+} t_satip_rtp_worker;
+
+void satip_rtp_set_sched(const t_satip_sched* sched, int count);
+int satip_rtp_start_workers(int count);
+int satip_rtp_share_socket(int port, int count);
+int satip_rtp_prepare_setup(struct satip_rtp* srtp, const struct sockaddr* server);
+void satip_rtp_set_source(struct satip_rtp* srtp, const struct sockaddr* server,
+			  int server_port, uint32_t ssrc);
 struct satip_rtp*  satip_rtp_new(int fd, int fixed_rtp_port);
+void satip_rtp_set_report_interval(struct satip_rtp* srtp, int msec);
+/* seconds since the last receiver report went out, -1 = none */
+int satip_rtp_report_age(struct satip_rtp* srtp);
+int satip_rtp_set_sink(struct satip_rtp* srtp, int id, int fd, unsigned char tune_id,
+		       const unsigned char* pidmap);
+void satip_rtp_del_sink(struct satip_rtp* srtp, int id);
+/* stream feeds its sinks only, nothing goes to fd directly */
+void satip_rtp_sinks_only(struct satip_rtp* srtp);
+void satip_rtp_zap(struct satip_rtp* srtp, const struct timespec* requested, int prefetch);
+void satip_rtp_get_counters(struct satip_rtp* srtp, t_satip_rtp_counters* counters);
+long satip_rtp_socket_drops(struct satip_rtp* srtp);
+long satip_rtp_shared_socket_drops(int index);
 //int satip_rtp_port(struct satip_rtp* srtp);
 
 #endif
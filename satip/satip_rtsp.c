@@ -17,22 +17,29 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdarg.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
-#include <poll.h>
+#include <time.h>
 
 #include "satip_config.h"
 #include "satip_rtp.h"
 #include "satip_rtsp.h"
+#include "satip_sdp.h"
+#include "satip_pool.h"
+#include "satip_evloop.h"
+#include "satip_trace.h"
 #include "polltimer.h"
 #include "log.h"
 
@@ -42,6 +49,7 @@ typedef enum {
   RTSP_NOCONFIG = 0,
   RTSP_CONNECTING,
   RTSP_ESTABLISHING,  /* try to get stream ID */
+  RTSP_IDLE,          /* connected without stream ID, waiting for config */
   RTSP_READY,         /* connected with stream ID and no request pending */
   RTSP_WAITING,       /* waiting for response */
   RTSP_ABORTING,
@@ -53,37 +61,177 @@ typedef enum {
   RTSP_REQ_SETUP,
   RTSP_REQ_PLAY,
   RTSP_REQ_TEARDOWN,
+  RTSP_REQ_DESCRIBE,
   RTSP_REQ_NONE
 } t_rtsp_request;
 
+static const char* request_names[] =
+  { "OPTIONS", "SETUP", "PLAY", "TEARDOWN", "DESCRIBE" };
+
 
-#define MAX_BUF 1024
 #define MAX_SESSION 50
+#define MAX_FRONTENDS 16
+
+/* request buffer grows on demand, e.g. for long pid lists */
+#define TXBUF_INITIAL 1024
+#define TXBUF_LIMIT   65536
+
+/* room for the query parts besides the pids */
+#define TUNING_MAX    256
+#define PMT_CI_MAX    (SATIPCFG_MAX_PIDS*6+32)
+
+/* bounds of the URL length, longer pid lists are split */
+#define URL_MAX_MIN   256
+#define URL_PIDS_MIN  64
+
+/* receive buffer grows on demand, e.g. for DESCRIBE bodies */
+#define RXBUF_INITIAL 2048
+#define RXBUF_LIMIT   65536
+
+/* requests sent but not yet answered */
+#define MAX_PENDING 8
+
+/* msec before a failed session is set up again */
+#define RECONNECT_DELAY      5000
+#define SESSION_EXPIRE_DELAY 65000  /* server still holds it until its timeout */
+
+typedef struct rtsp_pending {
+  int cseq;
+  t_rtsp_request request;
+  int tuning;             /* request makes the server tune */
+  int sample;             /* nothing else was pending, use for RTT */
+  struct timespec sent;
+} t_rtsp_pending;
+
+/*
+ * smoothed round trip time as of RFC 6298, kept separately for
+ * requests that make the server tune and plain control requests
+ */
+#define RTT_CONTROL 0
+#define RTT_TUNING  1
+
+#define RTO_INITIAL 5000  /* msec, used until first measurement */
+#define RTO_MIN     1000
+#define RTO_MAX     10000
+
+typedef struct rtsp_rtt {
+  int srtt;               /* usec, 0 = no sample yet */
+  int rttvar;
+} t_rtsp_rtt;
+
+/* server has no free tuner for this request */
+#define RTSP_STATUS_UNAVAILABLE 503
+#define RTSP_STATUS_NOT_ENOUGH_BANDWIDTH 453
+
+/* DESCRIBE without any stream */
+#define RTSP_STATUS_NOT_FOUND 404
+#define RTSP_STATUS_URI_TOO_LONG 414
+
+/* sessions sharing one connection, one per tuner */
+#define MAX_CONN_SESSIONS SATIP_MAX_TUNERS
+
+struct satip_rtsp;
+
+/*
+ * one TCP connection per server carries the sessions of all tuners,
+ * responses are routed to the session that sent the request
+ */
+typedef struct rtsp_conn {
+  char* host;
+  char* port;
+  int sockfd;
+  int connected;
+  struct addrinfo* addrinfo;
+
+  int cseq;               /* unique per connection */
+
+  struct satip_rtsp* session[MAX_CONN_SESSIONS];
+  int nsessions;
+  int hold;               /* in use by the receive loop, do not free */
+
+  struct polltimer_queue* timer_queue;
+  struct polltimer* keep_alive_timer;
+  struct timespec keep_alive_at;
+
+  /* incremental response parser */
+  char* rxbuf;
+  int rxbuf_size;
+  int rxbuf_len;      /* bytes received, not yet consumed */
+  int rxbuf_scan;     /* header end search continues here */
+  int hdr_len;        /* complete header incl. empty line, 0 = incomplete */
+  int content_length;
+  char* body;         /* body of current response, NUL terminated */
+
+  struct rtsp_conn* next;
+} t_rtsp_conn;
+
+static t_rtsp_conn* conn_list=NULL;
+static struct satip_evloop* evloop=NULL;
 
 typedef struct satip_rtsp {
   t_rtsp_state status;
 
-  int sockfd;
+  t_rtsp_conn* conn;  /* NULL = not connected */
   char* host;
   char* port;
-  struct addrinfo* addrinfo;
 
   t_satip_config* satip_config;
   t_satip_rtp *satip_rtp;
 
-  struct polltimer** timer_queue;
+  struct polltimer_queue* timer_queue;
   struct polltimer* timer;
+  struct polltimer* linger_timer;
 
   t_rtsp_request request;
-  int cseq;
   int streamid;
   char session[MAX_SESSION];
   int timeout;
 
-  char txbuf[MAX_BUF];
-
-  char rxbuf[MAX_BUF];
-  int rxbuf_pos;
+  int warm_interval;  /* msec, 0 = connect on demand only */
+  int linger;         /* msec to keep a closed session, 0 = teardown on close */
+  int rtcp_keepalive; /* RTCP receiver reports keep the session, OPTIONS if none */
+  int lingering;
+
+  /* frontend rotation on busy tuners, 0 = let server choose */
+  int fe_list[MAX_FRONTENDS];
+  int fe_busy[MAX_FRONTENDS];
+  int fe_count;
+  int fe_next;
+  int fe_current;
+  unsigned int fe_tried;
+  struct timespec setup_start;
+
+  /* server state from DESCRIBE, cached for probe_interval msec */
+  int probe_interval;     /* 0 = no probing */
+  t_satip_sdp sdp;
+  int sdp_valid;
+  struct timespec sdp_time;
+  unsigned int fe_used;   /* frontends held by other sessions */
+  int fe_auto;            /* no frontend configured, probing may pick one */
+
+  t_satip_pool* pool;     /* NULL = single server, else shared by all tuners */
+  t_satip_pool_server* pool_server;  /* selected for the connection */
+  int pool_held;          /* session counted in its used tuners */
+
+  int status_code;
+
+  char* txbuf;
+  int txbuf_size;
+  int url_max;            /* current limit, lowered by "414 Request-URI Too Long" */
+  int url_max_cfg;
+
+  t_rtsp_pending pending[MAX_PENDING];
+  int npending;
+  int tx_tuning;
+
+  t_rtsp_rtt rtt[2];
+  int rto_min;            /* msec, bounds of derived timers */
+  int rto_max;
+
+  t_satip_rtsp_counters counters;
+  struct timespec zap_requested;  /* last tuning request sent */
+  int zap_prefetch;               /* with pids prefetched, SATIPCFG_PREFETCH_* */
+  int zap_pending;                /* its response hands it to RTP */
 
 } t_satip_rtsp;
 
@@ -92,66 +240,366 @@ static int handle_response_options(t_satip_rtsp* rtsp);
 static int handle_response_setup(t_satip_rtsp* rtsp);
 static int handle_response_play(t_satip_rtsp* rtsp);
 static int handle_response_teardown(t_satip_rtsp* rtsp);
+static int handle_response_describe(t_satip_rtsp* rtsp);
 
 int(*handle_response[])(t_satip_rtsp*)=
 {
   handle_response_options,
   handle_response_setup,
   handle_response_play,
-  handle_response_teardown
+  handle_response_teardown,
+  handle_response_describe
 };
 
 
 
 
 static void restart_connection(t_satip_rtsp* rtsp,int now);
+static void restart_later(t_satip_rtsp* rtsp,int msec);
+static void conn_event(int fd, unsigned int events, void* param);
+static void enter_idle(t_satip_rtsp* rtsp);
 static int send_teardown(t_satip_rtsp* rtsp);
+static void process_response(t_satip_rtsp* rtsp, int ret);
+static int server_failed(t_satip_rtsp* rtsp);
 
 
 
 
-static void reset_connection(t_satip_rtsp* rtsp)
+static void conn_unlink(t_rtsp_conn* conn)
 {
-  rtsp->status = RTSP_NOCONFIG;
+  t_rtsp_conn** prev=&conn_list;
+
+  while ( *prev!=NULL )
+    {
+      if ( *prev==conn )
+	{
+	  *prev=conn->next;
+	  break;
+	}
+      prev=&(*prev)->next;
+    }
+
+  conn->next=NULL;
+}
+
+static void conn_free(t_rtsp_conn* conn)
+{
+  conn_unlink(conn);
+
+  polltimer_cancel(conn->timer_queue, &conn->keep_alive_timer);
+
+  if ( conn->sockfd>=0 )
+    {
+      DEBUG(MSG_NET,"closing socket\n");
+      satip_evloop_del(evloop, conn->sockfd);
+      close(conn->sockfd);
+    }
+
+  free(conn->host);
+  free(conn->port);
+  free(conn->rxbuf);
+  free(conn);
+}
+
+/* join the connection to the session's server, a new one if there is none */
+static t_rtsp_conn* conn_attach(t_satip_rtsp* rtsp)
+{
+  t_rtsp_conn* conn;
+
+  for ( conn=conn_list; conn!=NULL; conn=conn->next )
+    if ( strcmp(conn->host,rtsp->host)==0 && strcmp(conn->port,rtsp->port)==0 &&
+	 conn->nsessions < MAX_CONN_SESSIONS )
+      break;
+
+  if ( conn==NULL )
+    {
+      conn=(t_rtsp_conn*)malloc(sizeof(t_rtsp_conn));
+      memset(conn, 0, sizeof(t_rtsp_conn));
+
+      conn->host=strdup(rtsp->host);
+      conn->port=strdup(rtsp->port);
+      conn->sockfd=-1;
+      conn->cseq=1;
+      conn->timer_queue=rtsp->timer_queue;
+
+      conn->rxbuf_size = RXBUF_INITIAL;
+      conn->rxbuf = (char*)malloc(conn->rxbuf_size+1);
+
+      conn->next=conn_list;
+      conn_list=conn;
+    }
+  else
+    DEBUG(MSG_NET,"sharing connection to %s:%s with %d session(s)\n",
+	  conn->host,conn->port,conn->nsessions);
+
+  conn->session[conn->nsessions++]=rtsp;
+  rtsp->conn=conn;
+
+  return conn;
+}
+
+static void conn_detach(t_satip_rtsp* rtsp)
+{
+  t_rtsp_conn* conn=rtsp->conn;
+  int i;
+
+  for ( i=0; i<conn->nsessions; i++ )
+    if ( conn->session[i]==rtsp )
+      {
+	conn->nsessions--;
+	memmove(&conn->session[i], &conn->session[i+1],
+		(conn->nsessions-i)*sizeof(t_satip_rtsp*));
+	break;
+      }
+
+  rtsp->conn=NULL;
+
+  if ( conn->nsessions==0 )
+    {
+      /* no new sessions on it, freed once the receive loop is done */
+      conn_unlink(conn);
+      if ( conn->hold==0 )
+	conn_free(conn);
+    }
+}
+
+static void conn_release(t_rtsp_conn* conn)
+{
+  conn->hold--;
+
+  if ( conn->hold==0 && conn->nsessions==0 )
+    conn_free(conn);
+}
+
+/* requests of all sessions still waiting for a response */
+static int conn_outstanding(t_rtsp_conn* conn)
+{
+  int i;
+  int n=0;
+
+  for ( i=0; i<conn->nsessions; i++ )
+    n+=conn->session[i]->npending;
+
+  return n;
+}
+
+/* connection is unusable, every session on it starts over */
+static void conn_failed(t_rtsp_conn* conn, int rejected)
+{
+  t_satip_rtsp* session[MAX_CONN_SESSIONS];
+  int n=conn->nsessions;
+  int i;
+
+  memcpy(session, conn->session, n*sizeof(t_satip_rtsp*));
+
+  /* reconnects must not come back to it */
+  conn_unlink(conn);
+  conn->hold++;
+
+  for ( i=0; i<n; i++ )
+    {
+      t_satip_rtsp* rtsp=session[i];
+
+      if ( rtsp->conn!=conn )
+	continue;
+
+      if ( rejected || rtsp->status==RTSP_CONNECTING )
+	restart_connection(rtsp,server_failed(rtsp));
+      else
+	{
+	  rtsp->status_code = 0;
+	  process_response(rtsp, SATIP_RTSP_ERROR);
+	}
+
+      /* state without error handling */
+      if ( rtsp->conn==conn )
+	restart_connection(rtsp,0);
+    }
+
+  conn_release(conn);
+}
+
+
+/* RTSP server as connected, NULL = unknown */
+static const struct sockaddr* server_address(t_satip_rtsp* rtsp)
+{
+  static struct sockaddr_storage addr;
+  socklen_t addrlen=sizeof(addr);
+
+  if ( rtsp->conn==NULL ||
+       getpeername(rtsp->conn->sockfd,(struct sockaddr*)&addr,&addrlen) )
+    return NULL;
+
+  return (struct sockaddr*)&addr;
+}
 
-  rtsp->cseq = 1;
+static void clear_session(t_satip_rtsp* rtsp)
+{
   rtsp->streamid = -1;
-  rtsp->request = RTSP_REQ_NONE;
   rtsp->timeout = 30;
   rtsp->session[0] = 0;
+  satip_rtp_set_source(rtsp->satip_rtp,NULL,0,0);
+
+  /* torn down, or lost with the connection */
+  if ( rtsp->pool_held )
+    {
+      satip_pool_release(rtsp->pool_server);
+      rtsp->pool_held = 0;
+    }
+}
+
+static void reset_connection(t_satip_rtsp* rtsp)
+{
+  int i;
+
+  rtsp->status = RTSP_NOCONFIG;
+
+  rtsp->request = RTSP_REQ_NONE;
+  clear_session(rtsp);
+  rtsp->lingering = 0;
+  rtsp->fe_tried = 0;
+  rtsp->status_code = 0;
 
   rtsp->txbuf[0]=0;
+  rtsp->url_max=rtsp->url_max_cfg;
+
+  for ( i=0; i<rtsp->npending; i++ )
+    rtsp->counters.requests[rtsp->pending[i].request][SATIP_RTSP_RESULT_NONE]++;
+  rtsp->npending=0;
+
+  polltimer_cancel(rtsp->timer_queue,&rtsp->timer);
+  polltimer_cancel(rtsp->timer_queue,&rtsp->linger_timer);
+
+  if (rtsp->conn!=NULL)
+    conn_detach(rtsp);
+}
+
 
-  rtsp->rxbuf_pos=0;
-  rtsp->rxbuf[0]=0;
+static void update_rtt(t_satip_rtsp* rtsp, t_rtsp_pending* pending)
+{
+  struct timespec now;
+  t_rtsp_rtt* rtt=&rtsp->rtt[pending->tuning];
+  int r;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  r = (now.tv_sec - pending->sent.tv_sec)*1000000 +
+    (now.tv_nsec - pending->sent.tv_nsec)/1000;
+  if ( r<1 )
+    r=1;
 
-  if (rtsp->timer != NULL)
+  if ( rtt->srtt == 0 )
+    {
+      rtt->srtt = r;
+      rtt->rttvar = r/2;
+    }
+  else
     {
-      polltimer_cancel(rtsp->timer_queue,rtsp->timer);
-      rtsp->timer=NULL;
+      /* beta = 1/4, alpha = 1/8 */
+      rtt->rttvar += ( abs(rtt->srtt-r) - rtt->rttvar ) / 4;
+      rtt->srtt += ( r - rtt->srtt ) / 8;
     }
 
-  if (rtsp->sockfd>=0)
+  DEBUG(MSG_NET,"rtt%s %d us, srtt %d us, rttvar %d us\n",
+	pending->tuning ? " (tuning)" : "", r, rtt->srtt, rtt->rttvar);
+}
+
+/* supervision time for a request in msec */
+static int request_timeout(t_satip_rtsp* rtsp, int tuning)
+{
+  t_rtsp_rtt* rtt=&rtsp->rtt[tuning];
+  int rto;
+
+  if ( rtt->srtt == 0 )
+    rto = RTO_INITIAL;
+  else
+    /* clock granularity 1 msec */
+    rto = ( rtt->srtt + ( 4*rtt->rttvar > 1000 ? 4*rtt->rttvar : 1000 ) ) / 1000;
+
+  if ( rto < rtsp->rto_min )
+    rto = rtsp->rto_min;
+  if ( rto > rtsp->rto_max )
+    rto = rtsp->rto_max;
+
+  return rto;
+}
+
+/* refresh session so that it arrives in time, even if late by one timeout */
+static int keep_alive_timeout(t_satip_rtsp* rtsp)
+{
+  int msec = rtsp->timeout*1000 - 2*request_timeout(rtsp, RTT_CONTROL);
+
+  if ( msec < rtsp->timeout*500 )
+    msec = rtsp->timeout*500;
+
+  return msec;
+}
+
+/* a receiver report went out since the last keep-alive, OPTIONS not needed */
+static int rtcp_kept_alive(t_satip_rtsp* rtsp)
+{
+  int age;
+
+  if ( !rtsp->rtcp_keepalive )
+    return 0;
+
+  age = satip_rtp_report_age(rtsp->satip_rtp);
+  if ( age >= 0 && age*1000 < keep_alive_timeout(rtsp) )
+    return 1;
+
+  DEBUG(MSG_NET,"no RTCP report sent, keep-alive by OPTIONS\n");
+  return 0;
+}
+
+void satip_rtsp_set_timeouts(t_satip_rtsp* rtsp, int rto_min, int rto_max)
+{
+  if ( rto_min > 0 )
+    rtsp->rto_min = rto_min;
+  if ( rto_max > 0 )
+    rtsp->rto_max = rto_max;
+
+  /* e.g. only min given above the default max */
+  if ( rtsp->rto_max < rtsp->rto_min )
     {
-      DEBUG(MSG_NET,"closing socket\n");
-      close(rtsp->sockfd);
-      rtsp->sockfd=-1;
+      if ( rto_max > 0 )
+	WARN(MSG_NET,"timeout max %d below min %d, raised\n",rto_max,rtsp->rto_min);
+      rtsp->rto_max = rtsp->rto_min;
     }
 }
 
+/* server dropped out, returns whether another one can take over at once */
+static int server_failed(t_satip_rtsp* rtsp)
+{
+  if ( rtsp->pool == NULL )
+    return 0;
+
+  satip_pool_failed(rtsp->pool_server);
+  return satip_pool_available(rtsp->pool);
+}
 
 static void timeout_reconnect(void* param)
 {
   t_satip_rtsp* rtsp=(t_satip_rtsp*)param;
 
   DEBUG(MSG_NET,"timeout\n");
+  rtsp->counters.timeouts++;
 
   /* timer expired, clear it */
   rtsp->timer = NULL;
 
   if (rtsp->streamid>0) send_teardown(rtsp);
-  sleep(5);
-  restart_connection(rtsp,1);
+
+  /* connection may hang, keep it from new sessions */
+  if ( rtsp->conn!=NULL )
+    conn_unlink(rtsp->conn);
+
+  /* NOCONFIG: connect failed, failure was counted already */
+  if ( rtsp->status != RTSP_NOCONFIG && server_failed(rtsp) )
+    {
+      restart_connection(rtsp,1);
+      return;
+    }
+
+  restart_later(rtsp,RECONNECT_DELAY);
 }
 
 
@@ -159,7 +607,7 @@ static void timeout_reconnect(void* param)
 
 
 t_satip_rtsp* satip_rtsp_new(t_satip_config* satip_config,
-			     struct polltimer** timer_queue,
+			     struct polltimer_queue* timer_queue,
 			     const char* host,
 			     const char* port,
 			     t_satip_rtp* satip_rtp)
@@ -175,10 +623,42 @@ t_satip_rtsp* satip_rtsp_new(t_satip_config* satip_config,
   rtsp->timer_queue = timer_queue;
 
   rtsp->timer = NULL;
-  rtsp->sockfd = -1;
+  rtsp->linger_timer = NULL;
+  rtsp->conn = NULL;
 
   rtsp->satip_rtp = satip_rtp;
 
+  rtsp->rtt[RTT_CONTROL].srtt = 0;
+  rtsp->rtt[RTT_TUNING].srtt = 0;
+  rtsp->rto_min = RTO_MIN;
+  rtsp->rto_max = RTO_MAX;
+
+  rtsp->warm_interval = 0;
+  rtsp->linger = 0;
+  rtsp->rtcp_keepalive = 0;
+  rtsp->fe_count = 0;
+  rtsp->fe_next = 0;
+  rtsp->fe_current = -1;
+
+  rtsp->probe_interval = 0;
+  rtsp->sdp_valid = 0;
+  rtsp->sdp_time.tv_sec = 0;
+  rtsp->sdp_time.tv_nsec = 0;
+  rtsp->fe_used = 0;
+  rtsp->fe_auto = ( satip_config->frontend <= 0 );
+
+  rtsp->pool = NULL;
+  rtsp->pool_server = NULL;
+  rtsp->pool_held = 0;
+
+  rtsp->txbuf_size = TXBUF_INITIAL;
+  rtsp->txbuf = (char*)malloc(rtsp->txbuf_size);
+  rtsp->url_max_cfg = SATIP_RTSP_URL_MAX;
+
+  memset(&rtsp->counters, 0, sizeof(rtsp->counters));
+  rtsp->zap_pending = 0;
+  rtsp->npending = 0;
+
   /* reset dynamic parts*/
   reset_connection(rtsp);
 
@@ -188,55 +668,271 @@ t_satip_rtsp* satip_rtsp_new(t_satip_config* satip_config,
 
 static void restart_connection(t_satip_rtsp* rtsp,int now)
 {
-  reset_connection(rtsp);
-
   if ( now )
     {
+      reset_connection(rtsp);
       satip_rtsp_check_update(rtsp, 0);
     }
   else
+    restart_later(rtsp,RECONNECT_DELAY);
+}
+
+static void timeout_restart(void* param)
+{
+  t_satip_rtsp* rtsp=(t_satip_rtsp*)param;
+
+  /* timer expired, clear it */
+  rtsp->timer = NULL;
+
+  DEBUG(MSG_NET,"retrying\n");
+  restart_connection(rtsp,1);
+}
+
+/*
+ * attempt again after some time: NOCONFIG with the timer pending, which
+ * keeps satip_rtsp_check_update() from connecting before it expired
+ */
+static void restart_later(t_satip_rtsp* rtsp,int msec)
+{
+  reset_connection(rtsp);
+
+  rtsp->timer = polltimer_start( rtsp->timer_queue,
+				 timeout_restart,
+				 msec,(void*)rtsp);
+}
+
+/*
+ * value of header "name" within the NUL terminated header block,
+ * header names are case insensitive
+ */
+static char* find_header(char* hdr, const char* name)
+{
+  int len=strlen(name);
+  char* line=strchr(hdr,'\n');
+
+  while ( line!=NULL )
     {
-      /* attempt again after some time*/
-      rtsp->timer = polltimer_start( rtsp->timer_queue,
-				     timeout_reconnect,
-				     5000,(void*)rtsp);
+      line++;
+      if ( strncasecmp(line,name,len)==0 && line[len]==':' )
+	{
+	  line+=len+1;
+	  while ( *line==' ' || *line=='\t' )
+	    line++;
+	  return line;
+	}
+      line=strchr(line,'\n');
     }
+
+  return NULL;
+}
+
+static t_rtsp_request pending_request(t_satip_rtsp* rtsp)
+{
+  if ( rtsp->npending == 0 )
+    return RTSP_REQ_NONE;
+
+  return rtsp->pending[rtsp->npending-1].request;
+}
+
+/* remove request answered by cseq from pending list, older ones are lost */
+static t_rtsp_request match_request(t_satip_rtsp* rtsp, int cseq)
+{
+  t_rtsp_request request;
+  int i,n;
+
+  for ( i=0; i<rtsp->npending; i++ )
+    if ( rtsp->pending[i].cseq == cseq )
+      break;
+
+  if ( i == rtsp->npending )
+    return RTSP_REQ_NONE;
+
+  if ( i>0 )
+    DEBUG(MSG_NET,"%d response(s) missing before CSeq %d\n",i,cseq);
+  for ( n=0; n<i; n++ )
+    rtsp->counters.requests[rtsp->pending[n].request][SATIP_RTSP_RESULT_NONE]++;
+
+  request = rtsp->pending[i].request;
+  if ( rtsp->pending[i].sample )
+    update_rtt(rtsp, &rtsp->pending[i]);
+
+  rtsp->npending -= i+1;
+  memmove(&rtsp->pending[0], &rtsp->pending[i+1],
+	  rtsp->npending*sizeof(t_rtsp_pending));
+
+  return request;
 }
 
-static int read_response(t_satip_rtsp* rtsp)
+static int receive_data(t_rtsp_conn* conn)
 {
   int rec;
 
-  rec=recv(rtsp->sockfd,
-	   &(rtsp->rxbuf[rtsp->rxbuf_pos]),
-	   MAX_BUF-rtsp->rxbuf_pos, 0);
+  if ( conn->rxbuf_len == conn->rxbuf_size )
+    {
+      if ( conn->rxbuf_size >= RXBUF_LIMIT )
+	{
+	  ERROR(MSG_NET,"response exceeds %d bytes\n",RXBUF_LIMIT);
+	  return SATIP_RTSP_ERROR;
+	}
+
+      conn->rxbuf_size *= 2;
+      conn->rxbuf = (char*)realloc(conn->rxbuf, conn->rxbuf_size+1);
+    }
+
+  rec=recv(conn->sockfd,
+	   &(conn->rxbuf[conn->rxbuf_len]),
+	   conn->rxbuf_size-conn->rxbuf_len, 0);
 
-  if ( rec==0 )
+  if ( rec<0 && (errno==EAGAIN || errno==EINTR) )
+    return SATIP_RTSP_OK;
+
+  if ( rec<=0 )
     return SATIP_RTSP_ERROR;
 
-  rtsp->rxbuf_pos += rec;
-  rtsp->rxbuf[rtsp->rxbuf_pos]=0;
+  DEBUG(MSG_NET,"rxbuf:\n%.*s\n<<\n",rec,&conn->rxbuf[conn->rxbuf_len]);
+
+  conn->rxbuf_len += rec;
 
-  DEBUG(MSG_NET,"rxbuf:\n%s\n<<\n",rtsp->rxbuf);
+  return SATIP_RTSP_OK;
+}
 
+/* 
+ * session which sent the request of the current response: by CSeq,
+ * without CSeq the oldest request of the session named in the response
+ */
+static t_satip_rtsp* route_response(t_rtsp_conn* conn, int* cseq)
+{
+  t_satip_rtsp* rtsp;
+  char* str;
+  int i,j,len;
 
-  if (strstr(rtsp->rxbuf,"\r\n\r\n") == NULL )
+  str = find_header(conn->rxbuf,"CSeq");
+  if ( str!=NULL )
     {
-      return SATIP_RTSP_OK;
+      *cseq = atoi(str);
+      for ( i=0; i<conn->nsessions; i++ )
+	for ( j=0; j<conn->session[i]->npending; j++ )
+	  if ( conn->session[i]->pending[j].cseq == *cseq )
+	    return conn->session[i];
+      return NULL;
     }
-  else
+
+  str = find_header(conn->rxbuf,"Session");
+  for ( i=0; i<conn->nsessions; i++ )
     {
-      /* reset buffer index for next response */
-      rtsp->rxbuf_pos=0;
+      rtsp = conn->session[i];
+      if ( rtsp->npending==0 )
+	continue;
 
-      /* check basic status code */
-      int ret=0;
-      sscanf(rtsp->rxbuf,"RTSP/%*s %d",&ret);
-      if (ret!=200)
-	return SATIP_RTSP_ERROR;
-     fflush(stdout);
-      /* request specific evaluation of response */
-      return (*handle_response[rtsp->request])(rtsp);
+      len = strlen(rtsp->session);
+      if ( str==NULL ? conn->nsessions==1 :
+	   ( len>0 && strncmp(str,rtsp->session,len)==0 && strchr(";\r",str[len])!=NULL ) )
+	{
+	  *cseq = rtsp->pending[0].cseq;
+	  return rtsp;
+	}
+    }
+
+  *cseq = 0;
+  return NULL;
+}
+
+/*
+ * take next complete response from receive buffer and evaluate it for
+ * the session which sent the request, returns SATIP_RTSP_OK if no
+ * complete response is available
+ */
+static int read_response(t_rtsp_conn* conn, t_satip_rtsp** target)
+{
+  *target = NULL;
+
+  while (1)
+    {
+      char* str;
+      char* end;
+      char saved;
+      int start,msg_len,cseq,status=0;
+      int ret;
+      t_rtsp_request request=RTSP_REQ_NONE;
+      t_satip_rtsp* rtsp;
+
+      if ( conn->hdr_len == 0 )
+	{
+	  /* search only new data, "\r\n\r\n" may span two receives */
+	  start = conn->rxbuf_scan>3 ? conn->rxbuf_scan-3 : 0;
+	  end = memmem(&conn->rxbuf[start], conn->rxbuf_len-start, "\r\n\r\n", 4);
+	  if ( end == NULL )
+	    {
+	      conn->rxbuf_scan = conn->rxbuf_len;
+	      return SATIP_RTSP_OK;
+	    }
+
+	  conn->hdr_len = end - conn->rxbuf + 4;
+
+	  /* terminate header block at last "\n", body follows */
+	  saved = conn->rxbuf[conn->hdr_len-1];
+	  conn->rxbuf[conn->hdr_len-1] = 0;
+	  str = find_header(conn->rxbuf,"Content-Length");
+	  conn->content_length = str ? atoi(str) : 0;
+	  conn->rxbuf[conn->hdr_len-1] = saved;
+
+	  if ( conn->content_length<0 ||
+	       conn->hdr_len+conn->content_length > RXBUF_LIMIT )
+	    {
+	      ERROR(MSG_NET,"invalid Content-Length %d\n",conn->content_length);
+	      return SATIP_RTSP_ERROR;
+	    }
+	}
+
+      msg_len = conn->hdr_len + conn->content_length;
+
+      if ( conn->rxbuf_len < msg_len )
+	return SATIP_RTSP_OK;
+
+      /* complete response, make header and body strings */
+      saved = conn->rxbuf[msg_len];
+      conn->rxbuf[msg_len] = 0;
+      conn->rxbuf[conn->hdr_len-1] = 0;
+      conn->body = &conn->rxbuf[conn->hdr_len];
+
+      sscanf(conn->rxbuf,"RTSP/%*s %d",&status);
+
+      rtsp = route_response(conn,&cseq);
+      if ( rtsp!=NULL )
+	request = match_request(rtsp,cseq);
+
+      if ( request == RTSP_REQ_NONE )
+	{
+	  DEBUG(MSG_NET,"dropping response with CSeq %d\n",cseq);
+	  ret = SATIP_RTSP_OK;
+	}
+      else
+	{
+	  rtsp->status_code = status;
+	  rtsp->request = request;
+	  rtsp->counters.requests[request][status==200 ? SATIP_RTSP_RESULT_OK : SATIP_RTSP_RESULT_ERROR]++;
+
+	  if ( status!=200 )
+	    ret = SATIP_RTSP_ERROR;
+	  else
+	    /* request specific evaluation of response */
+	    ret = (*handle_response[request])(rtsp);
+	}
+
+      /* connection is held by the caller, handler may only detach the session */
+      conn->rxbuf[msg_len] = saved;
+      conn->rxbuf_len -= msg_len;
+      memmove(conn->rxbuf, &conn->rxbuf[msg_len], conn->rxbuf_len);
+      conn->rxbuf_scan = 0;
+      conn->hdr_len = 0;
+      conn->content_length = 0;
+      conn->body = NULL;
+
+      if ( request != RTSP_REQ_NONE )
+	{
+	  *target = rtsp;
+	  return ret;
+	}
     }
 }
 
@@ -247,18 +943,32 @@ static int handle_response_options(t_satip_rtsp* rtsp)
 }
 
 
+/* tuning is done on the server, the zap ends with its first TS data */
+static void zap_answered(t_satip_rtsp* rtsp)
+{
+  if ( rtsp->zap_pending )
+    {
+      satip_trace(rtsp->satip_rtp->fd, SATIP_TRACE_ANSWERED, rtsp->status_code);
+      satip_rtp_zap(rtsp->satip_rtp, &rtsp->zap_requested, rtsp->zap_prefetch);
+      rtsp->zap_pending = 0;
+    }
+}
+
 static int handle_response_setup(t_satip_rtsp* rtsp)
 {
   char* str;
+  char* transport;
+  uint32_t ssrc=0;
+  int server_port=0;
 
-  str=strstr(rtsp->rxbuf,"\ncom.ses.streamID:");
-  if ( str==NULL  || sscanf(str,"\ncom.ses.streamID: %d",&rtsp->streamid) != 1 )
+  str=find_header(rtsp->conn->rxbuf,"com.ses.streamID");
+  if ( str==NULL  || sscanf(str,"%d",&rtsp->streamid) != 1 )
     return SATIP_RTSP_ERROR;
 
   DEBUG(MSG_NET,"streamid %d\n",rtsp->streamid);
 
-  str=strstr(rtsp->rxbuf,"\nSession:");
-  if ( str==NULL || sscanf(str,"\nSession: %s",rtsp->session) !=1 )
+  str=find_header(rtsp->conn->rxbuf,"Session");
+  if ( str==NULL || sscanf(str,"%49s",rtsp->session) !=1 )
     return SATIP_RTSP_ERROR;
 
   str=strstr(rtsp->session,";timeout=");
@@ -274,7 +984,43 @@ static int handle_response_setup(t_satip_rtsp* rtsp)
 
   DEBUG(MSG_NET,"Session: %s\n",rtsp->session);
 
+  if ( rtsp->fe_tried )
+    {
+      struct timespec now;
+      int attempts=__builtin_popcount(rtsp->fe_tried);
+
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      INFO(MSG_NET,"SETUP done after %ld ms, %d attempt%s, fe=%d\n",
+	   (now.tv_sec - rtsp->setup_start.tv_sec)*1000 +
+	   (now.tv_nsec - rtsp->setup_start.tv_nsec)/1000000,
+	   attempts, attempts>1 ? "s" : "",
+	   rtsp->satip_config->frontend);
+
+      if ( rtsp->fe_current>=0 )
+	{
+	  rtsp->fe_busy[rtsp->fe_current] = 0;
+	  rtsp->fe_next = rtsp->fe_current;
+	}
+      rtsp->fe_tried = 0;
+    }
+
+  if ( rtsp->pool != NULL && !rtsp->pool_held )
+    {
+      satip_pool_success(rtsp->pool_server);
+      rtsp->pool_held = 1;
+    }
+
+  /* shared RTP socket tells streams apart by SSRC and sender */
+  transport=find_header(rtsp->conn->rxbuf,"Transport");
+  if ( transport!=NULL && (str=strstr(transport,"ssrc="))!=NULL )
+    ssrc=strtoul(str+5,NULL,16);
+  if ( transport!=NULL && (str=strstr(transport,"server_port="))!=NULL )
+    server_port=strtoul(str+12,NULL,10) & 0xffff;
+  satip_rtp_set_source(rtsp->satip_rtp,server_address(rtsp),server_port,ssrc);
+
   rtsp->satip_rtp->tune_id=rtsp->satip_config->tune_id;
+  rtsp->satip_rtp->frequency=rtsp->satip_config->frequency;
+  zap_answered(rtsp);
   return SATIP_RTSP_COMPLETE;
 }
 
@@ -282,209 +1028,444 @@ static int handle_response_setup(t_satip_rtsp* rtsp)
 static int handle_response_play(t_satip_rtsp* rtsp)
 {
   rtsp->satip_rtp->tune_id=rtsp->satip_config->tune_id;
+  rtsp->satip_rtp->frequency=rtsp->satip_config->frequency;
+  zap_answered(rtsp);
   return SATIP_RTSP_COMPLETE;
 }
 
 static int handle_response_teardown(t_satip_rtsp* rtsp)
 {
+  if ( rtsp->warm_interval > 0 )
+    {
+      /* keep connection open for next tuning */
+      clear_session(rtsp);
+      return SATIP_RTSP_COMPLETE;
+    }
+
   reset_connection(rtsp);
 
   return SATIP_RTSP_OK;
 }
 
 
+static int handle_response_describe(t_satip_rtsp* rtsp)
+{
+  satip_sdp_parse(rtsp->conn->body, &rtsp->sdp);
+  rtsp->sdp_valid = 1;
+  rtsp->fe_used = satip_sdp_used(&rtsp->sdp, rtsp->streamid);
+
+  DEBUG(MSG_NET,"server tuners %d,%d,%d, %d stream(s), fe used 0x%x\n",
+	rtsp->sdp.tuners[SATIP_MSYS_SAT],
+	rtsp->sdp.tuners[SATIP_MSYS_TER],
+	rtsp->sdp.tuners[SATIP_MSYS_CAB],
+	rtsp->sdp.nstreams, rtsp->fe_used);
+
+  if ( rtsp->pool != NULL )
+    {
+      t_satip_msys msys=satip_sdp_msys(rtsp->satip_config->delsys);
+
+      /* other streams, all our tuners' ones among them, and our own */
+      satip_pool_probed(rtsp->pool_server,
+			msys != SATIP_MSYS_UNKNOWN ? rtsp->sdp.tuners[msys] : 0,
+			__builtin_popcount(rtsp->fe_used) + rtsp->pool_held);
+    }
+
+  return SATIP_RTSP_COMPLETE;
+}
+
+
+/* request buffer holds at least size bytes */
+static int tx_reserve(t_satip_rtsp* rtsp, int size)
+{
+  char* buf;
+  int newsize=rtsp->txbuf_size;
+
+  if ( size <= newsize )
+    return 0;
+
+  while ( newsize < size )
+    newsize *= 2;
+
+  if ( newsize > TXBUF_LIMIT ||
+       ( buf = (char*)realloc(rtsp->txbuf, newsize) ) == NULL )
+    {
+      ERROR(MSG_NET,"request of %d bytes too large\n",size);
+      return -1;
+    }
+
+  rtsp->txbuf = buf;
+  rtsp->txbuf_size = newsize;
+  return 0;
+}
+
+/* append to the request of length printed, returns the new length or -1 */
+static int tx_printf(t_satip_rtsp* rtsp, int printed, const char* fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(rtsp->txbuf+printed, rtsp->txbuf_size-printed, fmt, ap);
+  va_end(ap);
+
+  if ( printed+len >= rtsp->txbuf_size )
+    {
+      if ( tx_reserve(rtsp, printed+len+1) )
+	return -1;
+
+      va_start(ap, fmt);
+      vsnprintf(rtsp->txbuf+printed, rtsp->txbuf_size-printed, fmt, ap);
+      va_end(ap);
+    }
+
+  return printed+len;
+}
+
+
 static int send_options(t_satip_rtsp* rtsp)
 {
   int printed;
 
   printed =
-    snprintf(rtsp->txbuf,MAX_BUF,"OPTIONS rtsp://%s:%s/ RTSP/1.0\r\n"
+    tx_printf(rtsp,0,"OPTIONS rtsp://%s:%s/ RTSP/1.0\r\n"
 	     "CSeq: %d\r\n"
 	     "%s%s%s",
 	     rtsp->host, rtsp->port, 
-	     rtsp->cseq++,
+	     rtsp->conn->cseq++,
 	     rtsp->session[0] ? "Session: " : "",
 	     rtsp->session ,
 	     rtsp->session[0] ? "\r\n\r\n" : "\r\n"
 	     );
 
-  if ( printed >= MAX_BUF )
-    return SATIP_RTSP_ERROR;
+  if ( printed < 0 )
+    return SATIP_RTSP_ERROR;
+
+  DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
+
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
+    return SATIP_RTSP_ERROR;
+
+  return SATIP_RTSP_OK;
+}
+
+
+static int send_teardown(t_satip_rtsp* rtsp)
+{
+  int printed;
+
+  printed =
+    tx_printf(rtsp,0,"TEARDOWN rtsp://%s/stream=%d RTSP/1.0\r\n"
+	     "CSeq: %d\r\n"
+	     "Session: %s\r\n\r\n",
+	     rtsp->host,
+	     rtsp->streamid,
+	     rtsp->conn->cseq++,
+	     rtsp->session);
+
+  if ( printed < 0 )
+    return SATIP_RTSP_ERROR;
+
+  DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
+
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
+    return SATIP_RTSP_ERROR;
+
+  return SATIP_RTSP_OK;
+}
+
+
+
+static int send_describe(t_satip_rtsp* rtsp)
+{
+  int printed;
+
+  /* failed attempts are not repeated before the next interval either */
+  clock_gettime(CLOCK_MONOTONIC,&rtsp->sdp_time);
+
+  printed =
+    tx_printf(rtsp,0,"DESCRIBE rtsp://%s:%s/ RTSP/1.0\r\n"
+	     "CSeq: %d\r\n"
+	     "Accept: application/sdp\r\n\r\n",
+	     rtsp->host, rtsp->port,
+	     rtsp->conn->cseq++);
+
+  if ( printed < 0 )
+    return SATIP_RTSP_ERROR;
+
+  DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
+
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
+    return SATIP_RTSP_ERROR;
+
+  return SATIP_RTSP_OK;
+}
+
+static int probe_due(t_satip_rtsp* rtsp)
+{
+  struct timespec now;
+
+  if ( rtsp->probe_interval <= 0 )
+    return 0;
+
+  if ( rtsp->sdp_time.tv_sec == 0 && rtsp->sdp_time.tv_nsec == 0 )
+    return 1;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  return ( (now.tv_sec - rtsp->sdp_time.tv_sec)*1000 +
+	   (now.tv_nsec - rtsp->sdp_time.tv_nsec)/1000000 >= rtsp->probe_interval );
+}
+
+void satip_rtsp_set_probe(t_satip_rtsp* rtsp, int interval)
+{
+  rtsp->probe_interval = interval;
+}
+
+static int frontend_used(t_satip_rtsp* rtsp, int fe)
+{
+  return ( fe>0 && fe<=SATIP_SDP_MAX_FE &&
+	   (rtsp->fe_used & SATIP_SDP_FE_BIT(fe)) );
+}
+
+/*
+ * pick a frontend not yet tried for this tuning, skipping those the
+ * probed server reports for another system; free ones before the least
+ * busy, starting the rotation at the one that worked last
+ */
+static int select_frontend(t_satip_rtsp* rtsp)
+{
+  t_satip_msys msys=satip_sdp_msys(rtsp->satip_config->delsys);
+  t_satip_msys fe_msys;
+  int i,idx;
+  int best=-1;
+  int used,best_used=0;
+
+  for ( i=0; i<rtsp->fe_count; i++ )
+    {
+      idx = (rtsp->fe_next+i) % rtsp->fe_count;
+
+      if ( rtsp->fe_tried & (1<<idx) )
+	continue;
+
+      if ( rtsp->sdp_valid )
+	{
+	  fe_msys = satip_sdp_frontend_msys(&rtsp->sdp, rtsp->fe_list[idx]);
+	  if ( fe_msys != SATIP_MSYS_UNKNOWN && msys != SATIP_MSYS_UNKNOWN &&
+	       fe_msys != msys )
+	    continue;
+	}
 
-  DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
+      used = frontend_used(rtsp, rtsp->fe_list[idx]);
 
-  if ( send(rtsp->sockfd,rtsp->txbuf,printed,0) != printed )
-    return SATIP_RTSP_ERROR;
+      if ( best<0 || used < best_used ||
+	   ( used == best_used && rtsp->fe_busy[idx] < rtsp->fe_busy[best] ) )
+	{
+	  best=idx;
+	  best_used=used;
+	}
+    }
 
-  return SATIP_RTSP_OK;
+  return best;
 }
 
-
-static int send_teardown(t_satip_rtsp* rtsp)
+/* free frontend of the tuning's system as probed, 0 = let server choose */
+static int auto_frontend(t_satip_rtsp* rtsp)
 {
-  int printed;
+  if ( rtsp->fe_count > 0 || !rtsp->fe_auto || !rtsp->sdp_valid )
+    return 0;
 
-  printed =
-    snprintf(rtsp->txbuf,MAX_BUF,"TEARDOWN rtsp://%s/stream=%d RTSP/1.0\r\n"
-	     "CSeq: %d\r\n"
-	     "Session: %s\r\n\r\n",
-	     rtsp->host,
-	     rtsp->streamid,
-	     rtsp->cseq++,
-	     rtsp->session);
+  return satip_sdp_free_frontend(&rtsp->sdp,
+				 satip_sdp_msys(rtsp->satip_config->delsys),
+				 rtsp->fe_used);
+}
 
-  if ( printed >= MAX_BUF )
-    return SATIP_RTSP_ERROR;
+void satip_rtsp_set_frontends(t_satip_rtsp* rtsp, int* fe_list, int count)
+{
+  int i;
 
-  DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
+  if ( count > MAX_FRONTENDS )
+    count = MAX_FRONTENDS;
 
-  if ( send(rtsp->sockfd,rtsp->txbuf,printed,0) != printed )
-    return SATIP_RTSP_ERROR;
+  for ( i=0; i<count; i++ )
+    {
+      rtsp->fe_list[i] = fe_list[i];
+      rtsp->fe_busy[i] = 0;
+    }
 
-  return SATIP_RTSP_OK;
+  rtsp->fe_count = count;
 }
 
-
+static int tuner_busy(t_satip_rtsp* rtsp)
+{
+  return ( rtsp->status_code == RTSP_STATUS_UNAVAILABLE ||
+	   rtsp->status_code == RTSP_STATUS_NOT_ENOUGH_BANDWIDTH );
+}
 
 static int send_setup(t_satip_rtsp* rtsp)
 {
-  char* buf=rtsp->txbuf;
-  int printed;
-  int remain=MAX_BUF;
+  int printed,len;
 
-  printed = snprintf(buf,remain,"SETUP rtsp://%s/?", rtsp->host);
-  if ( printed >= remain )
-    return SATIP_RTSP_ERROR;
+  if ( rtsp->fe_tried == 0 )
+    clock_gettime(CLOCK_MONOTONIC,&rtsp->setup_start);
+
+  if ( rtsp->fe_count > 0 )
+    {
+      rtsp->fe_current = select_frontend(rtsp);
+      if ( rtsp->fe_current<0 )
+	return SATIP_RTSP_ERROR;
 
+      rtsp->fe_tried |= 1<<rtsp->fe_current;
+      rtsp->satip_config->frontend = rtsp->fe_list[rtsp->fe_current];
+    }
+  else
+    {
+      int fe=auto_frontend(rtsp);
 
-  printed += satip_prepare_tuning(rtsp->satip_config,buf+printed,remain-printed);
-  if ( printed >= remain )
-    return SATIP_RTSP_ERROR;
+      if ( rtsp->fe_auto )
+	rtsp->satip_config->frontend = fe>0 ? fe : -1;
 
-  printed += snprintf(buf+printed,remain-printed,"&");
+      /* count attempts */
+      rtsp->fe_tried |= fe>0 ? SATIP_SDP_FE_BIT(fe) : 1;
+    }
 
-  if ( printed >= remain )
+  /* client_port may change on the shared port pair */
+  if ( satip_rtp_prepare_setup(rtsp->satip_rtp, server_address(rtsp)) )
     return SATIP_RTSP_ERROR;
 
-#if 0
-  printed += satip_prepare_pids(rtsp->satip_config,buf+printed,remain-printed,0);
-  if ( printed >= remain )
+  printed = tx_printf(rtsp,0,"SETUP rtsp://%s/?", rtsp->host);
+  if ( printed < 0 || tx_reserve(rtsp, printed+TUNING_MAX+PMT_CI_MAX) )
     return SATIP_RTSP_ERROR;
 
+  len = satip_prepare_tuning(rtsp->satip_config,rtsp->txbuf+printed,TUNING_MAX);
+  if ( len >= TUNING_MAX )
+    return SATIP_RTSP_ERROR;
+  printed += len;
 
-  satip_settle_config(rtsp->satip_config);
-#else
-  printed += snprintf(buf+printed,remain-printed,"pids=none");
-#endif
+  printed = tx_printf(rtsp,printed,"&pids=none");
+  if ( printed < 0 || tx_reserve(rtsp, printed+PMT_CI_MAX) )
+    return SATIP_RTSP_ERROR;
 
   /* Add PMT and CI parameters if available */
-  printed += satip_prepare_pmt_ci(rtsp->satip_config, buf+printed, remain-printed);
-  if ( printed >= remain )
-    return SATIP_RTSP_ERROR;
+  printed += satip_prepare_pmt_ci(rtsp->satip_config, rtsp->txbuf+printed, PMT_CI_MAX);
 
 #if 1
-  printed += snprintf(buf+printed,remain-printed," RTSP/1.0\r\n"
+  printed = tx_printf(rtsp,printed," RTSP/1.0\r\n"
 		      "CSeq: %d\r\n"
 		      "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n\r\n",
-		      rtsp->cseq++,rtsp->satip_rtp->rtp_port,rtsp->satip_rtp->rtp_port+1);
+		      rtsp->conn->cseq++,rtsp->satip_rtp->rtp_port,rtsp->satip_rtp->rtp_port+1);
 
 #else
-  printed += snprintf(buf+printed,remain-printed," RTSP/1.0\r\n"
+  printed = tx_printf(rtsp,printed," RTSP/1.0\r\n"
 		      "CSeq: %d\r\n"
 		      "Transport: RTP/AVP;multicast;destination=224.16.16.1;port=%d-%d\r\n\r\n",
-		      rtsp->cseq++,rtsp->satip_rtp->rtp_port,rtsp->satip_rtp->rtp_port+1);
+		      rtsp->conn->cseq++,rtsp->satip_rtp->rtp_port,rtsp->satip_rtp->rtp_port+1);
 #endif
 
 
-  if ( printed >= remain )
+  if ( printed < 0 )
     return SATIP_RTSP_ERROR;
 
   DEBUG(MSG_NET,">>txbuf:\n%s\n<<\n",rtsp->txbuf);
 
-  if ( send(rtsp->sockfd,rtsp->txbuf,printed,0) != printed )
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
     return  SATIP_RTSP_ERROR ;
-  INFO(MSG_NET, "Channel URI: %s\n", buf);
+  INFO(MSG_NET, "Channel URI: %s\n", rtsp->txbuf);
 
   return SATIP_RTSP_OK;
 }
 
 
-static int send_play(t_satip_rtsp* rtsp)
+/* keep session and tuner allocated, but stop streaming */
+static int send_play_none(t_satip_rtsp* rtsp)
 {
-  char* buf=rtsp->txbuf;
   int printed;
-  int remain=MAX_BUF;
-  int tuning,pid_update;
 
-  tuning = satip_tuning_required(rtsp->satip_config);
-  pid_update = satip_pid_update_required(rtsp->satip_config);
+  printed =
+    tx_printf(rtsp,0,"PLAY rtsp://%s/stream=%d?pids=none RTSP/1.0\r\n"
+	     "CSeq: %d\r\n"
+	     "Session: %s\r\n\r\n",
+	     rtsp->host,
+	     rtsp->streamid,
+	     rtsp->conn->cseq++,
+	     rtsp->session);
 
-  printed = snprintf(buf,remain,"PLAY rtsp://%s/stream=%d%s",
-		     rtsp->host,rtsp->streamid,
-		     (tuning || pid_update) ? "?" : "");
-  if ( printed>=remain )
+  if ( printed < 0 )
     return SATIP_RTSP_ERROR;
 
-#if 1
+  DEBUG(MSG_NET,">>play:\n%s\n<<\n",rtsp->txbuf);
 
-  if ( tuning )
-    {
-      printed += satip_prepare_tuning(rtsp->satip_config, buf+printed, remain-printed);
-      if ( printed>=remain )
-	return SATIP_RTSP_ERROR;
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
+    return SATIP_RTSP_ERROR;
 
-      printed += snprintf(buf+printed,remain-printed,"&");
+  return SATIP_RTSP_OK;
+}
 
-      if ( printed >= remain )
-	return SATIP_RTSP_ERROR;
 
-      printed += satip_prepare_pids(rtsp->satip_config, buf+printed, remain-printed,0);
-      if ( printed>=remain )
-	return SATIP_RTSP_ERROR;
+static int send_play(t_satip_rtsp* rtsp)
+{
+  t_satip_config* cfg=rtsp->satip_config;
+  char pmt_ci[PMT_CI_MAX];
+  int printed,len;
+  int budget;
+  int tuning,pid_update;
 
-      /* Add PMT and CI parameters if available */
-      printed += satip_prepare_pmt_ci(rtsp->satip_config, buf+printed, remain-printed);
-      if ( printed>=remain )
-	return SATIP_RTSP_ERROR;
+  tuning = satip_tuning_required(cfg);
+  rtsp->tx_tuning = tuning;
+  pid_update = satip_pid_update_required(cfg);
 
-    }
-  else if (  pid_update )
-    {
+  printed = tx_printf(rtsp,0,"PLAY rtsp://%s/stream=%d%s",
+		      rtsp->host,rtsp->streamid,
+		      (tuning || pid_update) ? "?" : "");
+  if ( printed < 0 )
+    return SATIP_RTSP_ERROR;
 
-      printed += satip_prepare_pids(rtsp->satip_config, buf+printed, remain-printed,1);
-      if ( printed>=remain )
+  if ( tuning || pid_update )
+    {
+      if ( tx_reserve(rtsp, printed+TUNING_MAX+rtsp->url_max+PMT_CI_MAX) )
 	return SATIP_RTSP_ERROR;
 
+      if ( tuning )
+	{
+	  len = satip_prepare_tuning(cfg, rtsp->txbuf+printed, TUNING_MAX-1);
+	  if ( len >= TUNING_MAX-1 )
+	    return SATIP_RTSP_ERROR;
+
+	  printed += len;
+	  rtsp->txbuf[printed++] = '&';
+	}
+
       /* Add PMT and CI parameters if available */
-      printed += satip_prepare_pmt_ci(rtsp->satip_config, buf+printed, remain-printed);
-      if ( printed>=remain )
-	return SATIP_RTSP_ERROR;
-    }
-#else
+      pmt_ci[0] = 0;
+      satip_prepare_pmt_ci(cfg, pmt_ci, sizeof(pmt_ci));
 
+      /* pids get the rest of the URL, what does not fit follows in the next PLAY */
+      budget = rtsp->url_max - ( printed - strlen("PLAY ") ) - strlen(pmt_ci);
+      if ( budget < URL_PIDS_MIN )
+	budget = URL_PIDS_MIN;
 
-  printed += snprintf(buf+printed,remain-printed,"pids=all");
-  if ( printed>=remain )
-    return SATIP_RTSP_ERROR;
-#endif
+      printed += satip_prepare_pids(cfg, rtsp->txbuf+printed, budget, !tuning);
+
+      printed = tx_printf(rtsp,printed,"%s",pmt_ci);
+      if ( printed < 0 )
+	return SATIP_RTSP_ERROR;
+    }
 
-  satip_settle_config(rtsp->satip_config);
+  satip_settle_config(cfg);
 
-  printed += snprintf(buf+printed,remain-printed," RTSP/1.0\r\n"
+  printed = tx_printf(rtsp,printed," RTSP/1.0\r\n"
 		      "CSeq: %d\r\n"
 		      "%s%s%s",
-		      rtsp->cseq++,
+		      rtsp->conn->cseq++,
 		      rtsp->session[0] ? "Session: " : "",
 		      rtsp->session,
 		      rtsp->session[0] ? "\r\n\r\n" : "\r\n"
 		      );
 
-  if ( printed >= remain )
+  if ( printed < 0 )
     return SATIP_RTSP_ERROR;
 
   DEBUG(MSG_NET,">>play:\n%s\n<<\n",rtsp->txbuf);
 
-  if ( send(rtsp->sockfd,rtsp->txbuf,printed,0) != printed )
+  if ( send(rtsp->conn->sockfd,rtsp->txbuf,printed,0) != printed )
     return  SATIP_RTSP_ERROR ;
 
   //INFO(MSG_NET, "Send Play: Channel URI --> %s\n", buf);
@@ -494,7 +1475,7 @@ static int send_play(t_satip_rtsp* rtsp)
 
 
 
-static int connect_server(t_satip_rtsp* rtsp )
+static int connect_server(t_rtsp_conn* conn)
 {
   int sockfd,s;
   int flags;
@@ -508,7 +1489,7 @@ static int connect_server(t_satip_rtsp* rtsp )
   hints.ai_flags = 0;
   hints.ai_protocol = 0;
 
-  s = getaddrinfo(rtsp->host, rtsp->port, &hints, &result);
+  s = getaddrinfo(conn->host, conn->port, &hints, &result);
   if (s != 0) {
     ERROR(MSG_NET, "getaddrinfo: %s\n", gai_strerror(s));
     return(SATIP_RTSP_ERROR);
@@ -537,16 +1518,56 @@ static int connect_server(t_satip_rtsp* rtsp )
     return(SATIP_RTSP_ERROR);
   }
 
-  rtsp->sockfd = sockfd;
-  rtsp->addrinfo = rp;
+  conn->sockfd = sockfd;
+  conn->addrinfo = rp;
+
+  /* writable once connected */
+  if ( satip_evloop_add(evloop, sockfd, EPOLLOUT, conn_event, conn) )
+    return(SATIP_RTSP_ERROR);
 
   return(SATIP_RTSP_OK);
 }
 
 
-int satip_rtsp_socket(t_satip_rtsp* rtsp)
+/* next connection goes to the least loaded server of the pool */
+static void select_server(t_satip_rtsp* rtsp)
+{
+  t_satip_pool_server* server;
+  int i;
+
+  if ( rtsp->pool == NULL )
+    return;
+
+  server = satip_pool_select(rtsp->pool);
+  rtsp->pool_server = server;
+  if ( strcmp(server->host,rtsp->host)==0 && strcmp(server->port,rtsp->port)==0 )
+    return;
+
+  INFO(MSG_NET,"using server %s:%s\n",server->host,server->port);
+
+  free(rtsp->host);
+  free(rtsp->port);
+  rtsp->host=strdup(server->host);
+  rtsp->port=strdup(server->port);
+
+  /* what we know about frontends belongs to the previous server */
+  rtsp->sdp_valid = 0;
+  rtsp->sdp_time.tv_sec = 0;
+  rtsp->sdp_time.tv_nsec = 0;
+  rtsp->fe_used = 0;
+  for ( i=0; i<rtsp->fe_count; i++ )
+    rtsp->fe_busy[i] = 0;
+}
+
+void satip_rtsp_set_pool(t_satip_rtsp* rtsp, t_satip_pool* pool)
+{
+  rtsp->pool = pool;
+}
+
+/* connection sockets are registered with loop */
+void satip_rtsp_set_evloop(struct satip_evloop* loop)
 {
-  return rtsp->sockfd;
+  evloop = loop;
 }
 
 
@@ -555,172 +1576,440 @@ static void send_request(t_satip_rtsp* rtsp,
 			 t_rtsp_request request,
 			 int(*sendfunc)(t_satip_rtsp*))
 {
+  int cseq;
+
   /* stop supervision timer*/
-  polltimer_cancel(rtsp->timer_queue, rtsp->timer);
+  polltimer_cancel(rtsp->timer_queue, &rtsp->timer);
 
   rtsp->request = request;
   rtsp->status  = newstate;
 
-  if (request == RTSP_REQ_TEARDOWN && rtsp->streamid<0) return;
+  if (request == RTSP_REQ_TEARDOWN && rtsp->streamid<0)
+    {
+      if ( newstate == RTSP_IDLE )
+	enter_idle(rtsp);
+      return;
+    }
 
   /* send request and start timer */
-  if ( (*sendfunc)(rtsp) == SATIP_RTSP_OK )
-    rtsp->timer = polltimer_start( rtsp->timer_queue,
-				   timeout_reconnect,
-				   5000,(void*)rtsp);
+  cseq = rtsp->conn!=NULL ? rtsp->conn->cseq : 0;
+  rtsp->tx_tuning = ( request == RTSP_REQ_SETUP );
+  if ( rtsp->conn != NULL &&
+       rtsp->npending < MAX_PENDING &&
+       (*sendfunc)(rtsp) == SATIP_RTSP_OK )
+    {
+      t_rtsp_pending* pending=&rtsp->pending[rtsp->npending];
+
+      pending->cseq = cseq;
+      pending->request = request;
+      pending->tuning = rtsp->tx_tuning;
+      /* pipelined requests wait for their predecessors, no RTT sample */
+      pending->sample = ( conn_outstanding(rtsp->conn) == 0 );
+      clock_gettime(CLOCK_MONOTONIC,&pending->sent);
+      rtsp->npending++;
+
+      if ( rtsp->tx_tuning )
+	{
+	  rtsp->zap_requested = pending->sent;
+	  rtsp->zap_prefetch = rtsp->satip_config->prefetch;
+	  rtsp->zap_pending = 1;
+	  satip_trace(rtsp->satip_rtp->fd,
+		      request == RTSP_REQ_SETUP ? SATIP_TRACE_SETUP : SATIP_TRACE_PLAY, cseq);
+	}
+
+      rtsp->timer = polltimer_start( rtsp->timer_queue,
+				     timeout_reconnect,
+				     request_timeout(rtsp,rtsp->tx_tuning),
+				     (void*)rtsp);
+    }
   else
-    restart_connection(rtsp,0);
+    restart_connection(rtsp,server_failed(rtsp));
 }
 
 static void timeout_keep_alive(void* param)
+{
+  t_rtsp_conn* conn=(t_rtsp_conn*)param;
+  t_satip_rtsp* session[MAX_CONN_SESSIONS];
+  int n=conn->nsessions;
+  int i;
+
+  DEBUG(MSG_NET,"keep_alive for %d session(s)\n",n);
+
+  /* timer expired, clear it */
+  conn->keep_alive_timer = NULL;
+
+  /* a failing send may restart sessions */
+  memcpy(session, conn->session, n*sizeof(t_satip_rtsp*));
+  conn->hold++;
+
+  for ( i=0; i<n; i++ )
+    if ( session[i]->conn == conn &&
+	 session[i]->status == RTSP_READY &&
+	 session[i]->request == RTSP_REQ_NONE &&
+	 !rtcp_kept_alive(session[i]) )
+      send_request(session[i], RTSP_READY, RTSP_REQ_OPTIONS, send_options);
+
+  conn_release(conn);
+}
+
+/* one timer per connection refreshes all its sessions, earliest due wins */
+static void schedule_keep_alive(t_satip_rtsp* rtsp)
+{
+  t_rtsp_conn* conn=rtsp->conn;
+  struct timespec now;
+  int msec=keep_alive_timeout(rtsp);
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+
+  if ( conn->keep_alive_timer != NULL &&
+       (conn->keep_alive_at.tv_sec-now.tv_sec)*1000 +
+       (conn->keep_alive_at.tv_nsec-now.tv_nsec)/1000000 <= msec )
+    return;
+
+  polltimer_cancel(conn->timer_queue, &conn->keep_alive_timer);
+  conn->keep_alive_timer = polltimer_start( conn->timer_queue,
+					    timeout_keep_alive,
+					    msec,(void*)conn);
+
+  conn->keep_alive_at.tv_sec = now.tv_sec + msec/1000;
+  conn->keep_alive_at.tv_nsec = now.tv_nsec + (msec%1000)*1000000;
+  if ( conn->keep_alive_at.tv_nsec >= 1000000000 )
+    {
+      conn->keep_alive_at.tv_sec++;
+      conn->keep_alive_at.tv_nsec -= 1000000000;
+    }
+}
+
+static void timeout_warm_refresh(void* param)
 {
   t_satip_rtsp* rtsp=(t_satip_rtsp*)param;
 
-  DEBUG(MSG_NET,"keep_alive\n");
+  DEBUG(MSG_NET,"warm connection refresh\n");
 
   /* timer expired, clear it */
   rtsp->timer = NULL;
 
-  send_request(rtsp, RTSP_READY, RTSP_REQ_OPTIONS, send_options);
+  /* probing refreshes the server state as well */
+  if ( rtsp->probe_interval > 0 )
+    send_request(rtsp, RTSP_IDLE, RTSP_REQ_DESCRIBE, send_describe);
+  else
+    send_request(rtsp, RTSP_IDLE, RTSP_REQ_OPTIONS, send_options);
+}
+
+static void enter_idle(t_satip_rtsp* rtsp)
+{
+  polltimer_cancel(rtsp->timer_queue, &rtsp->timer);
+
+  rtsp->status = RTSP_IDLE;
+  rtsp->request = RTSP_REQ_NONE;
+
+  /* verify connection periodically until tuning starts */
+  rtsp->timer = polltimer_start( rtsp->timer_queue,
+				 timeout_warm_refresh,
+				 rtsp->warm_interval,(void*)rtsp);
+}
 
+/* SETUP, preceded by DESCRIBE if the cached server state is too old */
+static void start_setup(t_satip_rtsp* rtsp)
+{
+  if ( probe_due(rtsp) )
+    send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_DESCRIBE, send_describe);
+  else
+    send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_SETUP, send_setup);
 }
 
+/* non-200 DESCRIBE leaves the server state unknown, but is no failure */
+static int describe_failed(t_satip_rtsp* rtsp, int ret)
+{
+  if ( ret!=SATIP_RTSP_ERROR || rtsp->request != RTSP_REQ_DESCRIBE ||
+       rtsp->status_code == 0 )
+    return 0;
+
+  DEBUG(MSG_NET,"DESCRIBE failed with %d\n",rtsp->status_code);
+
+  if ( rtsp->status_code == RTSP_STATUS_NOT_FOUND )
+    {
+      /* no streams at all */
+      rtsp->sdp.nstreams = 0;
+      rtsp->fe_used = 0;
+    }
+
+  return 1;
+}
 
+void satip_rtsp_set_warm(t_satip_rtsp* rtsp, int interval)
+{
+  rtsp->warm_interval = interval;
+}
 
-void satip_rtsp_pollevents(t_satip_rtsp* rtsp, short events)
+static void timeout_linger(void* param)
 {
-  if ( events & POLLHUP )
+  t_satip_rtsp* rtsp=(t_satip_rtsp*)param;
+
+  /* timer expired, clear it */
+  rtsp->linger_timer = NULL;
+
+  /* not reopened in time, close it for real */
+  if ( !satip_valid_config(rtsp->satip_config) )
     {
-      /* connection rejected (port closed) */
-      DEBUG(MSG_NET,"connection rejected\n");
-      restart_connection(rtsp,0);
-      return;
+      DEBUG(MSG_NET,"linger expired\n");
+      satip_close(rtsp->satip_config);
+      satip_rtsp_check_update(rtsp, 0);
     }
+}
+
+void satip_rtsp_set_linger(t_satip_rtsp* rtsp, int linger)
+{
+  rtsp->linger = linger;
+}
+
+void satip_rtsp_set_rtcp_keepalive(t_satip_rtsp* rtsp, int enable)
+{
+  rtsp->rtcp_keepalive = enable;
+}
+
+void satip_rtsp_set_url_max(t_satip_rtsp* rtsp, int url_max)
+{
+  rtsp->url_max_cfg = url_max > URL_MAX_MIN ? url_max : URL_MAX_MIN;
+  rtsp->url_max = rtsp->url_max_cfg;
+}
+
 
+
+static void process_response(t_satip_rtsp* rtsp, int ret)
+{
   switch ( rtsp->status )
     {
-    case RTSP_NOCONFIG:
-      break;
+    case RTSP_ESTABLISHING:
+      if ( ret==SATIP_RTSP_ERROR &&
+	   rtsp->request == RTSP_REQ_SETUP && tuner_busy(rtsp) )
+	{
+	  /* no free tuner, try the next frontend right away */
+	  if ( rtsp->fe_current>=0 )
+	    {
+	      rtsp->fe_busy[rtsp->fe_current]++;
+	      DEBUG(MSG_NET,"fe=%d busy (%d)\n",
+		    rtsp->fe_list[rtsp->fe_current],
+		    rtsp->fe_busy[rtsp->fe_current]);
+	    }
 
-    case RTSP_CONNECTING:
-      if ( events & POLLOUT )
+	  /* probed state is outdated, correct it */
+	  if ( rtsp->sdp_valid && rtsp->satip_config->frontend>0 &&
+	       rtsp->satip_config->frontend<=SATIP_SDP_MAX_FE )
+	    rtsp->fe_used |= SATIP_SDP_FE_BIT(rtsp->satip_config->frontend);
+
+	  if ( select_frontend(rtsp)>=0 || auto_frontend(rtsp)>0 )
+	    send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_SETUP, send_setup);
+	  else
+	    {
+	      DEBUG(MSG_NET,"all frontends busy\n");
+	      if ( rtsp->pool != NULL )
+		{
+		  /* try another server of the pool */
+		  satip_pool_busy(rtsp->pool_server);
+		  restart_connection(rtsp,satip_pool_available(rtsp->pool));
+		}
+	      else
+		restart_connection(rtsp,0);
+	    }
+	}
+      else if ( describe_failed(rtsp, ret) )
 	{
-	  DEBUG(MSG_NET,"connected -> establishing\n");
- 	  send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_OPTIONS, send_options);
+	  /* tune anyway */
+	  send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_SETUP, send_setup);
 	}
-      break;
-
-    case RTSP_ESTABLISHING:
-      if ( events & POLLIN )
+      else if ( ret==SATIP_RTSP_ERROR )
 	{
-	  int ret=read_response(rtsp);
-
-	  if ( ret==SATIP_RTSP_ERROR )
+	  if ( server_failed(rtsp) )
 	    {
-	      DEBUG(MSG_NET,"peer closed, waiting for timeout...\n");
-              sleep(65);
+	      DEBUG(MSG_NET,"peer closed, trying next server\n");
 	      restart_connection(rtsp,1);
+	      break;
 	    }
-	  else if ( ret==SATIP_RTSP_COMPLETE )
+	  DEBUG(MSG_NET,"peer closed, waiting for timeout...\n");
+	  restart_later(rtsp,SESSION_EXPIRE_DELAY);
+	}
+      else if ( ret==SATIP_RTSP_COMPLETE )
+	{
+	  DEBUG(MSG_NET,"response complete\n");
+	  if ( rtsp->request == RTSP_REQ_OPTIONS &&
+	       !satip_valid_config(rtsp->satip_config) )
 	    {
-	      DEBUG(MSG_NET,"response complete\n");
-	      if ( rtsp->request == RTSP_REQ_OPTIONS )
-		send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_SETUP, send_setup);
-	      else if (rtsp->request == RTSP_REQ_SETUP )
-		send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
-	      else
-		{
-		  DEBUG(MSG_NET,"bug..\n");
-		  restart_connection(rtsp,0);
-		}
+	      DEBUG(MSG_NET,"established -> idle\n");
+	      enter_idle(rtsp);
+	    }
+	  else if ( rtsp->request == RTSP_REQ_OPTIONS )
+	    start_setup(rtsp);
+	  else if ( rtsp->request == RTSP_REQ_DESCRIBE )
+	    send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_SETUP, send_setup);
+	  else if (rtsp->request == RTSP_REQ_SETUP )
+	    {
+	      /* new session after a reconnect needs everything again */
+	      satip_force_tuning(rtsp->satip_config);
+	      send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
+	    }
+	  else
+	    {
+	      DEBUG(MSG_NET,"bug..\n");
+	      restart_connection(rtsp,0);
 	    }
-	  /* SATIP_RTSP_OK: response not yet complete, wait for more data.. */
+	}
+      break;
 
+    case RTSP_IDLE:
+      if ( describe_failed(rtsp, ret) )
+	ret = SATIP_RTSP_COMPLETE;
+
+      if ( ret==SATIP_RTSP_ERROR )
+	{
+	  /* server dropped the idle connection, open a new one */
+	  DEBUG(MSG_NET,"idle connection lost\n");
+	  restart_connection(rtsp,1);
+	}
+      else if ( ret==SATIP_RTSP_COMPLETE )
+	{
+	  if ( satip_valid_config(rtsp->satip_config) )
+	    start_setup(rtsp);
+	  else
+	    enter_idle(rtsp);
 	}
       break;
 
     case RTSP_READY:
-      if ( events & POLLIN )
+      if ( ret==SATIP_RTSP_ERROR && rtsp->request == RTSP_REQ_PLAY &&
+	   rtsp->status_code == RTSP_STATUS_URI_TOO_LONG &&
+	   rtsp->url_max > URL_MAX_MIN )
 	{
-	  int ret=read_response(rtsp);
-
-	  if ( ret==SATIP_RTSP_ERROR )
-	    {
-	      restart_connection(rtsp,0);
-	    }
-	  else if ( ret==SATIP_RTSP_COMPLETE )
-	    {
-	      polltimer_cancel(rtsp->timer_queue,rtsp->timer);
-
-	      rtsp->request=RTSP_REQ_NONE;
+	  /* server takes shorter URLs only, send everything again in smaller parts */
+	  rtsp->url_max = rtsp->url_max/2 > URL_MAX_MIN ? rtsp->url_max/2 : URL_MAX_MIN;
+	  INFO(MSG_NET,"URL too long for server, limit now %d\n",rtsp->url_max);
+	  satip_force_tuning(rtsp->satip_config);
+	  send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
+	}
+      else if ( ret==SATIP_RTSP_ERROR )
+	{
+	  /* connection lost: migrate the session if the pool allows */
+	  restart_connection(rtsp, rtsp->status_code==0 && server_failed(rtsp));
+	}
+      else if ( ret==SATIP_RTSP_COMPLETE )
+	{
+	  polltimer_cancel(rtsp->timer_queue,&rtsp->timer);
 
-	      satip_rtsp_check_update(rtsp, 0);
+	  /* pipelined requests may still be pending */
+	  rtsp->request=pending_request(rtsp);
 
-	      if ( rtsp->request == RTSP_REQ_NONE )
+	  satip_rtsp_check_update(rtsp, 0);
 
-		rtsp->timer = polltimer_start( rtsp->timer_queue,
-					       timeout_keep_alive,
-					       (rtsp->timeout-5)*1000,(void*)rtsp);
+	  if ( rtsp->request == RTSP_REQ_NONE )
+	    {
+	      if ( rtsp->conn != NULL )
+		schedule_keep_alive(rtsp);
 	    }
-	  /* SATIP_RTSP_OK: response not yet complete, wait for more data.. */
+	  else if ( rtsp->timer == NULL )
+	    rtsp->timer = polltimer_start( rtsp->timer_queue,
+					   timeout_reconnect,
+					   request_timeout(rtsp,rtsp->pending[0].tuning),
+					   (void*)rtsp);
 	}
       break;
 
     default:
       break;
     }
-
-
 }
 
 
-
-short satip_rtsp_pollflags(t_satip_rtsp* rtsp)
+static void conn_event(int fd, unsigned int events, void* param)
 {
-  short flags=0;
+  t_rtsp_conn* conn=(t_rtsp_conn*)param;
+  t_satip_rtsp* session[MAX_CONN_SESSIONS];
+  t_satip_rtsp* target;
+  int i,n,ret;
 
-  switch ( rtsp->status )
+  if ( events & EPOLLHUP )
     {
-    case RTSP_NOCONFIG:
-      break;
-
-    case RTSP_CONNECTING:
-      flags = POLLHUP | POLLOUT;
-      break;
+      /* connection rejected (port closed) */
+      DEBUG(MSG_NET,"connection rejected\n");
+      conn_failed(conn,1);
+      return;
+    }
 
-    case RTSP_ESTABLISHING:
-    case RTSP_READY:
-      flags = POLLHUP | POLLIN;
-      break;
+  /* sessions may detach while the connection is in use */
+  conn->hold++;
 
-    default:
-      break;
+  if ( (events & EPOLLOUT) && !conn->connected )
+    {
+      DEBUG(MSG_NET,"connected -> establishing\n");
+      conn->connected = 1;
+      satip_evloop_modify(evloop, fd, EPOLLIN);
+
+      n = conn->nsessions;
+      memcpy(session, conn->session, n*sizeof(t_satip_rtsp*));
+      for ( i=0; i<n; i++ )
+	if ( session[i]->conn == conn && session[i]->status == RTSP_CONNECTING )
+	  send_request(session[i], RTSP_ESTABLISHING, RTSP_REQ_OPTIONS, send_options);
     }
 
-  return flags;
+  if ( (events & EPOLLIN) && conn->connected )
+    {
+      if ( receive_data(conn) == SATIP_RTSP_ERROR )
+	conn_failed(conn,0);
+      else
+	/* several responses, maybe of several sessions, may have arrived at once */
+	while ( conn->nsessions > 0 &&
+		(ret=read_response(conn,&target)) != SATIP_RTSP_OK )
+	  {
+	    if ( target == NULL )
+	      {
+		/* garbage from server */
+		conn_failed(conn,0);
+		break;
+	      }
+	    process_response(target, ret);
+	  }
+
+      /* SATIP_RTSP_OK: response not yet complete, wait for more data.. */
+    }
 
+  conn_release(conn);
 }
 
 
 
-
 void  satip_rtsp_check_update(struct satip_rtsp*  rtsp, int abort)
 {
   if (abort) rtsp->status = RTSP_ABORTING;
   switch ( rtsp->status )
     {
     case RTSP_NOCONFIG:
-      if ( satip_valid_config(rtsp->satip_config) &&
+      if ( ( satip_valid_config(rtsp->satip_config) ||
+	     rtsp->warm_interval > 0 ) &&
 	   rtsp->timer == NULL )
 	{
+	  select_server(rtsp);
+
 	  DEBUG(MSG_NET,"connecting...\n");
+	  rtsp->counters.connects++;
 	  rtsp->timer = polltimer_start( rtsp->timer_queue,
 					 timeout_reconnect,
-					 5000,(void*)rtsp);
+					 request_timeout(rtsp,RTT_CONTROL),
+					 (void*)rtsp);
 
-	  if ( connect_server(rtsp) == SATIP_RTSP_ERROR )
-	    /* network down, DNS error,... */
-	    DEBUG(MSG_NET,"connect failed, waiting...\n");
+	  if ( conn_attach(rtsp)->connected )
+	    /* connection shared with other sessions */
+	    send_request(rtsp, RTSP_ESTABLISHING, RTSP_REQ_OPTIONS, send_options);
+	  else if ( rtsp->conn->sockfd >= 0 )
+	    rtsp->status = RTSP_CONNECTING;
+	  else if ( connect_server(rtsp->conn) == SATIP_RTSP_ERROR )
+	    {
+	      conn_detach(rtsp);
+
+	      /* network down, DNS error,... */
+	      if ( server_failed(rtsp) )
+		restart_connection(rtsp,1);
+	      else
+		DEBUG(MSG_NET,"connect failed, waiting...\n");
+	    }
 	  else
 	    rtsp->status = RTSP_CONNECTING;
 	}
@@ -731,15 +2020,54 @@ void  satip_rtsp_check_update(struct satip_rtsp*  rtsp, int abort)
 	{
 	  if ( satip_tuning_required(rtsp->satip_config) ||
 	       satip_pid_update_required(rtsp->satip_config))
-	    send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
+	    {
+	      if ( rtsp->lingering )
+		{
+		  /* reopened within linger time, resume session */
+		  DEBUG(MSG_NET,"resume lingering session\n");
+		  polltimer_cancel(rtsp->timer_queue, &rtsp->linger_timer);
+		  rtsp->lingering = 0;
+		}
+	      send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
+	    }
 
-	  if ( satip_close_requested(rtsp->satip_config) )
+	  if ( satip_close_requested(rtsp->satip_config) &&
+	       rtsp->linger > 0 && !rtsp->lingering )
+	  {
+	    DEBUG(MSG_NET,"lingering for %d ms\n",rtsp->linger);
+	    send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play_none);
+	    rtsp->lingering = 1;
+	    rtsp->linger_timer = polltimer_start( rtsp->timer_queue,
+						  timeout_linger,
+						  rtsp->linger,(void*)rtsp);
+	    rtsp->satip_config->status = SATIPCFG_INCOMPLETE;
+	  }
+	  else if ( satip_close_requested(rtsp->satip_config) )
 	  {
-	    send_request(rtsp, RTSP_NOCONFIG, RTSP_REQ_TEARDOWN, send_teardown);
-            reset_connection(rtsp);
+	    rtsp->lingering = 0;
+	    if ( rtsp->warm_interval > 0 )
+	      /* keep connection, response returns to idle */
+	      send_request(rtsp, RTSP_IDLE, RTSP_REQ_TEARDOWN, send_teardown);
+	    else
+	      {
+		send_request(rtsp, RTSP_NOCONFIG, RTSP_REQ_TEARDOWN, send_teardown);
+		reset_connection(rtsp);
+	      }
 	    rtsp->satip_config->status = SATIPCFG_INCOMPLETE;
 	  }
         }
+      else if ( rtsp->request == RTSP_REQ_PLAY &&
+		rtsp->npending < MAX_PENDING &&
+		satip_pid_update_required(rtsp->satip_config) )
+	/* pipeline pid updates behind the pending PLAY */
+	send_request(rtsp, RTSP_READY, RTSP_REQ_PLAY, send_play);
+      break;
+
+    case RTSP_IDLE:
+      /* tuning started, use warm connection right away */
+      if ( rtsp->request == RTSP_REQ_NONE &&
+	   satip_valid_config(rtsp->satip_config) )
+	start_setup(rtsp);
       break;
 
     case RTSP_ABORTING:
@@ -755,3 +2083,13 @@ void  satip_rtsp_check_update(struct satip_rtsp*  rtsp, int abort)
     }
 
 }
+
+const t_satip_rtsp_counters* satip_rtsp_get_counters(t_satip_rtsp* rtsp)
+{
+  return &rtsp->counters;
+}
+
+const char* satip_rtsp_request_name(int request)
+{
+  return request >= 0 && request < SATIP_RTSP_REQUEST_TYPES ? request_names[request] : "NONE";
+}
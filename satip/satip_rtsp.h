@@ -23,6 +23,8 @@
 #include "polltimer.h"
 #include "satip_rtp.h"
 #include "satip_config.h"
+#include "satip_pool.h"
+#include "satip_evloop.h"
 
 
 struct satip_rtsp;
@@ -31,16 +33,42 @@ struct satip_rtsp;
 #define  SATIP_RTSP_ERROR      1
 #define  SATIP_RTSP_COMPLETE   2
 
+/* default limit of request URLs, longer pid lists are split */
+#define  SATIP_RTSP_URL_MAX    1024
+
+/* results of requests by type, OPTIONS SETUP PLAY TEARDOWN DESCRIBE */
+#define  SATIP_RTSP_REQUEST_TYPES 5
+#define  SATIP_RTSP_RESULT_OK     0   /* 200 */
+#define  SATIP_RTSP_RESULT_ERROR  1   /* other status */
+#define  SATIP_RTSP_RESULT_NONE   2   /* no response, timeout or connection lost */
+
+typedef struct satip_rtsp_counters
+{
+  unsigned long requests[SATIP_RTSP_REQUEST_TYPES][3];
+  unsigned long connects;  /* connection attempts or attaches to a shared one */
+  unsigned long timeouts;
+} t_satip_rtsp_counters;
+
 struct satip_rtsp* satip_rtsp_new(t_satip_config* satip_config, 
-				  struct polltimer** timer_queue,
+				  struct polltimer_queue* timer_queue,
 				  const char* host, 
 				  const char* port,
 				  t_satip_rtp *satip_rtp );
 
-int   satip_rtsp_socket(struct satip_rtsp* rtsp);
-void  satip_rtsp_pollevents(struct satip_rtsp* rtsp, short events);
-short satip_rtsp_pollflags(struct satip_rtsp* rtsp);
+void  satip_rtsp_set_warm(struct satip_rtsp* rtsp, int interval);
+void  satip_rtsp_set_linger(struct satip_rtsp* rtsp, int linger);
+void  satip_rtsp_set_rtcp_keepalive(struct satip_rtsp* rtsp, int enable);
+void  satip_rtsp_set_frontends(struct satip_rtsp* rtsp, int* fe_list, int count);
+void  satip_rtsp_set_timeouts(struct satip_rtsp* rtsp, int rto_min, int rto_max);
+void  satip_rtsp_set_probe(struct satip_rtsp* rtsp, int interval);
+void  satip_rtsp_set_pool(struct satip_rtsp* rtsp, t_satip_pool* pool);
+void  satip_rtsp_set_url_max(struct satip_rtsp* rtsp, int url_max);
+
+void  satip_rtsp_set_evloop(struct satip_evloop* loop);
 void  satip_rtsp_check_update(struct satip_rtsp*  rtsp, int abort);
 
+const t_satip_rtsp_counters* satip_rtsp_get_counters(struct satip_rtsp* rtsp);
+const char* satip_rtsp_request_name(int request);
+
 #endif
 
@@ -0,0 +1,246 @@
+/*
+ * satip: thread placement, CPU affinity, scheduling and NUMA node
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "satip_sched.h"
+
+#include "log.h"
+
+static t_satip_sched_stats threads[SATIP_SCHED_MAX_THREADS];
+static int thread_count = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct
+{
+  const char* name;
+  int policy;
+} policies[] =
+  {
+    { "fifo",  SCHED_FIFO },
+    { "rr",    SCHED_RR },
+    { "other", SCHED_OTHER },
+    { "batch", SCHED_BATCH },
+    { "idle",  SCHED_IDLE },
+  };
+
+
+void satip_sched_init(t_satip_sched* sched)
+{
+  sched->ncpus = 0;
+  memset(sched->cpus, 0, sizeof(sched->cpus));
+  sched->policy = -1;
+  sched->priority = -1;
+  sched->node = -1;
+}
+
+/* "0-3,8" */
+static int parse_cpus(const char* str, int len, t_satip_sched* sched)
+{
+  const char* end=str+len;
+  char* next;
+  long from,to;
+
+  while ( str < end )
+    {
+      from = to = strtol(str, &next, 10);
+      if ( next == str || from < 0 )
+	return -1;
+      if ( *next == '-' )
+	{
+	  str = next+1;
+	  to = strtol(str, &next, 10);
+	  if ( next == str || to < from )
+	    return -1;
+	}
+      if ( to >= SATIP_SCHED_MAX_CPUS )
+	return -1;
+
+      for ( ; from<=to; from++ )
+	{
+	  sched->cpus[from/8] |= 1 << (from%8);
+	  sched->ncpus++;
+	}
+
+      str = next;
+      if ( str < end && *str++ != ',' )
+	return -1;
+    }
+
+  return 0;
+}
+
+int satip_sched_parse(const char* spec, t_satip_sched* sched)
+{
+  const char* field[4];
+  int len[4];
+  unsigned int i;
+  int n;
+
+  satip_sched_init(sched);
+
+  for ( n=0; n<4; n++ )
+    {
+      field[n] = spec;
+      len[n] = strcspn(spec, ":");
+      spec += len[n];
+      if ( *spec == 0 )
+	break;
+      spec++;
+    }
+  if ( n == 4 )
+    return -1;
+
+  if ( len[0] > 0 && parse_cpus(field[0], len[0], sched) )
+    return -1;
+
+  if ( n >= 1 && len[1] > 0 )
+    {
+      for ( i=0; i<sizeof(policies)/sizeof(policies[0]); i++ )
+	if ( (int)strlen(policies[i].name) == len[1] &&
+	     strncmp(field[1], policies[i].name, len[1]) == 0 )
+	  break;
+      if ( i == sizeof(policies)/sizeof(policies[0]) )
+	return -1;
+      sched->policy = policies[i].policy;
+    }
+
+  if ( n >= 2 && len[2] > 0 )
+    sched->priority = atoi(field[2]);
+
+  if ( n >= 3 && len[3] > 0 )
+    sched->node = atoi(field[3]);
+
+  return 0;
+}
+
+t_satip_sched_stats* satip_sched_apply(const t_satip_sched* sched, const char* name, int prio_offset)
+{
+  t_satip_sched_stats* stats;
+  struct sched_param schedp;
+  int policy = SCHED_FIFO;
+
+  if ( sched != NULL && sched->policy >= 0 )
+    policy = sched->policy;
+
+  memset(&schedp, 0, sizeof(schedp));
+  if ( policy == SCHED_FIFO || policy == SCHED_RR )
+    schedp.sched_priority = ( sched != NULL && sched->priority >= 0 ) ?
+      sched->priority : sched_get_priority_min(policy) + prio_offset;
+
+  if ( sched_setscheduler(0, policy, &schedp) )
+    DEBUG(MSG_MAIN,"%s: No realtime scheduling\n",name);
+  else if ( policy == SCHED_FIFO || policy == SCHED_RR )
+    DEBUG(MSG_MAIN,"%s: Realtime scheduling enabled at prio %d\n",name,schedp.sched_priority);
+
+  if ( sched != NULL && sched->ncpus > 0 )
+    {
+      cpu_set_t cpus;
+      int cpu;
+
+      CPU_ZERO(&cpus);
+      for ( cpu=0; cpu<SATIP_SCHED_MAX_CPUS && cpu<CPU_SETSIZE; cpu++ )
+	if ( sched->cpus[cpu/8] & (1 << (cpu%8)) )
+	  CPU_SET(cpu, &cpus);
+
+      if ( sched_setaffinity(0, sizeof(cpus), &cpus) )
+	ERROR(MSG_MAIN,"%s: cannot set CPU affinity: %s\n",name,strerror(errno));
+      else
+	DEBUG(MSG_MAIN,"%s: bound to %d CPU%s\n",name,sched->ncpus,sched->ncpus>1?"s":"");
+    }
+
+  pthread_mutex_lock(&threads_lock);
+  stats = &threads[thread_count < SATIP_SCHED_MAX_THREADS ? thread_count++ : SATIP_SCHED_MAX_THREADS-1];
+  pthread_mutex_unlock(&threads_lock);
+
+  snprintf(stats->name, sizeof(stats->name), "%s", name);
+  stats->tid = syscall(SYS_gettid);
+  stats->cpu = -1;
+  stats->wakeups = 0;
+  stats->migrations = 0;
+  if ( pthread_getcpuclockid(pthread_self(), &stats->cpuclock) )
+    stats->cpuclock = (clockid_t)-1;
+
+  return stats;
+}
+
+void* satip_sched_alloc(const t_satip_sched* sched, size_t size)
+{
+  unsigned long mask;
+  void* buf;
+
+  if ( sched == NULL || sched->node < 0 )
+    return malloc(size);
+
+  buf = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if ( buf == MAP_FAILED )
+    return NULL;
+
+  /* pages may be populated already by mlockall, move them */
+  mask = 1UL << sched->node;
+  if ( syscall(SYS_mbind, buf, size, MPOL_BIND, &mask, sizeof(mask)*8, MPOL_MF_MOVE) )
+    ERROR(MSG_MAIN,"cannot bind RX buffer to node %d: %s\n",sched->node,strerror(errno));
+
+  memset(buf, 0, size);
+  return buf;
+}
+
+void satip_sched_wakeup(t_satip_sched_stats* stats)
+{
+  int cpu = sched_getcpu();
+
+  if ( cpu != stats->cpu )
+    {
+      if ( stats->cpu >= 0 )
+	stats->migrations++;
+      stats->cpu = cpu;
+    }
+  stats->wakeups++;
+}
+
+void satip_sched_log(void)
+{
+  int i;
+
+  for ( i=0; i<thread_count; i++ )
+    INFO(MSG_MAIN,"thread %s tid %d: cpu %d wakeups %lu migrations %lu\n",
+	 threads[i].name, (int)threads[i].tid, threads[i].cpu,
+	 threads[i].wakeups, threads[i].migrations);
+}
+
+const t_satip_sched_stats* satip_sched_thread(int index)
+{
+  int count;
+
+  pthread_mutex_lock(&threads_lock);
+  count = thread_count;
+  pthread_mutex_unlock(&threads_lock);
+
+  return index < count ? &threads[index] : NULL;
+}
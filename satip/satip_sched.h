@@ -0,0 +1,68 @@
+/*
+ * satip: thread placement, CPU affinity, scheduling and NUMA node
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_SCHED_H
+#define _SATIP_SCHED_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define SATIP_SCHED_MAX_THREADS 32
+#define SATIP_SCHED_MAX_CPUS 1024
+
+/* "cpulist:policy:priority:node", empty fields keep the defaults */
+typedef struct satip_sched
+{
+  int ncpus;          /* 0 = no affinity */
+  unsigned char cpus[SATIP_SCHED_MAX_CPUS/8];
+  int policy;         /* -1 = SCHED_FIFO */
+  int priority;       /* -1 = minimum of policy + offset given on apply */
+  int node;           /* -1 = no NUMA binding */
+} t_satip_sched;
+
+/* per thread, to verify the placement */
+typedef struct satip_sched_stats
+{
+  char name[16];
+  pid_t tid;
+  int cpu;                    /* last seen on */
+  unsigned long wakeups;
+  unsigned long migrations;   /* wakeups on another CPU than before */
+  clockid_t cpuclock;         /* CPU time of the thread for others, -1 = none */
+} t_satip_sched_stats;
+
+void satip_sched_init(t_satip_sched* sched);
+int satip_sched_parse(const char* spec, t_satip_sched* sched);
+
+/* place the calling thread, registered as name for statistics */
+t_satip_sched_stats* satip_sched_apply(const t_satip_sched* sched, const char* name, int prio_offset);
+
+/* RX buffer on the thread's node */
+void* satip_sched_alloc(const t_satip_sched* sched, size_t size);
+
+void satip_sched_log(void);
+
+/* registered threads by index, NULL past the last */
+const t_satip_sched_stats* satip_sched_thread(int index);
+
+/* once per loop iteration of the thread */
+void satip_sched_wakeup(t_satip_sched_stats* stats);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * satip: server capabilities and stream state from DESCRIBE
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "satip_sdp.h"
+#include "vtuner.h"
+#include "log.h"
+
+#ifndef SYS_DVBT2
+#define SYS_DVBT2 16
+#endif
+
+#ifndef SYS_DVBC2
+#define SYS_DVBC2 19
+#endif
+
+t_satip_msys satip_sdp_msys_by_name(const char* name)
+{
+  if ( strncasecmp(name,"dvbs",4)==0 )
+    return SATIP_MSYS_SAT;
+  if ( strncasecmp(name,"dvbt",4)==0 )
+    return SATIP_MSYS_TER;
+  if ( strncasecmp(name,"dvbc",4)==0 )
+    return SATIP_MSYS_CAB;
+
+  return SATIP_MSYS_UNKNOWN;
+}
+
+/*
+ * "ver=1.0;src=1;tuner=fe,level,lock,quality,freq,pol|bw,msys,...;pids=..."
+ */
+static void parse_fmtp(const char* line, t_satip_sdp_stream* stream)
+{
+  const char* p=strstr(line,"tuner=");
+  int field;
+
+  if ( p==NULL )
+    return;
+
+  p+=6;
+  stream->frontend = atoi(p);
+
+  for ( field=0; field<6; field++ )
+    {
+      p += strcspn(p,",;\r\n");
+      if ( *p!=',' )
+	return;
+      p++;
+    }
+
+  stream->msys = satip_sdp_msys_by_name(p);
+}
+
+int satip_sdp_parse(const char* sdp, t_satip_sdp* info)
+{
+  const char* line=sdp;
+  t_satip_sdp_stream* stream=NULL;
+  int tuners[SATIP_MSYS_COUNT];
+
+  info->nstreams = 0;
+
+  while ( line!=NULL && *line )
+    {
+      if ( strncmp(line,"s=SatIPServer:1 ",16)==0 )
+	{
+	  memset(tuners,0,sizeof(tuners));
+	  if ( sscanf(line+16,"%d,%d,%d",
+		      &tuners[SATIP_MSYS_SAT],
+		      &tuners[SATIP_MSYS_TER],
+		      &tuners[SATIP_MSYS_CAB]) >= 1 )
+	    memcpy(info->tuners,tuners,sizeof(tuners));
+	}
+      else if ( strncmp(line,"m=",2)==0 )
+	{
+	  if ( info->nstreams < SATIP_SDP_MAX_STREAMS )
+	    {
+	      stream = &info->stream[info->nstreams++];
+	      stream->streamid = -1;
+	      stream->frontend = 0;
+	      stream->msys = SATIP_MSYS_UNKNOWN;
+	      stream->active = 0;
+	    }
+	  else
+	    stream = NULL;
+	}
+      else if ( stream!=NULL )
+	{
+	  if ( strncmp(line,"a=control:stream=",17)==0 )
+	    stream->streamid = atoi(line+17);
+	  else if ( strncmp(line,"a=fmtp:",7)==0 )
+	    parse_fmtp(line,stream);
+	  else if ( strncmp(line,"a=sendonly",10)==0 )
+	    stream->active = 1;
+	}
+
+      line = strchr(line,'\n');
+      if ( line!=NULL )
+	line++;
+    }
+
+  return info->nstreams;
+}
+
+/*
+ * combined tuners may be listed for several systems of a family,
+ * e.g. "DVBT-2,DVBT2-2", so the family takes the largest count
+ */
+int satip_sdp_parse_caps(const char* caps, int* tuners)
+{
+  const char* p=caps;
+  int found=0;
+
+  memset(tuners,0,SATIP_MSYS_COUNT*sizeof(int));
+
+  while ( *p )
+    {
+      t_satip_msys msys=satip_sdp_msys_by_name(p);
+      const char* count=p+strcspn(p,"-,");
+
+      if ( msys!=SATIP_MSYS_UNKNOWN && *count=='-' &&
+	   atoi(count+1) > tuners[msys] )
+	{
+	  tuners[msys] = atoi(count+1);
+	  found++;
+	}
+
+      p += strcspn(p,",");
+      if ( *p==',' )
+	p++;
+    }
+
+  return found;
+}
+
+t_satip_msys satip_sdp_msys(unsigned int delsys)
+{
+  switch ( delsys )
+    {
+    case SYS_DVBS:
+    case SYS_DVBS2:
+      return SATIP_MSYS_SAT;
+
+    case SYS_DVBT:
+    case SYS_DVBT2:
+      return SATIP_MSYS_TER;
+
+    case SYS_DVBC_ANNEX_A:
+    case SYS_DVBC_ANNEX_B:
+    case SYS_DVBC2:
+      return SATIP_MSYS_CAB;
+
+    default:
+      return SATIP_MSYS_UNKNOWN;
+    }
+}
+
+/*
+ * system a stream reports for the frontend wins, otherwise frontends
+ * are assumed to be numbered in the order of "S2,T,C"
+ */
+t_satip_msys satip_sdp_frontend_msys(t_satip_sdp* info, int frontend)
+{
+  int i;
+  int first=1;
+
+  for ( i=0; i<info->nstreams; i++ )
+    if ( info->stream[i].frontend == frontend &&
+	 info->stream[i].msys != SATIP_MSYS_UNKNOWN )
+      return info->stream[i].msys;
+
+  for ( i=0; i<SATIP_MSYS_COUNT; i++ )
+    {
+      if ( frontend < first+info->tuners[i] )
+	return frontend >= first ? (t_satip_msys)i : SATIP_MSYS_UNKNOWN;
+      first += info->tuners[i];
+    }
+
+  return SATIP_MSYS_UNKNOWN;
+}
+
+unsigned int satip_sdp_used(t_satip_sdp* info, int own_streamid)
+{
+  unsigned int used=0;
+  int i;
+
+  for ( i=0; i<info->nstreams; i++ )
+    {
+      t_satip_sdp_stream* stream=&info->stream[i];
+
+      if ( stream->streamid == own_streamid ||
+	   stream->frontend < 1 || stream->frontend > SATIP_SDP_MAX_FE )
+	continue;
+
+      DEBUG(MSG_NET,"stream=%d fe=%d %s\n",stream->streamid,stream->frontend,
+	    stream->active ? "active" : "inactive");
+      used |= SATIP_SDP_FE_BIT(stream->frontend);
+    }
+
+  return used;
+}
+
+int satip_sdp_free_frontend(t_satip_sdp* info, t_satip_msys msys, unsigned int used)
+{
+  int fe;
+  int first=1;
+  int i;
+
+  if ( msys == SATIP_MSYS_UNKNOWN )
+    return 0;
+
+  for ( i=0; i<msys; i++ )
+    first += info->tuners[i];
+
+  for ( fe=first; fe<first+info->tuners[msys] && fe<=SATIP_SDP_MAX_FE; fe++ )
+    if ( !(used & SATIP_SDP_FE_BIT(fe)) &&
+	 satip_sdp_frontend_msys(info,fe) == msys )
+      return fe;
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * satip: server capabilities and stream state from DESCRIBE
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_SDP_H
+#define _SATIP_SDP_H
+
+/* tuner families as counted in "s=SatIPServer:1 S2,T,C" */
+typedef enum
+  {
+    SATIP_MSYS_UNKNOWN = -1,
+    SATIP_MSYS_SAT = 0,   /* dvbs, dvbs2 */
+    SATIP_MSYS_TER,       /* dvbt, dvbt2 */
+    SATIP_MSYS_CAB,       /* dvbc, dvbc2 */
+    SATIP_MSYS_COUNT
+  } t_satip_msys;
+
+#define SATIP_SDP_MAX_STREAMS 32
+
+/* frontend numbers 1..32 as bits of an unsigned int */
+#define SATIP_SDP_MAX_FE 32
+#define SATIP_SDP_FE_BIT(fe) (1U << ((fe)-1))
+
+typedef struct satip_sdp_stream
+{
+  int streamid;
+  int frontend;       /* 0 = not reported */
+  t_satip_msys msys;
+  int active;         /* a=sendonly, else a=inactive */
+} t_satip_sdp_stream;
+
+typedef struct satip_sdp
+{
+  int tuners[SATIP_MSYS_COUNT];
+  int nstreams;
+  t_satip_sdp_stream stream[SATIP_SDP_MAX_STREAMS];
+} t_satip_sdp;
+
+/* session description of DESCRIBE response, tuner counts are kept if absent */
+int satip_sdp_parse(const char* sdp, t_satip_sdp* info);
+
+/* X_SATIPCAP style "DVBS2-2,DVBT-4,DVBC-1" */
+int satip_sdp_parse_caps(const char* caps, int* tuners);
+
+t_satip_msys satip_sdp_msys(unsigned int delsys);
+t_satip_msys satip_sdp_msys_by_name(const char* name);  /* "dvbs2", "DVBT", ... */
+t_satip_msys satip_sdp_frontend_msys(t_satip_sdp* info, int frontend);
+
+/* frontends held by other sessions */
+unsigned int satip_sdp_used(t_satip_sdp* info, int own_streamid);
+
+/* lowest free frontend of family msys, 0 = none known */
+int satip_sdp_free_frontend(t_satip_sdp* info, t_satip_msys msys, unsigned int used);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * satip: transponder sharing between adapters
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "satip_share.h"
+#include "log.h"
+
+
+t_satip_share* satip_share_new(void)
+{
+  t_satip_share* share;
+
+  share=(t_satip_share*)malloc(sizeof(t_satip_share));
+  memset(share, 0, sizeof(t_satip_share));
+
+  return share;
+}
+
+int satip_share_add(t_satip_share* share, t_satip_config* cfg, t_satip_config* session,
+		    struct satip_rtp* srtp, int fd)
+{
+  t_satip_share_member* m;
+
+  if ( share->count == SATIP_SHARE_MAX )
+    return -1;
+
+  m=&share->member[share->count];
+  m->cfg = cfg;
+  m->session = session;
+  m->srtp = srtp;
+  m->fd = fd;
+  m->owner = -1;
+
+  /* adapter gets its own pids only, from whichever session feeds it */
+  satip_rtp_sinks_only(srtp);
+
+  return share->count++;
+}
+
+static void close_session(t_satip_config* session)
+{
+  if ( satip_valid_config(session) && !satip_close_requested(session) )
+    satip_close(session);
+}
+
+/* adapters fed by the session of member s */
+static int group_size(t_satip_share* share, int s)
+{
+  int i,n=0;
+
+  for ( i=0; i<share->count; i++ )
+    if ( share->member[i].owner == s )
+      n++;
+  return n;
+}
+
+/*
+ * session of s carries the union of all pids of its group,
+ * each adapter of the group gets its own pids only
+ */
+static void sync_pids(t_satip_share* share, int s)
+{
+  t_satip_share_member* o=&share->member[s];
+  unsigned char all[SATIP_RTP_PIDMAP_SIZE];
+  unsigned char own[SATIP_RTP_PIDMAP_SIZE];
+  int i;
+
+  memset(all, 0, sizeof(all));
+
+  for ( i=0; i<share->count; i++ )
+    {
+      t_satip_share_member* m=&share->member[i];
+
+      if ( m->owner != s )
+	continue;
+
+      satip_get_pidmap(m->cfg, all);
+
+      memset(own, 0, sizeof(own));
+      satip_get_pidmap(m->cfg, own);
+      if ( satip_rtp_set_sink(o->srtp, i, m->fd, m->cfg->tune_id, own) )
+	ERROR(MSG_MAIN,"share: too many adapters on stream of adapter %d\n",s);
+    }
+
+  satip_set_pidmap(o->session, all);
+}
+
+/*
+ * adapter tunes away or closes, the rest of its group stays on the
+ * running session, even if that is the one of the adapter
+ */
+static void leave(t_satip_share* share, int id)
+{
+  t_satip_share_member* m=&share->member[id];
+  int s=m->owner;
+
+  if ( s < 0 )
+    return;
+
+  m->owner = -1;
+  satip_rtp_del_sink(share->member[s].srtp, id);
+
+  if ( group_size(share, s) == 0 )
+    close_session(share->member[s].session);
+  else
+    {
+      if ( s == id )
+	INFO(MSG_MAIN,"share: stream of adapter %d kept for the others\n",id);
+      sync_pids(share, s);
+    }
+}
+
+/*
+ * adapter tunes, use a running session on the same transponder if any,
+ * else its own one or, while that still feeds others, a free one
+ */
+static void join(t_satip_share* share, int id)
+{
+  t_satip_share_member* m=&share->member[id];
+  int s=id;
+  int i;
+
+  for ( i=0; i<share->count; i++ )
+    {
+      t_satip_share_member* o=&share->member[i];
+
+      if ( group_size(share, i) > 0 &&
+	   satip_valid_config(o->session) && !satip_close_requested(o->session) &&
+	   satip_same_transponder(o->session, m->cfg) )
+	{
+	  INFO(MSG_MAIN,"share: adapter %d uses stream of adapter %d\n",id,i);
+	  m->owner = i;
+	  sync_pids(share, i);
+	  return;
+	}
+    }
+
+  /* one session per adapter, so one is free while id is in no group */
+  if ( group_size(share, id) > 0 )
+    for ( s=0; s<share->count && group_size(share, s) > 0; s++ )
+      ;
+  if ( s == share->count )
+    return;
+
+  if ( s != id )
+    INFO(MSG_MAIN,"share: adapter %d uses free stream of adapter %d\n",id,s);
+  m->owner = s;
+  satip_copy_tuning(share->member[s].session, m->cfg);
+  sync_pids(share, s);
+}
+
+void satip_share_update(t_satip_share* share)
+{
+  int i,s;
+
+  for ( i=0; i<share->count; i++ )
+    {
+      t_satip_share_member* m=&share->member[i];
+
+      switch ( m->cfg->status )
+	{
+	case SATIPCFG_CHANGED:
+	  s = m->owner;
+	  if ( s >= 0 && !satip_same_transponder(share->member[s].session, m->cfg) )
+	    leave(share, i);
+	  else if ( s >= 0 )
+	    {
+	      /* retune on the same transponder keeps the group */
+	      if ( s == i || group_size(share, s) == 1 )
+		satip_copy_tuning(share->member[s].session, m->cfg);
+	      sync_pids(share, s);
+	    }
+
+	  if ( m->owner < 0 )
+	    join(share, i);
+
+	  satip_settle_config(m->cfg);
+	  break;
+
+	case SATIPCFG_PID_CHANGED:
+	  if ( m->owner >= 0 )
+	    sync_pids(share, m->owner);
+	  satip_settle_config(m->cfg);
+	  break;
+
+	case SATIPCFG_CLOSING:
+	  leave(share, i);
+	  m->cfg->status = SATIPCFG_INCOMPLETE;
+	  break;
+
+	default:
+	  break;
+	}
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * satip: transponder sharing between adapters
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as 
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_SHARE_H
+#define _SATIP_SHARE_H
+
+#include "satip_config.h"
+#include "satip_rtp.h"
+
+#define SATIP_SHARE_MAX SATIP_MAX_TUNERS
+
+typedef struct satip_share_member
+{
+  t_satip_config* cfg;      /* as requested by the adapter */
+  t_satip_config* session;  /* RTSP session of the member, may feed other adapters */
+  struct satip_rtp* srtp;   /* of the session, all adapters it feeds are sinks */
+  int fd;                   /* adapter TS output */
+  int owner;                /* member whose session feeds the adapter, -1 = none */
+} t_satip_share_member;
+
+typedef struct satip_share
+{
+  int count;
+  t_satip_share_member member[SATIP_SHARE_MAX];
+} t_satip_share;
+
+t_satip_share* satip_share_new(void);
+int satip_share_add(t_satip_share* share, t_satip_config* cfg, t_satip_config* session,
+		    struct satip_rtp* srtp, int fd);
+
+/* apply adapter changes to the sessions, call before the RTSP updates */
+void satip_share_update(t_satip_share* share);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * satip: statistics in shared memory
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "satip_shm.h"
+#include "satip_rtsp.h"
+#include "log.h"
+
+#if SATIP_SHM_MAX_TUNERS < SATIP_MAX_TUNERS
+#error "SATIP_SHM_MAX_TUNERS must hold all tuners"
+#endif
+
+typedef struct shm_source
+{
+  const char* device;
+  t_satip_config* cfg;
+  t_satip_rtp* srtp;
+  struct satip_rtsp* rtsp;
+} t_shm_source;
+
+static t_shm_source sources[SATIP_SHM_MAX_TUNERS];
+static int source_count = 0;
+static t_satip_shm* shm = NULL;
+static char shm_name[32];
+
+
+static void shm_update_tuner(t_satip_shm_tuner* t, t_shm_source* src)
+{
+  t_satip_rtp_counters rc;
+  const t_satip_rtsp_counters* sc;
+  int i,j;
+
+  snprintf(t->device, sizeof(t->device), "%s", src->device);
+  t->config_status = src->cfg->status;
+  t->frequency = src->cfg->frequency;
+  t->pid_all = src->cfg->pid_all;
+  t->pids = 0;
+  for ( i=0; i<SATIPCFG_PID_WORDS; i++ )
+    t->pids += __builtin_popcountll(src->cfg->pid_target[i]);
+
+  if ( !satip_valid_config(src->cfg) ||
+       satip_prepare_tuning(src->cfg, t->tuning, sizeof(t->tuning)) < 0 )
+    t->tuning[0] = 0;
+
+  satip_rtp_get_counters(src->srtp, &rc);
+  t->signallevel = rc.signallevel;
+  t->quality = rc.quality;
+  t->lock = rc.lock;
+  t->datagrams = rc.datagrams;
+  t->bytes = rc.bytes;
+  t->seq_lost = rc.seq_lost;
+  t->seq_resets = rc.seq_resets;
+  t->fillers = rc.fillers;
+  t->rtcp = rc.rtcp;
+  t->zaps = 0;
+  t->zap_usec = 0;
+  for ( i=0; i<SATIPCFG_PREFETCH_KINDS; i++ )
+    {
+      t->zaps += rc.zaps[i];
+      t->zap_usec += rc.zap_usec[i];
+    }
+
+  sc = satip_rtsp_get_counters(src->rtsp);
+  for ( i=0; i<SATIP_SHM_REQUESTS; i++ )
+    for ( j=0; j<3; j++ )
+      t->requests[i][j] = sc->requests[i][j];
+  t->connects = sc->connects;
+  t->timeouts = sc->timeouts;
+}
+
+/* seqlock writer, readers retry while seq is odd or has changed */
+static void shm_update(void* param)
+{
+  struct timespec now;
+  int i;
+
+  UNUSED(param);
+
+  __atomic_store_n(&shm->seq, shm->seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for ( i=0; i<source_count; i++ )
+    shm_update_tuner(&shm->tuner[i], &sources[i]);
+  shm->ntuners = source_count;
+  clock_gettime(CLOCK_REALTIME, &now);
+  shm->updated = (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+
+  __atomic_store_n(&shm->seq, shm->seq+1, __ATOMIC_RELEASE);
+}
+
+static void shm_remove(void)
+{
+  shm_unlink(shm_name);
+}
+
+int satip_shm_start(struct polltimer_queue* queue, int interval)
+{
+  int fd;
+
+  if ( interval <= 0 || shm != NULL )
+    return 0;
+
+  snprintf(shm_name, sizeof(shm_name), "/" SATIP_SHM_PREFIX "%d", (int)getpid());
+
+  /* left by an earlier process of this pid, one created by others is refused */
+  shm_unlink(shm_name);
+  fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if ( fd < 0 )
+    {
+      ERROR(MSG_MAIN,"cannot create shared memory %s: %s\n",shm_name,strerror(errno));
+      return -1;
+    }
+
+  if ( ftruncate(fd, sizeof(t_satip_shm)) ||
+       (shm = (t_satip_shm*)mmap(NULL, sizeof(t_satip_shm), PROT_READ|PROT_WRITE,
+				 MAP_SHARED, fd, 0)) == MAP_FAILED )
+    {
+      ERROR(MSG_MAIN,"cannot map shared memory %s: %s\n",shm_name,strerror(errno));
+      shm = NULL;
+      close(fd);
+      shm_unlink(shm_name);
+      return -1;
+    }
+  close(fd);
+  atexit(shm_remove);
+
+  /* zero filled by ftruncate */
+  shm->size = sizeof(t_satip_shm);
+  shm->tuner_size = sizeof(t_satip_shm_tuner);
+  shm->version = SATIP_SHM_VERSION;
+  shm->pid = getpid();
+  shm->interval = interval;
+  shm_update(NULL);
+  __atomic_store_n(&shm->magic, SATIP_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  polltimer_periodic_start(queue, shm_update, interval, NULL);
+
+  DEBUG(MSG_MAIN,"statistics in shared memory %s\n",shm_name);
+  return 0;
+}
+
+void satip_shm_add_tuner(const char* device, t_satip_config* cfg,
+			 t_satip_rtp* srtp, struct satip_rtsp* rtsp)
+{
+  t_shm_source* src;
+
+  if ( source_count == SATIP_SHM_MAX_TUNERS )
+    return;
+
+  src = &sources[source_count++];
+  src->device = device != NULL ? device : "";
+  src->cfg = cfg;
+  src->srtp = srtp;
+  src->rtsp = rtsp;
+}
@@ -0,0 +1,103 @@
+/*
+ * satip: statistics in shared memory
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_SHM_H
+#define _SATIP_SHM_H
+
+#include <stdint.h>
+
+/*
+ * Segment "/satip-<pid>" of every instance, see shm_overview(7). Only
+ * the main thread writes it, from a snapshot of the counters, readers
+ * take a consistent copy by the seqlock and never block the writer.
+ * Layout of this header is shared with satip-stat, fixed size types only.
+ */
+#define SATIP_SHM_PREFIX     "satip-"
+#define SATIP_SHM_MAGIC      0x50495453  /* "STIP" */
+#define SATIP_SHM_VERSION    2
+#define SATIP_SHM_MAX_TUNERS 16          /* at least SATIP_MAX_TUNERS */
+#define SATIP_SHM_REQUESTS   5           /* OPTIONS SETUP PLAY TEARDOWN DESCRIBE */
+
+/* default publish interval in msec */
+#define SATIP_SHM_INTERVAL   1000
+
+typedef struct satip_shm_tuner
+{
+  char device[32];
+
+  /* tuning from t_satip_config */
+  int32_t config_status;     /* t_satip_config_status */
+  uint32_t frequency;        /* MHz */
+  uint32_t pids;             /* requested */
+  int32_t pid_all;           /* server streams all pids */
+  char tuning[128];          /* query as sent, empty = incomplete */
+
+  /* RTCP */
+  int32_t signallevel;       /* 0-255 */
+  int32_t quality;           /* 0-15 */
+  int32_t lock;              /* -1 = unknown */
+  int32_t reserved;
+
+  /* RTP */
+  uint64_t datagrams;
+  uint64_t bytes;
+  uint64_t seq_lost;
+  uint64_t seq_resets;
+  uint64_t fillers;
+  uint64_t rtcp;
+  uint64_t zaps;
+  uint64_t zap_usec;
+
+  /* RTSP: ok, error status, no response */
+  uint64_t requests[SATIP_SHM_REQUESTS][3];
+  uint64_t connects;
+  uint64_t timeouts;
+} t_satip_shm_tuner;
+
+typedef struct satip_shm
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;             /* of the whole segment */
+  uint32_t tuner_size;       /* sizeof(t_satip_shm_tuner) */
+  int32_t pid;
+  uint32_t interval;         /* msec between updates */
+  uint32_t seq;              /* odd while an update is written */
+  uint32_t ntuners;
+  uint64_t updated;          /* usec, CLOCK_REALTIME */
+  t_satip_shm_tuner tuner[SATIP_SHM_MAX_TUNERS];
+} t_satip_shm;
+
+#ifndef SATIP_SHM_READER
+
+#include "satip_config.h"
+#include "satip_rtp.h"
+#include "polltimer.h"
+
+struct satip_rtsp;
+
+/* creates the segment and updates it every interval msec, removed at exit */
+int  satip_shm_start(struct polltimer_queue* queue, int interval);
+
+void satip_shm_add_tuner(const char* device, t_satip_config* cfg,
+			 t_satip_rtp* srtp, struct satip_rtsp* rtsp);
+
+#endif
+
+#endif
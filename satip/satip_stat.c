@@ -0,0 +1,293 @@
+/*
+ * satip-stat: live view of the statistics of all satip instances
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SATIP_SHM_READER
+#include "satip_shm.h"
+
+#define SHM_DIR       "/dev/shm"
+#define MAX_INSTANCES 64
+
+/* copy is torn while seq is odd or changed, give up on a stuck writer */
+#define READ_RETRIES  1000
+
+typedef struct instance
+{
+  char name[256];
+  const t_satip_shm* shm;   /* mapped read only */
+  t_satip_shm now;
+  t_satip_shm prev;
+  int have_prev;
+  int seen;
+} t_instance;
+
+static t_instance instances[MAX_INSTANCES];
+static int instance_count = 0;
+
+static const char* config_status[] =
+  { "incomplete", "pids", "tuning", "settled", "closing" };
+
+
+static int read_copy(const t_satip_shm* shm, t_satip_shm* copy)
+{
+  uint32_t seq1,seq2;
+  int i;
+
+  for ( i=0; i<READ_RETRIES; i++ )
+    {
+      seq1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+      if ( seq1 & 1 )
+	continue;
+      memcpy(copy, shm, sizeof(*copy));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      seq2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+      if ( seq1 == seq2 )
+	return 0;
+    }
+  return -1;
+}
+
+static const t_satip_shm* map_segment(const char* name)
+{
+  char path[264];
+  struct stat st;
+  void* p;
+  int fd;
+
+  snprintf(path, sizeof(path), "/%s", name);
+  fd = shm_open(path, O_RDONLY, 0);
+  if ( fd < 0 )
+    return NULL;
+
+  if ( fstat(fd, &st) || st.st_size < (off_t)sizeof(t_satip_shm) )
+    {
+      close(fd);
+      return NULL;
+    }
+
+  p = mmap(NULL, sizeof(t_satip_shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if ( p == MAP_FAILED )
+    return NULL;
+
+  /* other layouts are not understood */
+  if ( __atomic_load_n(&((t_satip_shm*)p)->magic, __ATOMIC_ACQUIRE) != SATIP_SHM_MAGIC ||
+       ((t_satip_shm*)p)->version != SATIP_SHM_VERSION ||
+       ((t_satip_shm*)p)->tuner_size != sizeof(t_satip_shm_tuner) )
+    {
+      munmap(p, sizeof(t_satip_shm));
+      return NULL;
+    }
+
+  return (const t_satip_shm*)p;
+}
+
+/* new segments are mapped, removed ones unmapped */
+static void scan_segments(void)
+{
+  struct dirent* de;
+  DIR* dir;
+  int i;
+
+  for ( i=0; i<instance_count; i++ )
+    instances[i].seen = 0;
+
+  dir = opendir(SHM_DIR);
+  if ( dir == NULL )
+    return;
+
+  while ( ( de = readdir(dir) ) != NULL )
+    {
+      if ( strncmp(de->d_name, SATIP_SHM_PREFIX, strlen(SATIP_SHM_PREFIX)) )
+	continue;
+
+      for ( i=0; i<instance_count && strcmp(instances[i].name, de->d_name); i++ )
+	;
+
+      if ( i == instance_count )
+	{
+	  const t_satip_shm* shm;
+
+	  if ( instance_count == MAX_INSTANCES || ( shm = map_segment(de->d_name) ) == NULL )
+	    continue;
+	  snprintf(instances[i].name, sizeof(instances[i].name), "%s", de->d_name);
+	  instances[i].shm = shm;
+	  instances[i].have_prev = 0;
+	  instance_count++;
+	}
+      instances[i].seen = 1;
+    }
+  closedir(dir);
+
+  for ( i=0; i<instance_count; )
+    if ( !instances[i].seen )
+      {
+	munmap((void*)instances[i].shm, sizeof(t_satip_shm));
+	instances[i] = instances[--instance_count];
+      }
+    else
+      i++;
+}
+
+static uint64_t requests_with(const t_satip_shm_tuner* t, int result)
+{
+  uint64_t sum=0;
+  int i;
+
+  for ( i=0; i<SATIP_SHM_REQUESTS; i++ )
+    sum += t->requests[i][result];
+  return sum;
+}
+
+static void show(void)
+{
+  struct timespec ts;
+  uint64_t now;
+  unsigned int j;
+  int i;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  now = (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+
+  printf("%-7s %-18s %-10s %6s %5s %7s %7s %8s %7s %7s %6s %7s %5s %5s\n",
+	 "PID", "DEVICE", "STATE", "MHZ", "PIDS", "LVL/Q", "MBIT/S", "PKT/S",
+	 "LOST", "FILLER", "ZAPS", "ZAP MS", "ERR", "CONN");
+
+  for ( i=0; i<instance_count; i++ )
+    {
+      t_instance* in=&instances[i];
+      double secs;
+
+      if ( read_copy(in->shm, &in->now) )
+	{
+	  printf("%-7s busy\n", in->name+strlen(SATIP_SHM_PREFIX));
+	  continue;
+	}
+
+      secs = in->have_prev ? ( in->now.updated - in->prev.updated ) / 1000000.0 : 0;
+
+      for ( j=0; j<in->now.ntuners && j<SATIP_SHM_MAX_TUNERS; j++ )
+	{
+	  const t_satip_shm_tuner* t=&in->now.tuner[j];
+	  const t_satip_shm_tuner* p=&in->prev.tuner[j];
+	  char level[16];
+
+	  if ( t->lock < 0 )
+	    snprintf(level, sizeof(level), "-");
+	  else
+	    snprintf(level, sizeof(level), "%d/%d%s", t->signallevel, t->quality, t->lock ? "" : "!");
+
+	  printf("%-7d %-18.18s %-10s %6u %5u%s %7s ",
+		 (int)in->now.pid, t->device,
+		 t->config_status >= 0 && t->config_status < 5 ? config_status[t->config_status] : "?",
+		 t->frequency, t->pids, t->pid_all ? "*" : " ", level);
+
+	  if ( secs > 0 )
+	    printf("%7.2f %8.0f ",
+		   ( t->bytes - p->bytes ) * 8 / secs / 1000000,
+		   ( t->datagrams - p->datagrams ) / secs);
+	  else
+	    printf("%7s %8s ", "-", "-");
+
+	  printf("%7llu %7llu %6llu %7.0f %5llu %5llu\n",
+		 (unsigned long long)t->seq_lost, (unsigned long long)t->fillers,
+		 (unsigned long long)t->zaps,
+		 t->zaps ? t->zap_usec / 1000.0 / t->zaps : 0.0,
+		 (unsigned long long)( requests_with(t, 1) + requests_with(t, 2) ),
+		 (unsigned long long)t->connects);
+	}
+
+      /* no update for three intervals, process hangs or is gone */
+      if ( now > in->now.updated + 3000ULL*in->now.interval )
+	printf("%-7d stale for %llu s\n", (int)in->now.pid,
+	       (unsigned long long)( ( now - in->now.updated ) / 1000000 ));
+
+      if ( !in->have_prev || in->now.updated != in->prev.updated )
+	{
+	  in->prev = in->now;
+	  in->have_prev = 1;
+	}
+    }
+
+  fflush(stdout);
+}
+
+static void usage(const char* name)
+{
+  fprintf(stderr,
+	  "usage: %s [-i seconds] [-n count]\n"
+	  "  -i\trefresh interval (defaults to 1)\n"
+	  "  -n\tnumber of views, then exit (defaults to unlimited)\n"
+	  "    \tcolumns: LVL/Q level/quality of RTCP, ! = no lock, PIDS * = server sends all,\n"
+	  "    \tERR = RTSP requests failed or unanswered, CONN = RTSP connects\n",
+	  name);
+}
+
+int main(int argc, char** argv)
+{
+  struct timespec interval = { 1, 0 };
+  int count = -1;
+  int clear = isatty(STDOUT_FILENO);
+  int opt;
+
+  while ( ( opt = getopt(argc, argv, "i:n:h") ) != -1 )
+    switch ( opt )
+      {
+      case 'i':
+	{
+	  double secs = atof(optarg);
+	  if ( secs <= 0 )
+	    secs = 1;
+	  interval.tv_sec = (time_t)secs;
+	  interval.tv_nsec = (long)( ( secs - interval.tv_sec ) * 1000000000 );
+	}
+	break;
+
+      case 'n':
+	count = atoi(optarg);
+	break;
+
+      default:
+	usage(argv[0]);
+	exit(1);
+      }
+
+  while ( count != 0 )
+    {
+      scan_segments();
+      if ( clear )
+	printf("\033[H\033[2J");
+      show();
+
+      if ( count > 0 && --count == 0 )
+	break;
+      nanosleep(&interval, NULL);
+    }
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * satip: zap tracing
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "satip_trace.h"
+#include "log.h"
+
+typedef struct trace_event
+{
+  uint64_t usec;       /* CLOCK_MONOTONIC */
+  uint32_t stamp;      /* ring position + 1 once written completely */
+  int track;
+  int point;
+  int arg;
+} t_trace_event;
+
+static t_trace_event ring[SATIP_TRACE_EVENTS];
+static uint32_t ring_next = 0;
+
+static const char* point_names[SATIP_TRACE_POINTS] =
+  {
+    "SET_FRONTEND",
+    "SETUP sent",
+    "PLAY sent",
+    "200 OK",
+    "first RTP",
+    "first TS",
+    "RTCP lock",
+  };
+
+static const char* point_args[SATIP_TRACE_POINTS] =
+  { "frequency", "cseq", "cseq", "status", "bytes", "bytes", "level" };
+
+
+void satip_trace(int track, t_satip_trace_point point, int arg)
+{
+  uint32_t pos = __atomic_fetch_add(&ring_next, 1, __ATOMIC_RELAXED);
+  t_trace_event* e = &ring[pos & (SATIP_TRACE_EVENTS-1)];
+  struct timespec now;
+
+  /* readers skip the slot until it is complete */
+  __atomic_store_n(&e->stamp, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  e->usec = (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+  e->track = track;
+  e->point = point;
+  e->arg = arg;
+
+  __atomic_store_n(&e->stamp, pos+1, __ATOMIC_RELEASE);
+}
+
+static int by_time(const void* a, const void* b)
+{
+  const t_trace_event* x=(const t_trace_event*)a;
+  const t_trace_event* y=(const t_trace_event*)b;
+
+  if ( x->track != y->track )
+    return x->track < y->track ? -1 : 1;
+  if ( x->usec != y->usec )
+    return x->usec < y->usec ? -1 : 1;
+  return x->point - y->point;
+}
+
+/* consistent copy of the events still in the ring */
+static int trace_copy(t_trace_event* events)
+{
+  uint32_t end = __atomic_load_n(&ring_next, __ATOMIC_ACQUIRE);
+  uint32_t pos = end > SATIP_TRACE_EVENTS ? end-SATIP_TRACE_EVENTS : 0;
+  int n = 0;
+
+  for ( ; pos != end; pos++ )
+    {
+      t_trace_event* e = &ring[pos & (SATIP_TRACE_EVENTS-1)];
+
+      if ( __atomic_load_n(&e->stamp, __ATOMIC_ACQUIRE) != pos+1 )
+	continue;
+      events[n] = *e;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if ( __atomic_load_n(&e->stamp, __ATOMIC_RELAXED) == pos+1 )
+	n++;
+    }
+
+  qsort(events, n, sizeof(t_trace_event), by_time);
+  return n;
+}
+
+static void dump_span(FILE* f, int pid, int track, const char* name,
+		      uint64_t start, uint64_t end, int* first)
+{
+  fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"zap\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+	  "\"ts\":%llu,\"dur\":%llu}",
+	  *first ? "" : ",", name, pid, track,
+	  (unsigned long long)start, (unsigned long long)(end-start));
+  *first = 0;
+}
+
+/*
+ * per track: instant events for all points, a "zap" span from
+ * SET_FRONTEND to its last point, and spans between the points named
+ * by the point reached. Without SET_FRONTEND, e.g. in test mode, a
+ * tuning request after data was received starts the next zap.
+ */
+int satip_trace_dump(const char* file)
+{
+  t_trace_event* events;
+  char span[40];
+  FILE* f = NULL;
+  int pid = getpid();
+  int first = 1;
+  int n,i,zap,fd;
+  int zap_data = 0;
+
+  events = (t_trace_event*)malloc(SATIP_TRACE_EVENTS*sizeof(t_trace_event));
+  if ( events == NULL )
+    return -1;
+  n = trace_copy(events);
+
+  /* never through a link put in its place */
+  fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+  if ( fd >= 0 && ( f = fdopen(fd, "w") ) == NULL )
+    close(fd);
+  if ( f == NULL )
+    {
+      ERROR(MSG_MAIN,"cannot write trace %s: %s\n",file,strerror(errno));
+      free(events);
+      return -1;
+    }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for ( i=0, zap=-1; i<n; i++ )
+    {
+      t_trace_event* e=&events[i];
+      int starts;
+
+      if ( i==0 || events[i-1].track != e->track )
+	{
+	  fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+		  "\"args\":{\"name\":\"tuner fd %d\"}}",
+		  first ? "" : ",", pid, e->track, e->track);
+	  first = 0;
+	  zap = -1;
+	}
+
+      fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"zap\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,"
+	      "\"ts\":%llu,\"args\":{\"%s\":%d}}",
+	      point_names[e->point], pid, e->track, (unsigned long long)e->usec,
+	      point_args[e->point], e->arg);
+
+      /* requests until data arrives, e.g. retries, belong to the same zap */
+      starts = e->point == SATIP_TRACE_FRONTEND ||
+	( ( e->point == SATIP_TRACE_SETUP || e->point == SATIP_TRACE_PLAY ) &&
+	  ( zap < 0 || zap_data ) );
+
+      if ( starts )
+	{
+	  if ( zap >= 0 )
+	    dump_span(f, pid, e->track, "zap", events[zap].usec, events[i-1].usec, &first);
+	  zap = i;
+	  zap_data = 0;
+	}
+      else if ( zap >= 0 )
+	{
+	  snprintf(span, sizeof(span), "to %s", point_names[e->point]);
+	  dump_span(f, pid, e->track, span, events[i-1].usec, e->usec, &first);
+	  if ( e->point >= SATIP_TRACE_FIRST_RTP )
+	    zap_data = 1;
+	}
+
+      if ( zap >= 0 && ( i+1 == n || events[i+1].track != e->track ) )
+	dump_span(f, pid, e->track, "zap", events[zap].usec, e->usec, &first);
+    }
+
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  free(events);
+
+  INFO(MSG_MAIN,"%d trace events written to %s\n",n,file);
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * satip: zap tracing
+ *
+ * Copyright (C) 2014  mc.fishdish@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _SATIP_TRACE_H
+#define _SATIP_TRACE_H
+
+#include "satip_config.h"
+
+/* last events kept, power of 2 */
+#define SATIP_TRACE_EVENTS 4096
+
+/* written on SIGUSR1, %d = pid */
+#define SATIP_TRACE_FILE SATIP_RUN_DIR "/trace-%d.json"
+
+/* points of a zap in order, a new one starts with FRONTEND */
+typedef enum
+  {
+    SATIP_TRACE_FRONTEND = 0,   /* MSG_SET_FRONTEND from vtuner */
+    SATIP_TRACE_SETUP,          /* SETUP sent */
+    SATIP_TRACE_PLAY,           /* PLAY with tuning sent */
+    SATIP_TRACE_ANSWERED,       /* 200 OK on the tuning request */
+    SATIP_TRACE_FIRST_RTP,      /* first datagram after the answer */
+    SATIP_TRACE_FIRST_TS,       /* first TS packets written */
+    SATIP_TRACE_LOCK,           /* first RTCP reporting lock */
+    SATIP_TRACE_POINTS
+  } t_satip_trace_point;
+
+#define SATIP_TRACE_BIT(point) (1U << (point))
+
+/*
+ * record point for track, the vtuner fd of the tuner; callable from
+ * any thread without lock
+ */
+void satip_trace(int track, t_satip_trace_point point, int arg);
+
+/* Chrome/Perfetto trace event JSON of the events kept */
+int  satip_trace_dump(const char* file);
+
+#endif
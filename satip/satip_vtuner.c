@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <linux/dvb/version.h>
 #include <linux/dvb/frontend.h>
@@ -32,6 +33,9 @@
 
 #include "satip_config.h"
 #include "satip_vtuner.h"
+#include "satip_trace.h"
+#include "satip_pmtcache.h"
+#include "polltimer.h"
 #include "log.h"
 
 /* driver interface */
@@ -40,10 +44,34 @@
 extern char *const strmap_fecinner[];
 extern char *const strmap_rolloff[];
 
+/* PAT NIT SDT EIT RST TDT, as added by the driver */
+static const unsigned short psi_pids[] = {0, 16, 17, 18, 19, 20};
+
+#define PSI_COUNT    (int)(sizeof(psi_pids) / sizeof(psi_pids[0]))
+#define PREFETCH_MAX (PSI_COUNT + 1 + SATIP_PMT_CACHE_PIDS)
+
 typedef struct satip_vtuner
 {
   int fd;
   t_satip_config *satip_cfg;
+
+  /* pids of the last MSG_PIDLIST, in order and as bitmap */
+  unsigned short requested[MAX_PIDTAB_LEN];
+  int requested_count;
+  uint64_t requested_map[SATIPCFG_PID_WORDS];
+
+  /* pids added on tuning until the grace time is over, PSI first */
+  struct polltimer_queue *timer_queue;
+  struct polltimer *prefetch_timer;
+  int prefetch_grace;
+  int *update;
+  unsigned short prefetch[PREFETCH_MAX];
+  unsigned char prefetch_used[PREFETCH_MAX];
+  int prefetch_count;
+  uint64_t prefetch_start;
+  uint64_t prefetch_ahead;
+
+  t_satip_vtuner_counters counters;
 } t_satip_vtuner;
 
 t_satip_vtuner *satip_vtuner_new(char *devname, char *delsys, char *caids[VTUNER_MAX_SLOTS], char *sids[VTUNER_MAX_SLOTS], t_satip_config *satip_cfg)
@@ -59,6 +87,7 @@ t_satip_vtuner *satip_vtuner_new(char *devname, char *delsys, char *caids[VTUNER
   }
 
   vt = (t_satip_vtuner *)malloc(sizeof(t_satip_vtuner));
+  memset(vt, 0, sizeof(t_satip_vtuner));
 
   vt->fd = fd;
   vt->satip_cfg = satip_cfg;
@@ -154,6 +183,145 @@ int satip_vtuner_fd(struct satip_vtuner *vt)
   return vt->fd;
 }
 
+void satip_vtuner_set_prefetch(struct satip_vtuner *vt, struct polltimer_queue *queue, int grace, int *update)
+{
+  vt->timer_queue = queue;
+  vt->prefetch_grace = grace;
+  vt->update = update;
+}
+
+const t_satip_vtuner_counters *satip_vtuner_get_counters(struct satip_vtuner *vt)
+{
+  return &vt->counters;
+}
+
+static uint64_t now_usec(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int pid_requested(struct satip_vtuner *vt, unsigned short pid)
+{
+  return (vt->requested_map[pid / 64] >> (pid & 63)) & 1;
+}
+
+static void clear_requested(struct satip_vtuner *vt)
+{
+  vt->requested_count = 0;
+  memset(vt->requested_map, 0, sizeof(vt->requested_map));
+}
+
+/* pids of the application, plus the prefetched ones during the grace time */
+static void apply_pids(struct satip_vtuner *vt)
+{
+  int i;
+
+  satip_del_allpid(vt->satip_cfg);
+  for (i = 0; i < vt->requested_count; i++)
+    satip_add_pid(vt->satip_cfg, vt->requested[i]);
+  for (i = 0; i < vt->prefetch_count; i++)
+    satip_add_pid(vt->satip_cfg, vt->prefetch[i]);
+}
+
+static void prefetch_trim(void *param)
+{
+  struct satip_vtuner *vt = (struct satip_vtuner *)param;
+  int used = 0;
+  int i;
+
+  vt->prefetch_timer = NULL;
+
+  for (i = PSI_COUNT; i < vt->prefetch_count; i++)
+    if (vt->prefetch_used[i])
+      used++;
+
+  vt->counters.pids_used += used;
+  vt->counters.pids_trimmed += vt->prefetch_count - PSI_COUNT - used;
+  vt->counters.ahead_usec += vt->prefetch_ahead;
+
+  if (vt->prefetch_count > PSI_COUNT)
+    INFO(MSG_NET, "prefetch: %d of %d pids used, %d ms ahead\n",
+         used, vt->prefetch_count - PSI_COUNT, (int)(vt->prefetch_ahead / 1000));
+
+  vt->prefetch_count = 0;
+  apply_pids(vt);
+
+  /* outside of a vtuner event, the pids go out with the next update */
+  *vt->update = 1;
+}
+
+static void prefetch_stop(struct satip_vtuner *vt)
+{
+  polltimer_cancel(vt->timer_queue, &vt->prefetch_timer);
+  vt->prefetch_count = 0;
+}
+
+/*
+ * PSI and the pids of the service last used on the transponder go with
+ * the first PLAY, instead of one PLAY per table the application opens
+ */
+static void prefetch_start(struct satip_vtuner *vt)
+{
+  unsigned short pids[SATIP_PMT_CACHE_PIDS];
+  int count, pmt, i;
+
+  if (vt->prefetch_grace <= 0 || vt->timer_queue == NULL)
+    return;
+
+  prefetch_stop(vt);
+
+  for (i = 0; i < PSI_COUNT; i++)
+    vt->prefetch[vt->prefetch_count++] = psi_pids[i];
+
+  count = satip_pmtcache_predict(vt->satip_cfg, pids, &pmt);
+  if (pmt >= 0)
+  {
+    vt->prefetch[vt->prefetch_count++] = pmt;
+    if (vt->satip_cfg->pmt_count != 1 || vt->satip_cfg->pmt_pids[0] != pmt)
+    {
+      satip_clear_pmt(vt->satip_cfg);
+      satip_add_pmt(vt->satip_cfg, pmt);
+    }
+  }
+  for (i = 0; i < count; i++)
+    vt->prefetch[vt->prefetch_count++] = pids[i];
+
+  memset(vt->prefetch_used, 0, sizeof(vt->prefetch_used));
+  vt->prefetch_start = now_usec();
+  vt->prefetch_ahead = 0;
+  vt->prefetch_timer = polltimer_start(vt->timer_queue, prefetch_trim, vt->prefetch_grace, vt);
+
+  vt->counters.tunings++;
+  vt->satip_cfg->prefetch = SATIPCFG_PREFETCH_PSI;
+  if (vt->prefetch_count > PSI_COUNT)
+  {
+    vt->counters.predicted++;
+    vt->satip_cfg->prefetch = SATIPCFG_PREFETCH_PREDICTED;
+  }
+  DEBUG(MSG_NET, "prefetch %d pids, PMT %d\n", vt->prefetch_count, pmt);
+
+  apply_pids(vt);
+}
+
+/* lead of the prefetched pids over the application asking for them */
+static void prefetch_account(struct satip_vtuner *vt)
+{
+  uint64_t ahead;
+  int i;
+
+  for (i = PSI_COUNT; i < vt->prefetch_count; i++)
+    if (!vt->prefetch_used[i] && pid_requested(vt, vt->prefetch[i]))
+    {
+      vt->prefetch_used[i] = 1;
+      ahead = now_usec() - vt->prefetch_start;
+      if (ahead > vt->prefetch_ahead)
+        vt->prefetch_ahead = ahead;
+    }
+}
+
 static t_polarization get_polarization(struct satip_vtuner *vt, struct vtuner_message *msg)
 {
   char dbg[50];
@@ -278,42 +446,80 @@ static void set_frontend(struct satip_vtuner *vt, struct vtuner_message *msg)
     break;
   }
   vt->satip_cfg->tune_id = msg->body.fe_tune.tune_id;
+  satip_trace(vt->fd, SATIP_TRACE_FRONTEND, vt->satip_cfg->frequency);
+
+  /* pids of the previous transponder are no request on this one */
+  clear_requested(vt);
+  vt->satip_cfg->prefetch = SATIPCFG_PREFETCH_NONE;
+  prefetch_start(vt);
 }
 
 static void close_frontend(struct satip_vtuner *vt)
 {
   DEBUG(MSG_NET, "MSG_CLOSE_FRONTEND\n");
+  prefetch_stop(vt);
   satip_close(vt->satip_cfg);
 }
 
 static void set_pidlist(struct satip_vtuner *vt, struct vtuner_message *msg)
 {
   int i;
+  int pmt = -1;
+  int grown = 0;
+  int count = 0;
+  unsigned short pid;
+  unsigned short pids[MAX_PIDTAB_LEN];
+  uint64_t map[SATIPCFG_PID_WORDS];
 
-  satip_del_allpid(vt->satip_cfg);
+  memset(map, 0, sizeof(map));
 
   int hdr = 0;
   for (i = 0; i < MAX_PIDTAB_LEN; i++)
     if (msg->body.pidlist[i] < 8192)
     {
-      if (satip_add_pid(vt->satip_cfg, msg->body.pidlist[i]) == SATIPCFG_OK)
+      pid = msg->body.pidlist[i];
+      if ((map[pid / 64] >> (pid & 63)) & 1)
+        continue;
+      if (!pid_requested(vt, pid))
+        grown = 1;
+      map[pid / 64] |= 1ULL << (pid & 63);
+      pids[count++] = pid;
+      if (!hdr)
       {
-        if (!hdr)
-        {
-          DEBUG(MSG_NET, "MSG_SET_PIDLIST:\n");
-          hdr = 1;
-        }
-        DEBUG(MSG_NET, "%d\n", msg->body.pidlist[i]);
+        DEBUG(MSG_NET, "MSG_SET_PIDLIST:\n");
+        hdr = 1;
       }
+      DEBUG(MSG_NET, "%d\n", pid);
     }
     else if (msg->body.pidlist[i] != 0xffff)
     {
       INFO(MSG_NET, "got PMT: %i\n", msg->body.pidlist[i] & 0x1FFF);
-      // TODO: ADD HERE SOMETHING?
+      pmt = msg->body.pidlist[i] & 0x1FFF;
       satip_clear_pmt(vt->satip_cfg);
-      satip_add_pmt(vt->satip_cfg, msg->body.pidlist[i] & 0x1FFF);
+      satip_add_pmt(vt->satip_cfg, pmt);
+    }
 
+  memcpy(vt->requested, pids, count * sizeof(pids[0]));
+  memcpy(vt->requested_map, map, sizeof(map));
+  vt->requested_count = count;
+
+  if (pmt >= 0)
+    satip_pmtcache_learn(vt->satip_cfg, vt->requested_map, pmt);
+  else if (grown)
+  {
+    /* known service, x_pmt goes with the first PLAY of its pids */
+    pmt = satip_pmtcache_service(vt->satip_cfg, vt->requested_map);
+    if (pmt >= 0 && (vt->satip_cfg->pmt_count != 1 || vt->satip_cfg->pmt_pids[0] != pmt))
+    {
+      INFO(MSG_NET, "cached PMT: %i\n", pmt);
+      satip_clear_pmt(vt->satip_cfg);
+      satip_add_pmt(vt->satip_cfg, pmt);
     }
+  }
+
+  /* target set built once, with the prefetched pids still in grace */
+  prefetch_account(vt);
+  apply_pids(vt);
 }
 
 void satip_vtuner_event(struct satip_vtuner *vt)
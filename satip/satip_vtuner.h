@@ -21,11 +21,33 @@
 #define _SATIP_VTUNER_H
 
 
+#include <stdint.h>
+
+/* default ms prefetched pids are kept for the application to ask for */
+#define SATIP_PREFETCH_GRACE 5000
+
 struct satip_vtuner;
+struct polltimer_queue;
+
+typedef struct satip_vtuner_counters
+{
+  unsigned long tunings;      /* with pids prefetched */
+  unsigned long predicted;    /* of those with the pids of a cached service */
+  unsigned long pids_used;    /* predicted pids the application asked for in time */
+  unsigned long pids_trimmed; /* and those it did not */
+  uint64_t ahead_usec;        /* lead over the application asking, per tuning the longest */
+} t_satip_vtuner_counters;
 
 struct satip_vtuner* satip_vtuner_new(char* devname,char *delsys,char *caids[VTUNER_MAX_SLOTS], char*sids[VTUNER_MAX_SLOTS],struct satip_config* satip_cfg);
 int satip_vtuner_fd(struct satip_vtuner* vt);
 
+/*
+ * prefetch PSI and predicted pids on tuning for grace ms, 0 = off,
+ * *update is set when the timer of queue trims them
+ */
+void satip_vtuner_set_prefetch(struct satip_vtuner* vt,struct polltimer_queue* queue,int grace,int* update);
+const t_satip_vtuner_counters* satip_vtuner_get_counters(struct satip_vtuner* vt);
+
 void satip_vtuner_event(struct satip_vtuner* vt);
 
 